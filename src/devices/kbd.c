@@ -7,6 +7,7 @@
 #include "devices/shutdown.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/workqueue.h"
 
 /** Keyboard data register port. */
 #define DATA_REG 0x60
@@ -24,12 +25,23 @@ static bool caps_lock;
 /** Number of keys pressed. */
 static int64_t key_cnt;
 
+/** Scancodes read by the interrupt handler and not yet
+   interpreted, in a circular buffer, and the work item that
+   interprets them.  Both are protected by turning interrupts
+   off. */
+#define SCANCODE_CNT 64
+static unsigned scancodes[SCANCODE_CNT];
+static int scancode_head, scancode_tail;
+static struct work kbd_work;
+
 static intr_handler_func keyboard_interrupt;
+static work_func interpret_scancodes;
 
 /** Initializes the keyboard. */
 void
 kbd_init (void) 
 {
+  work_init (&kbd_work, interpret_scancodes, NULL);
   intr_register_ext (0x21, keyboard_interrupt, "8042 Keyboard");
 }
 
@@ -92,27 +104,72 @@ static const struct keymap shifted_keymap[] =
 
 static bool map_key (const struct keymap[], unsigned scancode, uint8_t *);
 
+static void interpret_key (unsigned code);
+
+/** Keyboard interrupt handler.  Reads the scancode, including
+   the second byte of a prefixed one, and queues it for
+   interpret_scancodes(), which does the rest with interrupts
+   on.  If the queue is full, the key is lost. */
 static void
 keyboard_interrupt (struct intr_frame *args UNUSED) 
+{
+  /* Keyboard scancode. */
+  unsigned code;
+  int next;
+
+  /* Read scancode, including second byte if prefix code. */
+  code = inb (DATA_REG);
+  if (code == 0xe0)
+    code = (code << 8) | inb (DATA_REG);
+
+  next = (scancode_head + 1) % SCANCODE_CNT;
+  if (next != scancode_tail) 
+    {
+      scancodes[scancode_head] = code;
+      scancode_head = next;
+    }
+  work_queue (WORK_HIGH, &kbd_work);
+}
+
+/** Interprets the scancodes queued by keyboard_interrupt(). */
+static void
+interpret_scancodes (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      enum intr_level old_level = intr_disable ();
+      unsigned code;
+
+      if (scancode_tail == scancode_head) 
+        {
+          intr_set_level (old_level);
+          break;
+        }
+      code = scancodes[scancode_tail];
+      scancode_tail = (scancode_tail + 1) % SCANCODE_CNT;
+      intr_set_level (old_level);
+
+      interpret_key (code);
+    }
+}
+
+/** Updates the keyboard state for scancode CODE and adds the
+   character it produces, if any, to the input buffer. */
+static void
+interpret_key (unsigned code) 
 {
   /* Status of shift keys. */
   bool shift = left_shift || right_shift;
   bool alt = left_alt || right_alt;
   bool ctrl = left_ctrl || right_ctrl;
 
-  /* Keyboard scancode. */
-  unsigned code;
-
   /* False if key pressed, true if key released. */
   bool release;
 
   /* Character that corresponds to `code'. */
   uint8_t c;
 
-  /* Read scancode, including second byte if prefix code. */
-  code = inb (DATA_REG);
-  if (code == 0xe0)
-    code = (code << 8) | inb (DATA_REG);
+  enum intr_level old_level;
 
   /* Bit 0x80 distinguishes key press from key release
      (even if there's a prefix). */
@@ -154,11 +211,13 @@ keyboard_interrupt (struct intr_frame *args UNUSED)
             c += 0x80;
 
           /* Append to keyboard buffer. */
+          old_level = intr_disable ();
           if (!input_full ())
             {
               key_cnt++;
               input_putc (c);
             }
+          intr_set_level (old_level);
         }
     }
   else
@@ -0,0 +1,240 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include <stdint.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/** Interface to the local Advanced Programmable Interrupt
+   Controller (APIC) that is built into each CPU.  We use it only
+   for what the 8259A PICs cannot do: interrupts between CPUs
+   (IPIs), including the ones that start up the application
+   processors, and a timer for each application processor.
+   External interrupts still come from the PICs, through the
+   bootstrap processor's local APIC in "virtual wire" mode, as
+   the BIOS left it.  Refer to [IA32-v3a] chapter 8 "Advanced
+   Programmable Interrupt Controller (APIC)" for details. */
+
+/** Local APIC registers, as byte offsets into its page. */
+#define LAPIC_ID        0x020   /**< Local APIC ID. */
+#define LAPIC_TPR       0x080   /**< Task priority. */
+#define LAPIC_EOI       0x0b0   /**< End of interrupt. */
+#define LAPIC_SVR       0x0f0   /**< Spurious interrupt vector. */
+#define LAPIC_ESR       0x280   /**< Error status. */
+#define LAPIC_ICR_LO    0x300   /**< Interrupt command, low 32 bits. */
+#define LAPIC_ICR_HI    0x310   /**< Interrupt command, high 32 bits. */
+#define LAPIC_LVT_TIMER 0x320   /**< Timer local vector table entry. */
+#define LAPIC_LVT_LINT0 0x350   /**< LINT0 local vector table entry. */
+#define LAPIC_LVT_LINT1 0x360   /**< LINT1 local vector table entry. */
+#define LAPIC_LVT_ERROR 0x370   /**< Error local vector table entry. */
+#define LAPIC_TIMER_INIT 0x380  /**< Timer initial count. */
+#define LAPIC_TIMER_CUR 0x390   /**< Timer current count. */
+#define LAPIC_TIMER_DIV 0x3e0   /**< Timer divide configuration. */
+
+/** Spurious interrupt vector register bits. */
+#define SVR_ENABLE      0x100   /**< APIC software enable. */
+
+/** Local vector table entry bits. */
+#define LVT_MASKED      0x10000 /**< Interrupt masked. */
+#define LVT_PERIODIC    0x20000 /**< Timer mode: periodic. */
+
+/** Interrupt command register bits. */
+#define ICR_INIT        0x00500 /**< Delivery mode: INIT. */
+#define ICR_STARTUP     0x00600 /**< Delivery mode: STARTUP. */
+#define ICR_PENDING     0x01000 /**< Delivery status: send pending. */
+#define ICR_ASSERT      0x04000 /**< Level: assert. */
+#define ICR_LEVEL       0x08000 /**< Trigger mode: level. */
+
+/** Timer divide configuration: divide bus clock by 16. */
+#define TIMER_DIV_16    0x3
+
+/** The local APIC's registers, mapped at a kernel virtual
+   address equal to their physical address, or a null pointer if
+   lapic_init() has not been called.  Every CPU sees its own
+   local APIC at the same address. */
+static volatile uint32_t *lapic;
+
+static void lapic_enable (void);
+static void reschedule_interrupt (struct intr_frame *);
+
+/** Reads local APIC register REG. */
+static inline uint32_t
+lapic_read (int reg)
+{
+  return lapic[reg / sizeof *lapic];
+}
+
+/** Writes VALUE to local APIC register REG, then waits for the
+   write to finish by reading back the ID register. */
+static inline void
+lapic_write (int reg, uint32_t value)
+{
+  lapic[reg / sizeof *lapic] = value;
+  lapic_read (LAPIC_ID);
+}
+
+/** Maps the local APIC registers, found at physical address
+   PADDR, into the kernel's address space, registers the
+   interrupts that local APICs deliver, and enables the
+   bootstrap processor's local APIC. */
+void
+lapic_init (uint32_t paddr)
+{
+  void *va = (void *) paddr;
+  uint32_t *pde = init_page_dir + pd_no (va);
+  uint32_t *pt;
+
+  ASSERT (pg_ofs (va) == 0);
+
+  /* Device memory must not be cached. */
+  if (*pde == 0)
+    *pde = pde_create (palloc_get_page (PAL_ASSERT | PAL_ZERO));
+  pt = pde_get_pt (*pde);
+  pt[pt_no (va)] = paddr | PTE_PCD | PTE_PWT | PTE_W | PTE_P;
+  lapic = va;
+
+  intr_register_ext (LAPIC_VEC_RESCHEDULE, reschedule_interrupt,
+                     "Reschedule IPI");
+  lapic_enable ();
+}
+
+/** Enables an application processor's local APIC.  Its LINT0
+   and LINT1 inputs are masked, because only the bootstrap
+   processor takes interrupts from the PICs. */
+void
+lapic_init_ap (void)
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_LVT_LINT0, LVT_MASKED);
+  lapic_write (LAPIC_LVT_LINT1, LVT_MASKED);
+  lapic_enable ();
+}
+
+/** Enables the running CPU's local APIC. */
+static void
+lapic_enable (void)
+{
+  lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_VEC_SPURIOUS);
+  lapic_write (LAPIC_LVT_TIMER, LVT_MASKED);
+  lapic_write (LAPIC_LVT_ERROR, LVT_MASKED);
+
+  /* Clear errors.  The error status register must be written
+     before it is read, so write it twice. */
+  lapic_write (LAPIC_ESR, 0);
+  lapic_write (LAPIC_ESR, 0);
+
+  /* Acknowledge any outstanding interrupt and accept all
+     interrupts. */
+  lapic_write (LAPIC_EOI, 0);
+  lapic_write (LAPIC_TPR, 0);
+}
+
+/** Returns the running CPU's local APIC ID. */
+uint8_t
+lapic_id (void)
+{
+  ASSERT (lapic != NULL);
+  return lapic_read (LAPIC_ID) >> 24;
+}
+
+/** Sends an end-of-interrupt signal to the running CPU's local
+   APIC, which will deliver no more interrupts of the same or
+   lower priority until it does. */
+void
+lapic_eoi (void)
+{
+  lapic_write (LAPIC_EOI, 0);
+}
+
+/** Sends ICR_LO to the local APIC with ID DEST as an interprocessor
+   interrupt, and waits for it to be accepted. */
+static void
+send_icr (uint8_t dest, uint32_t icr_lo)
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_ICR_HI, (uint32_t) dest << 24);
+  lapic_write (LAPIC_ICR_LO, icr_lo);
+  while (lapic_read (LAPIC_ICR_LO) & ICR_PENDING)
+    continue;
+}
+
+/** Sends interrupt VEC to the CPU whose local APIC ID is DEST. */
+void
+lapic_send_ipi (uint8_t dest, uint8_t vec)
+{
+  send_icr (dest, ICR_ASSERT | vec);
+}
+
+/** Starts up the application processor whose local APIC ID is
+   DEST, making it execute code at START_PADDR, which must be a
+   page-aligned physical address below 1 MB, in real mode.  This
+   is the INIT-SIPI-SIPI sequence of [MP] appendix B.4 "Application
+   Processor Startup".  Interrupts must be on, so that timer
+   delays work. */
+void
+lapic_start_ap (uint8_t dest, uint32_t start_paddr)
+{
+  int i;
+
+  ASSERT (start_paddr % PGSIZE == 0 && start_paddr < 0x100000);
+
+  /* Assert, then deassert, INIT, and wait for the CPU to reset. */
+  send_icr (dest, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+  timer_udelay (200);
+  send_icr (dest, ICR_INIT | ICR_LEVEL);
+  timer_msleep (10);
+
+  /* Send STARTUP twice, as recommended. */
+  for (i = 0; i < 2; i++)
+    {
+      send_icr (dest, ICR_STARTUP | (start_paddr >> 12));
+      timer_udelay (200);
+    }
+}
+
+/** Starts the running CPU's local APIC timer counting down from
+   COUNT, in units of 16 bus clock cycles.  When it reaches 0, it
+   raises interrupt LAPIC_VEC_TIMER and, if PERIODIC is true,
+   starts over. */
+void
+lapic_timer_start (uint32_t count, bool periodic)
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_16);
+  lapic_write (LAPIC_LVT_TIMER,
+               LAPIC_VEC_TIMER | (periodic ? LVT_PERIODIC : 0));
+  lapic_write (LAPIC_TIMER_INIT, count);
+}
+
+/** Returns the running CPU's local APIC timer's current count. */
+uint32_t
+lapic_timer_count (void)
+{
+  ASSERT (lapic != NULL);
+  return lapic_read (LAPIC_TIMER_CUR);
+}
+
+/** Stops the running CPU's local APIC timer. */
+void
+lapic_timer_stop (void)
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_LVT_TIMER, LVT_MASKED);
+  lapic_write (LAPIC_TIMER_INIT, 0);
+}
+
+/** Reschedule IPI handler.  Another CPU put a thread in our run
+   queue that should run now, so let the scheduler pick it. */
+static void
+reschedule_interrupt (struct intr_frame *args UNUSED)
+{
+  thread_preempt ();
+}
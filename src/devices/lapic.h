@@ -0,0 +1,25 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Interrupt vectors for interrupts that the local APIC delivers.
+   They follow the PIC's 0x20...0x2f and the system call's 0x30. */
+#define LAPIC_VEC_TIMER 0x40            /**< Local APIC timer. */
+#define LAPIC_VEC_RESCHEDULE 0x41       /**< Reschedule IPI. */
+#define LAPIC_VEC_SPURIOUS 0x4f         /**< Spurious interrupt. */
+
+void lapic_init (uint32_t paddr);
+void lapic_init_ap (void);
+uint8_t lapic_id (void);
+void lapic_eoi (void);
+
+void lapic_send_ipi (uint8_t dest, uint8_t vec);
+void lapic_start_ap (uint8_t dest, uint32_t start_paddr);
+
+void lapic_timer_start (uint32_t count, bool periodic);
+uint32_t lapic_timer_count (void);
+void lapic_timer_stop (void);
+
+#endif /**< devices/lapic.h */
@@ -11,8 +11,17 @@
 #define PIT_PORT_CONTROL          0x43                /**< Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /**< Counter port. */
 
-/** PIT cycles per second. */
-#define PIT_HZ 1193180
+/** Read-back command for channel 0 that latches both its status
+   and its count.  See [8254] "Read-Back Command". */
+#define PIT_READ_BACK_0 0xc2
+
+/** Status byte bits. */
+#define PIT_STATUS_OUT 0x80             /**< State of OUT pin. */
+#define PIT_STATUS_NULL 0x40            /**< Count not yet loaded. */
+
+/** Length of the one-shot most recently started on channel 0, in
+   PIT cycles. */
+static unsigned oneshot_cycles;
 
 /** Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
@@ -81,3 +90,64 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/** Starts channel 0 counting down from CYCLES in mode 0,
+   "interrupt on terminal count", so that it raises a single
+   interrupt CYCLES PIT cycles from now.  CYCLES must be between
+   1 and 65536.
+
+   Unlike the periodic mode set up by pit_configure_channel(),
+   the channel does not reload itself: after reaching 0 it keeps
+   counting down from 65535 with OUT held high, which is what
+   allows pit_oneshot_elapsed() to tell how late it is being
+   asked. */
+void
+pit_oneshot_start (unsigned cycles)
+{
+  uint16_t count = cycles;      /* 65536 truncates to 0, as it should. */
+  enum intr_level old_level;
+
+  ASSERT (cycles >= 1 && cycles <= 65536);
+
+  old_level = intr_disable ();
+  oneshot_cycles = cycles;
+  outb (PIT_PORT_CONTROL, 0x30);
+  outb (PIT_PORT_COUNTER (0), count);
+  outb (PIT_PORT_COUNTER (0), count >> 8);
+  intr_set_level (old_level);
+}
+
+/** Returns the number of PIT cycles since the last call to
+   pit_oneshot_start().  The result is accurate as long as it is
+   less than the one-shot's length plus 65536 cycles, that is, as
+   long as the one-shot interrupt is not delayed by more than
+   about 55 ms. */
+unsigned
+pit_oneshot_elapsed (void)
+{
+  enum intr_level old_level;
+  uint8_t status;
+  unsigned count;
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, PIT_READ_BACK_0);
+  status = inb (PIT_PORT_COUNTER (0));
+  count = inb (PIT_PORT_COUNTER (0));
+  count |= inb (PIT_PORT_COUNTER (0)) << 8;
+  intr_set_level (old_level);
+
+  if (status & PIT_STATUS_NULL)
+    return 0;
+  else if (!(status & PIT_STATUS_OUT))
+    {
+      /* Still counting down.  A count of 0 can only be the
+         initial 65536. */
+      return oneshot_cycles - (count != 0 ? count : 65536);
+    }
+  else
+    {
+      /* Past terminal count, so the counter wrapped around to
+         65535 and has been counting down from there. */
+      return oneshot_cycles + ((65536 - count) & 0xffff);
+    }
+}
@@ -3,6 +3,12 @@
 
 #include <stdint.h>
 
+/** PIT cycles per second. */
+#define PIT_HZ 1193180
+
 void pit_configure_channel (int channel, int mode, int frequency);
 
+void pit_oneshot_start (unsigned cycles);
+unsigned pit_oneshot_elapsed (void);
+
 #endif /**< devices/pit.h */
@@ -3,7 +3,9 @@
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
+#include "devices/lapic.h"
 #include "devices/pit.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
@@ -24,7 +26,96 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/** CPU cycles spent in the timer interrupt handler since boot. */
+static uint64_t handler_cycles;
+
+/** Number of timer interrupts since boot. */
+static int64_t interrupts;
+
+/** Local APIC timer counts per timer tick, which application
+   processors use for their own timer interrupts.  Initialized by
+   timer_calibrate_lapic(), which measures it over
+   LAPIC_CALIBRATION_TICKS ticks. */
+static uint32_t lapic_counts_per_tick;
+#define LAPIC_CALIBRATION_TICKS 10
+
+/** If false (default), the timer interrupts TIMER_FREQ times per
+   second.
+   If true, use dynamic ticks and high-resolution sleeps.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/** Tickless mode.
+
+   Instead of running periodically, the 8254 is programmed for a
+   single interrupt at the next moment that something has to
+   happen.  While a thread other than the idle thread runs, that
+   is the next tick, so that time slicing and the scheduler's
+   statistics work as usual.  While the CPU idles, it is the next
+   tick at which a sleeping thread wakes up, so an idle machine
+   takes far fewer interrupts.  Either way, the interrupt comes
+   sooner if a thread in a sub-tick sleep is due first, which
+   gives timer_usleep() and timer_nsleep() precision of a few
+   microseconds without busy-waiting.
+
+   Time is kept in PIT cycles in `clock_base', as of the start of
+   the current one-shot, plus the cycles elapsed since, which the
+   8254 itself reports.  Tick N begins at cycle N * TICK_CYCLES,
+   exactly as in periodic mode, and each interrupt first runs the
+   tick processing for every tick boundary passed since the last
+   one, so that `ticks' catches up after the CPU idles.  A few
+   PIT cycles can be lost between reading the counter and
+   restarting it, so the clock runs very slightly slow. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define ONESHOT_MIN 2                   /**< Shortest one-shot, ~2 us. */
+#define ONESHOT_MAX 65536               /**< Longest one-shot, ~55 ms. */
+
+static int64_t clock_base;              /**< Cycles at one-shot start. */
+static int64_t clock_deadline;          /**< Cycle the one-shot expires. */
+static bool idling;                     /**< Idle thread is waiting. */
+
+/** Threads in sub-tick sleeps, in order of wakeup_tick, which for
+   them is a deadline in PIT cycles. */
+static struct list hr_sleepers;
+
+/** Sleeping threads are kept in a hierarchical timing wheel.
+
+   Level 0 has one slot for each of the next WHEEL_SLOTS ticks.
+   Each higher level has the same number of slots, but each slot
+   spans all of the level below it, so level L covers deadlines
+   up to WHEEL_SLOTS**(L+1) ticks away.  Whenever the level-0
+   index wraps around to 0, the current slot of level 1 is
+   "cascaded", that is, its threads are reinserted relative to
+   the current time, which drops them into level 0; level 1
+   wrapping cascades level 2, and so on.  Deadlines too far away
+   for even the top level wait in wheel_overflow, which is
+   cascaded when the top level wraps.
+
+   The upshot is that every thread in a level-0 slot wakes up on
+   exactly the same tick, so the timer interrupt wakes an expired
+   slot without looking at any thread that is still asleep, and
+   each sleeping thread is moved at most WHEEL_LEVELS times in
+   its life.  Accessed only with interrupts off. */
+#define WHEEL_BITS 6                    /**< Index bits per level. */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)   /**< Slots per level. */
+#define WHEEL_MASK (WHEEL_SLOTS - 1)    /**< Slot index mask. */
+#define WHEEL_LEVELS 4                  /**< Number of levels. */
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static struct list wheel_overflow;      /**< Beyond the top level. */
+static int64_t wheel_tick;              /**< Next tick to expire. */
+
+static void wheel_insert (struct thread *);
+static void wheel_advance (int64_t now);
+static int64_t wheel_next_expiry (void);
+
+static int64_t clock_now (void);
+static void clock_program_next (void);
+static void hr_sleep (int64_t cycles);
+static void hr_expire (int64_t now);
+
 static intr_handler_func timer_interrupt;
+static intr_handler_func timer_lapic_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -35,7 +126,21 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
-  pit_configure_channel (0, 2, TIMER_FREQ);
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init (&wheel[level][slot]);
+  list_init (&wheel_overflow);
+  list_init (&hr_sleepers);
+
+  if (!timer_tickless)
+    pit_configure_channel (0, 2, TIMER_FREQ);
+  else
+    {
+      clock_deadline = TICK_CYCLES;
+      pit_oneshot_start (TICK_CYCLES);
+    }
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -66,6 +171,43 @@ timer_calibrate (void)
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
 }
 
+/** Measures the rate of the local APIC timer, which runs at the
+   bus clock, against the 8254, and registers its interrupt, so
+   that application processors can use it to interrupt
+   themselves TIMER_FREQ times per second.  Interrupts must be
+   on. */
+void
+timer_calibrate_lapic (void)
+{
+  int64_t start;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  /* Count down over LAPIC_CALIBRATION_TICKS whole ticks. */
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    barrier ();
+  start = timer_ticks ();
+  lapic_timer_start (UINT32_MAX, false);
+  while (timer_elapsed (start) < LAPIC_CALIBRATION_TICKS)
+    barrier ();
+  lapic_counts_per_tick = ((UINT32_MAX - lapic_timer_count ())
+                           / LAPIC_CALIBRATION_TICKS);
+  lapic_timer_stop ();
+
+  intr_register_ext (LAPIC_VEC_TIMER, timer_lapic_interrupt,
+                     "Local APIC Timer");
+}
+
+/** Starts the running application processor's periodic timer
+   interrupt. */
+void
+timer_init_ap (void)
+{
+  ASSERT (lapic_counts_per_tick > 0);
+  lapic_timer_start (lapic_counts_per_tick, true);
+}
+
 /** Returns the number of timer ticks since the OS booted. */
 int64_t
 timer_ticks (void) 
@@ -85,15 +227,26 @@ timer_elapsed (int64_t then)
 }
 
 /** Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The running thread blocks in the timing wheel until the timer
+   interrupt for its wake-up tick, so a sleeping thread costs no
+   CPU time at all. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  cur->wakeup_tick = timer_ticks () + ticks;
+  wheel_insert (cur);
+  thread_block ();
+  intr_set_level (old_level);
 }
 
 /** Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -159,19 +312,285 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/** Returns the number of CPU cycles spent in the timer interrupt
+   handler since the OS booted. */
+uint64_t
+timer_handler_cycles (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  uint64_t cycles = handler_cycles;
+  intr_set_level (old_level);
+  return cycles;
+}
+
+/** Tells the timer that the idle thread is about to halt the
+   CPU.  In tickless mode, the timer then stops interrupting on
+   every tick until timer_idle_exit() is called.  Not on a
+   multiprocessor, though, because the other CPUs still count on
+   `ticks' advancing.  Interrupts must be off. */
+void
+timer_idle_enter (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (timer_tickless && !idling && cpu_cnt == 1)
+    {
+      idling = true;
+      clock_program_next ();
+    }
+}
+
+/** Tells the timer that the idle thread is giving up the CPU to
+   another thread, which needs regular ticks again.  If tick
+   boundaries passed while idling, the next timer interrupt comes
+   right away and catches `ticks' up.  Interrupts must be off. */
+void
+timer_idle_exit (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (idling)
+    {
+      idling = false;
+      clock_program_next ();
+    }
+}
+
 /** Prints timer statistics. */
 void
-timer_print_stats (void) 
+timer_print_stats (void)
 {
-  printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  enum intr_level old_level = intr_disable ();
+  int64_t t = ticks;
+  int64_t n = interrupts;
+  intr_set_level (old_level);
+
+  printf ("Timer: %"PRId64" ticks, %"PRId64" interrupts, "
+          "%"PRIu64" cycles per interrupt\n",
+          t, n, n > 0 ? timer_handler_cycles () / n : 0);
 }
 
+/** Processes a single timer tick. */
+static void
+timer_tick (void)
+{
+  ticks++;
+  wheel_advance (ticks);
+  thread_tick ();
+}
+
 /** Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
+  uint64_t start = rdtsc ();
+
+  interrupts++;
+  if (!timer_tickless)
+    timer_tick ();
+  else
+    {
+      int64_t now = clock_now ();
+
+      while (now >= (ticks + 1) * TICK_CYCLES)
+        timer_tick ();
+      hr_expire (now);
+      clock_program_next ();
+    }
+  thread_preempt ();
+
+  handler_cycles += rdtsc () - start;
+}
+
+/** Application processor timer interrupt handler.  Only the
+   bootstrap processor's 8254 interrupt advances `ticks' and wakes
+   sleeping threads; this only drives the scheduler. */
+static void
+timer_lapic_interrupt (struct intr_frame *args UNUSED)
+{
   thread_tick ();
+  thread_preempt ();
+}
+
+/** Returns the current time in PIT cycles since boot, in tickless
+   mode.  Interrupts must be off. */
+static int64_t
+clock_now (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  return clock_base + pit_oneshot_elapsed ();
+}
+
+/** Starts a one-shot for the next timer event: the next tick if
+   a thread other than the idle thread is running, otherwise the
+   next tick at which a thread wakes up, or the first sub-tick
+   sleeper's deadline, if that is earlier.  Interrupts must be
+   off. */
+static void
+clock_program_next (void)
+{
+  int64_t now = clock_now ();
+  int64_t next, delta;
+
+  next = (idling ? wheel_next_expiry () : ticks + 1) * TICK_CYCLES;
+  if (!list_empty (&hr_sleepers))
+    {
+      struct thread *t = list_entry (list_front (&hr_sleepers),
+                                     struct thread, elem);
+      if (t->wakeup_tick < next)
+        next = t->wakeup_tick;
+    }
+
+  delta = next - now;
+  if (delta < ONESHOT_MIN)
+    delta = ONESHOT_MIN;
+  else if (delta > ONESHOT_MAX)
+    delta = ONESHOT_MAX;
+
+  clock_base = now;
+  clock_deadline = now + delta;
+  pit_oneshot_start (delta);
+}
+
+/** Returns true if sleeping thread A's wakeup_tick is earlier
+   than B's. */
+static bool
+wakeup_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->wakeup_tick < b->wakeup_tick;
+}
+
+/** Sleeps for approximately CYCLES PIT cycles, which should be
+   less than a tick, by blocking until a one-shot timer interrupt.
+   Tickless mode only.  Interrupts must be turned on. */
+static void
+hr_sleep (int64_t cycles)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (timer_tickless);
+  ASSERT (intr_get_level () == INTR_ON);
+  if (cycles <= 0)
+    return;
+
+  old_level = intr_disable ();
+  cur->wakeup_tick = clock_now () + cycles;
+  list_insert_ordered (&hr_sleepers, &cur->elem, wakeup_less, NULL);
+  if (cur->wakeup_tick < clock_deadline)
+    clock_program_next ();
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/** Wakes up the sub-tick sleepers whose deadlines are at or
+   before NOW, in PIT cycles. */
+static void
+hr_expire (int64_t now)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (!list_empty (&hr_sleepers))
+    {
+      struct thread *t = list_entry (list_front (&hr_sleepers),
+                                     struct thread, elem);
+      if (t->wakeup_tick > now)
+        break;
+      list_pop_front (&hr_sleepers);
+      thread_unblock (t);
+    }
+}
+
+/** Adds sleeping thread T to the slot of the timing wheel that
+   covers T->wakeup_tick. */
+static void
+wheel_insert (struct thread *t) 
+{
+  int64_t expires = t->wakeup_tick > wheel_tick ? t->wakeup_tick : wheel_tick;
+  int64_t delta = expires - wheel_tick;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      {
+        size_t slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        list_push_back (&wheel[level][slot], &t->elem);
+        return;
+      }
+  list_push_back (&wheel_overflow, &t->elem);
+}
+
+/** Reinserts every thread in SLOT relative to the current value
+   of wheel_tick, moving each one down to a finer level. */
+static void
+wheel_cascade (struct list *slot) 
+{
+  struct list pending;
+
+  list_init (&pending);
+  if (!list_empty (slot))
+    list_splice (list_end (&pending), list_begin (slot), list_end (slot));
+  while (!list_empty (&pending))
+    wheel_insert (list_entry (list_pop_front (&pending), struct thread, elem));
+}
+
+/** Expires every tick of the timing wheel up to and including
+   NOW, waking the threads whose deadlines have arrived. */
+static void
+wheel_advance (int64_t now) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (wheel_tick <= now) 
+    {
+      struct list *slot = &wheel[0][wheel_tick & WHEEL_MASK];
+
+      /* Cascade the higher levels when level 0 wraps around. */
+      if ((wheel_tick & WHEEL_MASK) == 0)
+        {
+          int level;
+
+          for (level = 1; level < WHEEL_LEVELS; level++) 
+            {
+              size_t idx = (wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+              wheel_cascade (&wheel[level][idx]);
+              if (idx != 0)
+                break;
+            }
+          if (level == WHEEL_LEVELS)
+            wheel_cascade (&wheel_overflow);
+        }
+
+      while (!list_empty (slot)) 
+        thread_unblock (list_entry (list_pop_front (slot),
+                                    struct thread, elem));
+      wheel_tick++;
+    }
+}
+
+/** Returns the first tick at which the timing wheel has threads
+   to wake up.  Only level 0 is searched, so if it has none, this
+   returns the tick at which level 0 next wraps around, when the
+   higher levels must be cascaded anyway. */
+static int64_t
+wheel_next_expiry (void)
+{
+  int64_t tick = wheel_tick;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  do
+    if (!list_empty (&wheel[0][tick & WHEEL_MASK]))
+      return tick;
+  while ((++tick & WHEEL_MASK) != 0);
+  return tick;
 }
 
 /** Returns true if LOOPS iterations waits for more than one timer
@@ -227,11 +646,17 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
-  else 
+  else if (timer_tickless)
+    {
+      /* Otherwise, in tickless mode, sleep until a one-shot
+         timer interrupt at the exact time. */
+      hr_sleep (num * PIT_HZ / denom);
+    }
+  else
     {
       /* Otherwise, use a busy-wait loop for more accurate
          sub-tick timing. */
-      real_time_delay (num, denom); 
+      real_time_delay (num, denom);
     }
 }
 
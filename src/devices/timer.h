@@ -2,13 +2,18 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /** Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
+void timer_calibrate_lapic (void);
+void timer_init_ap (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
@@ -24,6 +29,11 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/** Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+uint64_t timer_handler_cycles (void);
 void timer_print_stats (void);
 
 #endif /**< devices/timer.h */
@@ -11,6 +11,7 @@
 /** Element type.
 
    This must be an unsigned integer type at least as wide as int.
+   The inline assembly below assumes that it is 32 bits wide.
 
    Each bit represents one bit in the bitmap.
    If bit 0 in an element represents bit K in the bitmap,
@@ -27,6 +28,7 @@ typedef unsigned long elem_type;
 struct bitmap
   {
     size_t bit_cnt;     /**< Number of bits. */
+    size_t free_hint;   /**< No element before this one has a 0 bit. */
     elem_type *bits;    /**< Elements that represent bits. */
   };
 
@@ -68,6 +70,55 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/** Returns a bit mask in which the bits of element ELEM_IDX that
+   represent bits START through END - 1 of the bitmap are set to 1
+   and the rest are set to 0.  ELEM_IDX must contain at least one
+   of those bits. */
+static inline elem_type
+range_mask (size_t elem_idx, size_t start, size_t end) 
+{
+  size_t first = elem_idx * ELEM_BITS;
+  elem_type mask = (elem_type) -1;
+
+  if (start > first)
+    mask &= (elem_type) -1 << (start - first);
+  if (end < first + ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - first)) - 1;
+  return mask;
+}
+
+/** Returns the index of the lowest 1 bit in E, which must not be
+   0.  See the description of the BSF instruction in
+   [IA32-v2a]. */
+static inline size_t
+lowest_bit (elem_type e) 
+{
+  elem_type idx;
+
+  asm ("bsfl %1, %0" : "=r" (idx) : "rm" (e) : "cc");
+  return idx;
+}
+
+/** Returns the number of 1 bits in E.  The POPCNT instruction
+   is too new to count on, so this adds up the bits in parallel,
+   in pairs, then nibbles, then bytes. */
+static inline size_t
+popcount (elem_type e) 
+{
+  e = e - ((e >> 1) & 0x55555555);
+  e = (e & 0x33333333) + ((e >> 2) & 0x33333333);
+  e = (e + (e >> 4)) & 0x0f0f0f0f;
+  return (e * 0x01010101) >> 24;
+}
+
+/** Records that bit BIT_IDX in B may have become 0. */
+static inline void
+lower_hint (struct bitmap *b, size_t bit_idx) 
+{
+  if (elem_idx (bit_idx) < b->free_hint)
+    b->free_hint = elem_idx (bit_idx);
+}
 
 /** Creation and destruction. */
 
@@ -82,6 +133,7 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->free_hint = 0;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -104,6 +156,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
+  b->free_hint = 0;
   b->bits = (elem_type *) (b + 1);
   bitmap_set_all (b, false);
   return b;
@@ -176,6 +229,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  lower_hint (b, bit_idx);
 }
 
 /** Atomically toggles the bit numbered IDX in B;
@@ -191,6 +245,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  lower_hint (b, bit_idx);
 }
 
 /** Returns the value of the bit numbered IDX in B. */
@@ -213,18 +268,32 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/** Sets the CNT bits starting at START in B to VALUE. */
+/** Sets the CNT bits starting at START in B to VALUE.  Each
+   element is updated atomically, as by bitmap_mark() or
+   bitmap_reset(), but the group as a whole is not. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt;
+  size_t idx;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++) 
+    {
+      elem_type mask = range_mask (idx, start, end);
+
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+    }
+  if (!value)
+    lower_hint (b, start);
 }
 
 /** Returns the number of bits in B between START and START + CNT,
@@ -232,17 +301,19 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t idx, ones;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  if (cnt == 0)
+    return 0;
+  ones = 0;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    ones += popcount (b->bits[idx] & range_mask (idx, start, end));
+  return value ? ones : cnt - ones;
 }
 
 /** Returns true if any bits in B between START and START + CNT,
@@ -250,14 +321,18 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t end = start + cnt;
+  size_t idx;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
+  if (cnt == 0)
+    return false;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    if ((b->bits[idx] ^ flip) & range_mask (idx, start, end))
       return true;
   return false;
 }
@@ -288,6 +363,69 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /** Finding set or unset bits. */
 
+/** Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's size if there is none.  Skips a whole
+   element at a time while looking. */
+static size_t
+next_bit (const struct bitmap *b, size_t start, bool value) 
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t last = elem_cnt (b->bit_cnt);
+  size_t idx;
+  elem_type e;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  idx = elem_idx (start);
+  e = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (e == 0)
+    {
+      if (++idx >= last)
+        return b->bit_cnt;
+      e = b->bits[idx] ^ flip;
+    }
+
+  /* The unused bits in the last element may hold anything, so
+     the search may have found one of them. */
+  start = idx * ELEM_BITS + lowest_bit (e);
+  return start < b->bit_cnt ? start : b->bit_cnt;
+}
+
+/** Finds and returns the starting index of the first group of CNT
+   consecutive bits in B at or after START that are all set to
+   VALUE, or BITMAP_ERROR if there is none, as bitmap_scan()
+   does.  Also stores into *FIRST the index of the first bit at
+   or after START that is set to VALUE, or B's size if there is
+   none.
+
+   Rather than testing each possible starting bit in turn, this
+   jumps from one run of VALUE bits to the next, finding the
+   start and end of each run a whole element at a time. */
+static size_t
+scan (const struct bitmap *b, size_t start, size_t cnt, bool value,
+      size_t *first) 
+{
+  size_t from = start;
+  size_t i;
+
+  /* Skip the elements that hold no 0 bits. */
+  if (!value && from < b->free_hint * ELEM_BITS)
+    from = b->free_hint * ELEM_BITS;
+
+  i = *first = next_bit (b, from, value);
+  if (cnt == 0)
+    return start;
+  while (cnt <= b->bit_cnt && i <= b->bit_cnt - cnt)
+    {
+      size_t end = next_bit (b, i, !value);
+      if (end - i >= cnt)
+        return i;
+      i = next_bit (b, end, value);
+    }
+  return BITMAP_ERROR;
+}
+
 /** Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -295,18 +433,12 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t first;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
-    {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
-    }
-  return BITMAP_ERROR;
+  return scan (b, start, cnt, value, &first);
 }
 
 /** Finds the first group of CNT consecutive bits in B at or after
@@ -319,7 +451,17 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t idx = bitmap_scan (b, start, cnt, value);
+  size_t idx, first;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+
+  /* If the scan started at the hint or before it, then FIRST is
+     B's first 0 bit, so the hint can move up to its element. */
+  idx = scan (b, start, cnt, value, &first);
+  if (!value && start <= b->free_hint * ELEM_BITS)
+    b->free_hint = elem_idx (first);
+
   if (idx != BITMAP_ERROR) 
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
@@ -346,6 +488,7 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      b->free_hint = 0;
     }
   return success;
 }
@@ -0,0 +1,179 @@
+#include "heap.h"
+#include "../debug.h"
+
+/** A pairing heap is a tree in which every element is at least
+   as great as each of its children.  Each element points to its
+   leftmost child, and the children of an element form a doubly
+   linked list through `next' and `prev'.  The `prev' pointer of
+   a leftmost child points to its parent instead, so that any
+   element can be cut out of the tree in constant time.
+
+   Two heaps are combined ("melded") by making the root with the
+   smaller key the leftmost child of the other.  Removing an
+   element leaves its children as a list of subheaps, which are
+   melded back together in two passes: first in pairs from left
+   to right, then the pairs from right to left.  The two-pass
+   scheme is what gives heap_remove() its amortized logarithmic
+   bound; see Fredman, Sedgewick, Sleator and Tarjan, "The
+   pairing heap: a new form of self-adjusting heap" (1986). */
+
+/** Melds the heaps rooted at A and B, either of which may be
+   null, and returns the new root.  A and B must not have
+   siblings or parents. */
+static struct heap_elem *
+meld (struct heap_elem *a, struct heap_elem *b,
+      heap_less_func *less, void *aux)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (less (a, b, aux))
+    {
+      struct heap_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  /* Make B the leftmost child of A. */
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/** Detaches E, along with its subtree, from its parent and
+   siblings.  E must not be the root. */
+static void
+cut (struct heap_elem *e)
+{
+  ASSERT (e->prev != NULL);
+
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+  e->next = e->prev = NULL;
+}
+
+/** Melds the list of sibling subheaps that starts at FIRST into
+   a single heap and returns its root, or a null pointer if FIRST
+   is null. */
+static struct heap_elem *
+merge_pairs (struct heap_elem *first, heap_less_func *less, void *aux)
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root = NULL;
+
+  /* First pass: meld adjacent pairs from left to right, stacking
+     the results on PAIRS, linked through `next'. */
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+
+      first = b != NULL ? b->next : NULL;
+      a->next = a->prev = NULL;
+      if (b != NULL)
+        b->next = b->prev = NULL;
+      a = meld (a, b, less, aux);
+      a->next = pairs;
+      pairs = a;
+    }
+
+  /* Second pass: meld the pairs from right to left. */
+  while (pairs != NULL)
+    {
+      struct heap_elem *next = pairs->next;
+      pairs->next = NULL;
+      root = meld (root, pairs, less, aux);
+      pairs = next;
+    }
+  return root;
+}
+
+/** Initializes HEAP as an empty heap. */
+void
+heap_init (struct heap *heap)
+{
+  ASSERT (heap != NULL);
+  heap->root = NULL;
+}
+
+/** Returns true if HEAP is empty, false otherwise. */
+bool
+heap_empty (const struct heap *heap)
+{
+  return heap->root == NULL;
+}
+
+/** Returns the maximum element in HEAP, which must not be
+   empty. */
+struct heap_elem *
+heap_max (const struct heap *heap)
+{
+  ASSERT (!heap_empty (heap));
+  return heap->root;
+}
+
+/** Inserts ELEM into HEAP, given comparison function LESS and
+   auxiliary data AUX. */
+void
+heap_insert (struct heap *heap, struct heap_elem *elem,
+             heap_less_func *less, void *aux)
+{
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+  ASSERT (less != NULL);
+
+  elem->child = elem->next = elem->prev = NULL;
+  heap->root = meld (heap->root, elem, less, aux);
+}
+
+/** Removes ELEM, which may be any element of HEAP, given
+   comparison function LESS and auxiliary data AUX. */
+void
+heap_remove (struct heap *heap, struct heap_elem *elem,
+             heap_less_func *less, void *aux)
+{
+  struct heap_elem *children;
+
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+  ASSERT (less != NULL);
+
+  children = merge_pairs (elem->child, less, aux);
+  if (elem == heap->root)
+    heap->root = children;
+  else
+    {
+      cut (elem);
+      heap->root = meld (heap->root, children, less, aux);
+    }
+  elem->child = NULL;
+}
+
+/** Restores the heap property after the key of ELEM, an element
+   of HEAP, has grown, given comparison function LESS and
+   auxiliary data AUX. */
+void
+heap_increase (struct heap *heap, struct heap_elem *elem,
+               heap_less_func *less, void *aux)
+{
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+  ASSERT (less != NULL);
+
+  /* ELEM is still at least as great as its own children, so only
+     its link to its parent can be wrong.  Move its whole subtree
+     up to the root. */
+  if (elem != heap->root)
+    {
+      cut (elem);
+      heap->root = meld (heap->root, elem, less, aux);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/** Max-heap.
+
+   This is a pairing heap.  Like our lists, it does not require
+   dynamically allocated memory: each structure that is a
+   potential heap element must embed a struct heap_elem member,
+   and heap_entry() converts a struct heap_elem back to the
+   structure that contains it.
+
+   The maximum element is always at the root, so heap_max() takes
+   constant time.  heap_insert() and heap_increase() take
+   constant time as well.  heap_remove() takes amortized
+   logarithmic time, whichever element is removed.
+
+   As with lists, the ordering is defined by a heap_less_func
+   supplied by the caller to each operation that needs it.  The
+   same function must be used for every operation on a given
+   heap.  An element's key may only grow while it is in the heap,
+   and heap_increase() must be called whenever it does. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Heap element. */
+struct heap_elem
+  {
+    struct heap_elem *child;    /**< Leftmost child. */
+    struct heap_elem *next;     /**< Next sibling to the right. */
+    struct heap_elem *prev;     /**< Left sibling, or parent if leftmost. */
+  };
+
+/** Heap. */
+struct heap
+  {
+    struct heap_elem *root;     /**< Maximum element, or null. */
+  };
+
+/** Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) &(HEAP_ELEM)->child    \
+                     - offsetof (STRUCT, MEMBER.child)))
+
+/** Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+void heap_init (struct heap *);
+bool heap_empty (const struct heap *);
+struct heap_elem *heap_max (const struct heap *);
+
+void heap_insert (struct heap *, struct heap_elem *,
+                  heap_less_func *, void *aux);
+void heap_remove (struct heap *, struct heap_elem *,
+                  heap_less_func *, void *aux);
+void heap_increase (struct heap *, struct heap_elem *,
+                    heap_less_func *, void *aux);
+
+#endif /**< lib/kernel/heap.h */
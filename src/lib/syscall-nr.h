@@ -28,7 +28,10 @@ enum
     SYS_MKDIR,                  /**< Create a directory. */
     SYS_READDIR,                /**< Reads a directory entry. */
     SYS_ISDIR,                  /**< Tests if a fd represents a directory. */
-    SYS_INUMBER                 /**< Returns the inode number for a fd. */
+    SYS_INUMBER,                /**< Returns the inode number for a fd. */
+
+    /* Project 3 extension, with copy-on-write. */
+    SYS_FORK                    /**< Duplicate this process. */
   };
 
 #endif /**< lib/syscall-nr.h */
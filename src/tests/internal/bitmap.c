@@ -0,0 +1,165 @@
+/** Test program for lib/kernel/bitmap.c.
+
+   Checks bitmap_count(), bitmap_contains(), and bitmap_scan()
+   against straightforward bit-at-a-time versions on bitmaps of
+   various sizes filled at random, then times the two kinds of
+   scan on a fully allocated map of 16K bits, which is where the
+   word-at-a-time scan pays off most.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/cpu.h"
+#include "threads/test.h"
+
+/** Largest bitmap that we will check, in bits. */
+#define MAX_BITS 300
+
+/** Number of bits in the map that we time scans of. */
+#define BENCH_BITS 16384
+
+static size_t slow_count (const struct bitmap *, size_t start, size_t cnt,
+                          bool);
+static bool slow_contains (const struct bitmap *, size_t start, size_t cnt,
+                           bool);
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool);
+static void benchmark (void);
+
+/** Test the bitmap implementation. */
+void
+test (void) 
+{
+  size_t bit_cnt;
+
+  printf ("testing various size bitmaps:");
+  for (bit_cnt = 0; bit_cnt < MAX_BITS; bit_cnt = bit_cnt * 4 / 3 + 1)
+    {
+      struct bitmap *b = bitmap_create (bit_cnt);
+      int repeat;
+
+      ASSERT (b != NULL);
+      printf (" %zu", bit_cnt);
+      for (repeat = 0; repeat < 100; repeat++) 
+        {
+          size_t density = random_ulong () % 101;
+          size_t start, cnt, i;
+          bool value;
+
+          /* Fill B at random, sometimes sparsely, sometimes
+             densely, and sometimes with long runs. */
+          for (i = 0; i < bit_cnt; i++)
+            bitmap_set (b, i, random_ulong () % 100 < density);
+          if (bit_cnt > 0 && repeat % 4 == 0) 
+            {
+              start = random_ulong () % bit_cnt;
+              cnt = random_ulong () % (bit_cnt - start + 1);
+              bitmap_set_multiple (b, start, cnt, repeat % 8 == 0);
+            }
+
+          start = random_ulong () % (bit_cnt + 1);
+          cnt = random_ulong () % (bit_cnt - start + 1);
+          value = random_ulong () % 2;
+          ASSERT (bitmap_count (b, start, cnt, value)
+                  == slow_count (b, start, cnt, value));
+          ASSERT (bitmap_contains (b, start, cnt, value)
+                  == slow_contains (b, start, cnt, value));
+
+          cnt = random_ulong () % 10;
+          ASSERT (bitmap_scan (b, start, cnt, value)
+                  == slow_scan (b, start, cnt, value));
+
+          /* A scan and flip must find the same group, and later
+             scans must still agree after it moves the hint. */
+          i = slow_scan (b, 0, cnt, false);
+          ASSERT (bitmap_scan_and_flip (b, 0, cnt, false) == i);
+          ASSERT (bitmap_scan (b, start, cnt, false)
+                  == slow_scan (b, start, cnt, false));
+        }
+      bitmap_destroy (b);
+    }
+  printf (" done\n");
+
+  benchmark ();
+  printf ("bitmap: PASS\n");
+}
+
+/** Times bitmap_scan() and bitmap_scan_and_flip() against
+   bit-at-a-time scanning on a fully allocated map. */
+static void
+benchmark (void) 
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  uint64_t start, slow, fast, flip;
+
+  ASSERT (b != NULL);
+  bitmap_set_all (b, true);
+
+  start = rdtsc ();
+  ASSERT (slow_scan (b, 0, 1, false) == BITMAP_ERROR);
+  slow = rdtsc () - start;
+
+  start = rdtsc ();
+  ASSERT (bitmap_scan (b, 0, 1, false) == BITMAP_ERROR);
+  fast = rdtsc () - start;
+
+  /* The first failed scan_and_flip() moves the hint to the end,
+     so time the second one. */
+  ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == BITMAP_ERROR);
+  start = rdtsc ();
+  ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == BITMAP_ERROR);
+  flip = rdtsc () - start;
+
+  printf ("scanning %d allocated bits: %llu cycles bit by bit, "
+          "%llu by words, %llu with hint\n", BENCH_BITS,
+          (unsigned long long) slow, (unsigned long long) fast,
+          (unsigned long long) flip);
+  bitmap_destroy (b);
+}
+
+/** Bit-at-a-time version of bitmap_count(). */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/** Bit-at-a-time version of bitmap_contains(). */
+static bool
+slow_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      return true;
+  return false;
+}
+
+/** Bit-at-a-time version of bitmap_scan(). */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t bit_cnt = bitmap_size (b);
+
+  if (cnt <= bit_cnt) 
+    {
+      size_t last = bit_cnt - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (!slow_contains (b, i, cnt, !value))
+          return i; 
+    }
+  return BITMAP_ERROR;
+}
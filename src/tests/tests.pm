@@ -179,6 +179,11 @@ sub compare_output {
 			&& !/^ esi=.* edi=.* esp=.* ebp=.*/
 			&& !/^ cs=.* ds=.* es=.* ss=.*/, @output);
     }
+    my $ignore_timings = exists $options{IGNORE_TIMINGS};
+    if ($ignore_timings) {
+	delete $options{IGNORE_TIMINGS};
+	@output = grep (!/^\([a-zA-Z0-9-_]+\) .*\b\d+ cycles\b/, @output);
+    }
     die "unknown option " . (keys (%options))[0] . "\n" if %options;
 
     my ($msg);
@@ -0,0 +1,122 @@
+/** Measures the cost of switching between two processes, as
+   seen by the kernel.  Two threads ping-pong through a pair of
+   semaphores, and each one, when it is switched in, reloads CR3
+   as process_activate() does and then reads a set of kernel
+   pages, as a system call or interrupt handler would, checking
+   that each still holds the tag written into it.
+
+   This runs twice: once with the kernel's own translations left
+   in the TLB across the CR3 load, which is what global pages
+   allow, and once with them flushed as well, which is what
+   happens without global pages.  Reports the average number of
+   cycles per switch for each. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/cpu.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+#define ROUND_CNT 10000         /**< Round trips per run. */
+#define PAGE_CNT 64             /**< Kernel pages touched per switch. */
+
+/** CR4 page global enable flag. */
+#define CR4_PGE 0x00000080
+
+static struct semaphore ping, pong, done;
+static uint8_t *pages[PAGE_CNT];
+static bool flush_global;
+
+/** Does what a process switch does to the TLB, then checks that
+   each of the kernel pages in `pages' still reads back the tag
+   that test_context_switch() wrote into it. */
+static void
+switch_in (void) 
+{
+  uint32_t cr4;
+  int i;
+
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (flush_global && (cr4 & CR4_PGE)) 
+    {
+      /* Toggling CR4.PGE flushes global entries too. */
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 & ~CR4_PGE) : "memory");
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+    }
+  else
+    asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
+
+  for (i = 0; i < PAGE_CNT; i++)
+    if (*(volatile uint8_t *) pages[i] != i)
+      fail ("kernel page %d lost its tag across a switch", i);
+}
+
+/** The other side of the ping-pong. */
+static void
+ponger (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUND_CNT; i++) 
+    {
+      sema_down (&ping);
+      switch_in ();
+      sema_up (&pong);
+    }
+  sema_up (&done);
+}
+
+/** Runs ROUND_CNT round trips and returns the average number of
+   cycles per switch. */
+static uint64_t
+run (bool flush_global_) 
+{
+  uint64_t start;
+  int i;
+
+  flush_global = flush_global_;
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  sema_init (&done, 0);
+  if (thread_create ("ponger", PRI_DEFAULT, ponger, NULL) == TID_ERROR)
+    fail ("thread_create failed");
+
+  start = rdtsc ();
+  for (i = 0; i < ROUND_CNT; i++) 
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+      switch_in ();
+    }
+  sema_down (&done);
+  return (rdtsc () - start) / (2 * ROUND_CNT);
+}
+
+void
+test_context_switch (void) 
+{
+  uint64_t kept, flushed;
+  int i;
+
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      pages[i] = palloc_get_page (0);
+      if (pages[i] == NULL)
+        fail ("out of pages after %d", i);
+      pages[i][0] = i;
+    }
+
+  kept = run (false);
+  flushed = run (true);
+  msg ("Switched %d times between two threads in each run.", 2 * ROUND_CNT);
+  msg ("%llu cycles per switch with kernel TLB entries kept.",
+       (unsigned long long) kept);
+  msg ("%llu cycles per switch with kernel TLB entries flushed.",
+       (unsigned long long) flushed);
+
+  for (i = 0; i < PAGE_CNT; i++)
+    palloc_free_page (pages[i]);
+}
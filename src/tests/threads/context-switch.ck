@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_TIMINGS => 1, [<<'EOF']);
+(context-switch) begin
+(context-switch) Switched 20000 times between two threads in each run.
+(context-switch) end
+EOF
+pass;
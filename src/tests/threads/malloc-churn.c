@@ -0,0 +1,146 @@
+/** Churns malloc() with a random mix of small allocations, in
+   all of its size classes, freeing each one later at random, and
+   checks that no two allocations ever overlap.  Then runs the
+   same mix in several threads at once.  Reports the average
+   number of cycles per malloc() or free(). */
+
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/cpu.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define SLOT_CNT 32             /**< Allocations outstanding at once. */
+#define OP_CNT 20000            /**< Allocations and frees per thread. */
+#define THREAD_CNT 4            /**< Threads churning at once. */
+
+/** An outstanding allocation. */
+struct slot 
+  {
+    uint8_t *block;             /**< Block, or null. */
+    size_t size;                /**< Size in bytes. */
+  };
+
+/** One thread's share of the test. */
+struct churn 
+  {
+    int id;                     /**< Thread number. */
+    struct slot slots[SLOT_CNT];
+    uint64_t cycles;            /**< Cycles spent in malloc() and free(). */
+    struct semaphore done;      /**< Upped when finished. */
+  };
+
+static struct churn churns[THREAD_CNT];
+
+/** Simple linear congruential generator, so that the sequence
+   of operations is the same from run to run. */
+static unsigned
+next_random (unsigned *state) 
+{
+  *state = *state * 1103515245 + 12345;
+  return *state >> 16;
+}
+
+/** Fills slot S of C with a byte derived from its slot number. */
+static void
+tag_block (struct churn *c, struct slot *s) 
+{
+  memset (s->block, (s - c->slots) ^ c->id, s->size);
+}
+
+/** Checks that slot S of C still has its tag. */
+static void
+check_block (struct churn *c, struct slot *s) 
+{
+  size_t i;
+
+  for (i = 0; i < s->size; i++)
+    if (s->block[i] != ((s - c->slots) ^ c->id))
+      fail ("byte %zu of slot %d in thread %d overwritten",
+            i, (int) (s - c->slots), c->id);
+}
+
+/** Runs OP_CNT random allocations and frees for C. */
+static void
+churn (void *c_) 
+{
+  static const size_t sizes[] = {8, 16, 20, 24, 32, 40, 48, 64, 80, 96,
+                                 128, 160, 192, 256, 300, 384, 512, 700,
+                                 768, 1024};
+  struct churn *c = c_;
+  unsigned state = c->id + 1;
+  int i;
+
+  for (i = 0; i < OP_CNT; i++) 
+    {
+      struct slot *s = &c->slots[next_random (&state) % SLOT_CNT];
+      uint64_t start;
+
+      if (s->block != NULL) 
+        {
+          check_block (c, s);
+          start = rdtsc ();
+          free (s->block);
+          c->cycles += rdtsc () - start;
+          s->block = NULL;
+        }
+      else 
+        {
+          s->size = sizes[next_random (&state)
+                          % (sizeof sizes / sizeof *sizes)];
+          start = rdtsc ();
+          s->block = malloc (s->size);
+          c->cycles += rdtsc () - start;
+          if (s->block != NULL)
+            tag_block (c, s);
+        }
+    }
+
+  for (i = 0; i < SLOT_CNT; i++)
+    if (c->slots[i].block != NULL) 
+      {
+        check_block (c, &c->slots[i]);
+        free (c->slots[i].block);
+        c->slots[i].block = NULL;
+      }
+  sema_up (&c->done);
+}
+
+void
+test_malloc_churn (void) 
+{
+  uint64_t cycles;
+  int i;
+
+  churns[0].id = 0;
+  sema_init (&churns[0].done, 0);
+  churn (&churns[0]);
+  msg ("Churned %d mallocs and frees in one thread.", OP_CNT);
+  msg ("%llu cycles per operation.",
+       (unsigned long long) (churns[0].cycles / OP_CNT));
+
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      char name[16];
+
+      churns[i].id = i;
+      churns[i].cycles = 0;
+      sema_init (&churns[i].done, 0);
+      snprintf (name, sizeof name, "churn %d", i);
+      if (thread_create (name, PRI_DEFAULT, churn, &churns[i])
+          == TID_ERROR)
+        fail ("thread_create failed for thread %d", i);
+    }
+  cycles = 0;
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      sema_down (&churns[i].done);
+      cycles += churns[i].cycles;
+    }
+  msg ("Churned %d mallocs and frees in each of %d threads.",
+       OP_CNT, THREAD_CNT);
+  msg ("%llu cycles per operation.",
+       (unsigned long long) (cycles / (OP_CNT * THREAD_CNT)));
+}
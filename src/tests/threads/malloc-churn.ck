@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_TIMINGS => 1, [<<'EOF']);
+(malloc-churn) begin
+(malloc-churn) Churned 20000 mallocs and frees in one thread.
+(malloc-churn) Churned 20000 mallocs and frees in each of 4 threads.
+(malloc-churn) end
+EOF
+pass;
@@ -0,0 +1,98 @@
+/** Churns the page allocator with a random mix of allocations
+   of 1 to 16 pages, freeing each one later at random, and checks
+   that no two allocations ever overlap.  Reports the average
+   number of cycles per allocation or free. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/cpu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+#define SLOT_CNT 64             /**< Allocations outstanding at once. */
+#define OP_CNT 20000            /**< Allocations and frees. */
+
+/** An outstanding allocation. */
+struct slot 
+  {
+    uint8_t *pages;             /**< First page, or null. */
+    size_t page_cnt;            /**< Number of pages. */
+  };
+
+static struct slot slots[SLOT_CNT];
+
+/** Simple linear congruential generator, so that the sequence
+   of operations is the same from run to run. */
+static unsigned
+next_random (unsigned *state) 
+{
+  *state = *state * 1103515245 + 12345;
+  return *state >> 16;
+}
+
+/** Marks each page of slot S with its slot number. */
+static void
+tag_pages (struct slot *s) 
+{
+  size_t i;
+
+  for (i = 0; i < s->page_cnt; i++)
+    *(int *) (s->pages + i * PGSIZE) = s - slots;
+}
+
+/** Checks that each page of slot S still has its tag. */
+static void
+check_pages (struct slot *s) 
+{
+  size_t i;
+
+  for (i = 0; i < s->page_cnt; i++)
+    if (*(int *) (s->pages + i * PGSIZE) != s - slots)
+      fail ("page %zu of slot %d overwritten", i, (int) (s - slots));
+}
+
+void
+test_palloc_churn (void) 
+{
+  static const size_t sizes[] = {1, 1, 1, 1, 2, 2, 3, 4, 5, 8, 13, 16};
+  unsigned state = 1;
+  uint64_t cycles = 0;
+  int i;
+
+  for (i = 0; i < OP_CNT; i++) 
+    {
+      struct slot *s = &slots[next_random (&state) % SLOT_CNT];
+      uint64_t start;
+
+      if (s->pages != NULL) 
+        {
+          check_pages (s);
+          start = rdtsc ();
+          palloc_free_multiple (s->pages, s->page_cnt);
+          cycles += rdtsc () - start;
+          s->pages = NULL;
+        }
+      else 
+        {
+          s->page_cnt = sizes[next_random (&state)
+                              % (sizeof sizes / sizeof *sizes)];
+          start = rdtsc ();
+          s->pages = palloc_get_multiple (0, s->page_cnt);
+          cycles += rdtsc () - start;
+          if (s->pages != NULL)
+            tag_pages (s);
+        }
+    }
+
+  for (i = 0; i < SLOT_CNT; i++)
+    if (slots[i].pages != NULL) 
+      {
+        check_pages (&slots[i]);
+        palloc_free_multiple (slots[i].pages, slots[i].page_cnt);
+        slots[i].pages = NULL;
+      }
+
+  msg ("Churned %d allocations and frees of 1 to 16 pages.", OP_CNT);
+  msg ("%llu cycles per operation.", (unsigned long long) (cycles / OP_CNT));
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_TIMINGS => 1, [<<'EOF']);
+(palloc-churn) begin
+(palloc-churn) Churned 20000 allocations and frees of 1 to 16 pages.
+(palloc-churn) end
+EOF
+pass;
@@ -0,0 +1,204 @@
+/** Checks readers-writer locks.
+
+   First, three threads of different priorities wait while the
+   main thread holds a lock for writing, and should get it in
+   order of priority, readers that outrank the waiting writer
+   first.
+
+   Then reader, writer and upgrading threads of mixed priorities
+   hammer on one lock, yielding inside their critical sections
+   to shake out races, and check that readers never overlap a
+   writer and writers never overlap anyone. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define READER_CNT 8            /**< Reader threads. */
+#define WRITER_CNT 4            /**< Writer threads. */
+#define UPGRADER_CNT 2          /**< Upgrading threads. */
+#define ITER_CNT 100            /**< Iterations per thread. */
+
+static struct rwlock rwlock;
+static struct semaphore done;
+
+/** Shared state.  Writers increment `a' and `b' one at a time,
+   so readers must always see them equal. */
+static int a, b;
+static int active_readers, active_writers;
+static int read_cnt, write_cnt;
+
+static void order_reader (void *);
+static void order_writer (void *);
+static void reader_thread (void *);
+static void writer_thread (void *);
+static void upgrader_thread (void *);
+
+void
+test_rwlock_stress (void) 
+{
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rwlock);
+  sema_init (&done, 0);
+
+  /* Wakeup order. */
+  rwlock_acquire_write (&rwlock);
+  if (rwlock_try_acquire_read (&rwlock) || rwlock_try_acquire_write (&rwlock))
+    fail ("try-acquire succeeded while lock held for writing");
+  thread_create ("reader 32", PRI_DEFAULT + 1, order_reader, NULL);
+  thread_create ("writer 33", PRI_DEFAULT + 2, order_writer, NULL);
+  thread_create ("reader 34", PRI_DEFAULT + 3, order_reader, NULL);
+  msg ("Main thread releasing lock.");
+  rwlock_release (&rwlock);
+  for (i = 0; i < 3; i++)
+    sema_down (&done);
+
+  /* Downgrade, then upgrade as the only reader. */
+  rwlock_acquire_write (&rwlock);
+  rwlock_downgrade (&rwlock);
+  if (!rwlock_try_acquire_read (&rwlock))
+    fail ("could not share lock after downgrade");
+  rwlock_release (&rwlock);
+  if (rwlock_try_acquire_write (&rwlock))
+    fail ("try-acquire for writing succeeded while lock held for reading");
+  if (!rwlock_upgrade (&rwlock) || !rwlock_held_by_current_thread (&rwlock))
+    fail ("upgrade of only reader failed");
+  rwlock_release (&rwlock);
+  msg ("Downgrade and upgrade worked.");
+
+  /* Contention. */
+  msg ("Starting %d readers, %d writers and %d upgraders.",
+       READER_CNT, WRITER_CNT, UPGRADER_CNT);
+  for (i = 0; i < READER_CNT; i++)
+    thread_create ("reader", PRI_DEFAULT - 1 + i % 3, reader_thread, NULL);
+  for (i = 0; i < WRITER_CNT; i++)
+    thread_create ("writer", PRI_DEFAULT - 1 + i % 3, writer_thread, NULL);
+  for (i = 0; i < UPGRADER_CNT; i++)
+    thread_create ("upgrader", PRI_DEFAULT - 1 + i % 3, upgrader_thread, NULL);
+  for (i = 0; i < READER_CNT + WRITER_CNT + UPGRADER_CNT; i++)
+    sema_down (&done);
+
+  msg ("%d reads, %d writes.", read_cnt, write_cnt);
+  if (a != b || a != (WRITER_CNT + UPGRADER_CNT) * ITER_CNT)
+    fail ("a = %d, b = %d after all writes", a, b);
+  msg ("Counters agree.");
+}
+
+static void
+order_reader (void *aux UNUSED) 
+{
+  rwlock_acquire_read (&rwlock);
+  msg ("Thread %s got lock.", thread_name ());
+  rwlock_release (&rwlock);
+  sema_up (&done);
+}
+
+static void
+order_writer (void *aux UNUSED) 
+{
+  rwlock_acquire_write (&rwlock);
+  msg ("Thread %s got lock.", thread_name ());
+  rwlock_release (&rwlock);
+  sema_up (&done);
+}
+
+/** Checks, as a reader, that no writer is active and that the
+   counters agree. */
+static void
+check_read (void) 
+{
+  if (active_writers != 0)
+    fail ("reader overlapped %d writers", active_writers);
+  if (a != b)
+    fail ("reader saw a = %d, b = %d", a, b);
+}
+
+/** Does one write, as the only thread holding the lock. */
+static void
+do_write (void) 
+{
+  if (active_readers != 0 || active_writers != 0)
+    fail ("writer overlapped %d readers and %d writers",
+          active_readers, active_writers);
+  active_writers++;
+  a++;
+  thread_yield ();
+  b++;
+  write_cnt++;
+  active_writers--;
+}
+
+static void
+reader_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      if (i % 4 != 0 || !rwlock_try_acquire_read (&rwlock))
+        rwlock_acquire_read (&rwlock);
+      active_readers++;
+      check_read ();
+      thread_yield ();
+      check_read ();
+      read_cnt++;
+      active_readers--;
+      rwlock_release (&rwlock);
+      thread_yield ();
+    }
+  sema_up (&done);
+}
+
+static void
+writer_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      if (i % 4 != 0 || !rwlock_try_acquire_write (&rwlock))
+        rwlock_acquire_write (&rwlock);
+      do_write ();
+      rwlock_release (&rwlock);
+      thread_yield ();
+    }
+  sema_up (&done);
+}
+
+static void
+upgrader_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      rwlock_acquire_read (&rwlock);
+      active_readers++;
+      check_read ();
+      thread_yield ();
+      active_readers--;
+      if (!rwlock_upgrade (&rwlock)) 
+        {
+          rwlock_release (&rwlock);
+          rwlock_acquire_write (&rwlock);
+        }
+      do_write ();
+      rwlock_downgrade (&rwlock);
+      active_readers++;
+      check_read ();
+      read_cnt++;
+      active_readers--;
+      rwlock_release (&rwlock);
+      thread_yield ();
+    }
+  sema_up (&done);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-stress) begin
+(rwlock-stress) Main thread releasing lock.
+(rwlock-stress) Thread reader 34 got lock.
+(rwlock-stress) Thread writer 33 got lock.
+(rwlock-stress) Thread reader 32 got lock.
+(rwlock-stress) Downgrade and upgrade worked.
+(rwlock-stress) Starting 8 readers, 4 writers and 2 upgraders.
+(rwlock-stress) 1000 reads, 600 writes.
+(rwlock-stress) Counters agree.
+(rwlock-stress) end
+EOF
+pass;
@@ -38,6 +38,11 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"thread-churn", test_thread_churn},
+    {"rwlock-stress", test_rwlock_stress},
+    {"palloc-churn", test_palloc_churn},
+    {"malloc-churn", test_malloc_churn},
+    {"context-switch", test_context_switch},
   };
 
 static const char *test_name;
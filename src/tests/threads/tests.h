@@ -32,6 +32,11 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_thread_churn;
+extern test_func test_rwlock_stress;
+extern test_func test_palloc_churn;
+extern test_func test_malloc_churn;
+extern test_func test_context_switch;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,85 @@
+/** Measures how long it takes to create a thread and have it
+   exit, with and without the pool of thread pages in thread.c.
+
+   Each thread has a higher priority than the main thread, so it
+   runs as soon as it is created, signals the main thread, and
+   exits.  The test passes as long as all of the threads run,
+   each with the priority it was created with; the cycle counts
+   are for comparison. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/cpu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 500          /**< Threads timed in each round. */
+#define WARMUP_CNT 32           /**< Untimed threads before each round. */
+
+static int ran_cnt;              /**< Threads that have run. */
+
+static void churn_thread (void *done_);
+static uint64_t churn (struct semaphore *done, int cnt);
+
+void
+test_thread_churn (void) 
+{
+  int low = thread_pool_low;
+  int high = thread_pool_high;
+  struct semaphore done;
+  uint64_t unpooled, pooled;
+
+  sema_init (&done, 0);
+
+  /* With the pool disabled, every thread page comes from and goes
+     back to the page allocator, once the warmup empties the
+     pool. */
+  thread_pool_low = thread_pool_high = 0;
+  churn (&done, WARMUP_CNT);
+  unpooled = churn (&done, THREAD_CNT);
+
+  thread_pool_low = low;
+  thread_pool_high = high;
+  churn (&done, WARMUP_CNT);
+  pooled = churn (&done, THREAD_CNT);
+
+  if (ran_cnt != 2 * (WARMUP_CNT + THREAD_CNT))
+    fail ("%d threads ran, expected %d",
+          ran_cnt, 2 * (WARMUP_CNT + THREAD_CNT));
+  msg ("Created and exited %d threads in each round.", THREAD_CNT);
+  msg ("unpooled: %llu cycles per thread.",
+       (unsigned long long) (unpooled / THREAD_CNT));
+  msg ("pooled: %llu cycles per thread.",
+       (unsigned long long) (pooled / THREAD_CNT));
+}
+
+/** Creates CNT threads, one at a time, waiting on DONE for each
+   one to run.  Returns the number of cycles taken. */
+static uint64_t
+churn (struct semaphore *done, int cnt) 
+{
+  uint64_t start = rdtsc ();
+  int i;
+
+  for (i = 0; i < cnt; i++) 
+    {
+      if (thread_create ("churn", PRI_DEFAULT + 1, churn_thread, done)
+          == TID_ERROR)
+        fail ("thread_create failed after %d threads", i);
+      sema_down (done);
+    }
+  return rdtsc () - start;
+}
+
+static void
+churn_thread (void *done_) 
+{
+  struct semaphore *done = done_;
+
+  /* A page from the pool must not carry over anything from the
+     thread that used it last. */
+  if (thread_get_priority () != PRI_DEFAULT + 1)
+    fail ("churn thread has priority %d", thread_get_priority ());
+  ran_cnt++;
+  sema_up (done);
+}
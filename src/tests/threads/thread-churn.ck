@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_TIMINGS => 1, [<<'EOF']);
+(thread-churn) begin
+(thread-churn) Created and exited 500 threads in each round.
+(thread-churn) end
+EOF
+pass;
@@ -0,0 +1,73 @@
+/** Forks a process that has 2 MB of memory in use, then has
+   parent and child each write half of its pages, and checks that
+   each one sees only its own writes.  Reports the time that the
+   fork took, which should depend on the number of pages, not on
+   their contents. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define PAGE 4096
+
+static unsigned char buf[SIZE];
+
+/** Reads the time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/** Writes VALUE to every other page of buf, starting at page
+   FIRST. */
+static void
+write_pages (size_t first, unsigned char value)
+{
+  size_t i;
+
+  for (i = first * PAGE; i < SIZE; i += 2 * PAGE)
+    memset (buf + i, value, PAGE);
+}
+
+/** Returns true if the even pages of buf hold EVEN and the odd
+   pages hold ODD. */
+static bool
+check_pages (unsigned char even, unsigned char odd)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != ((i / PAGE) % 2 == 0 ? even : odd))
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  uint64_t start, cycles;
+  pid_t child;
+
+  memset (buf, 0x5a, sizeof buf);
+
+  start = rdtsc ();
+  child = fork ();
+  cycles = rdtsc () - start;
+  if (child == 0) 
+    {
+      write_pages (0, 0xa5);
+      exit (check_pages (0xa5, 0x5a) ? 81 : 1);
+    }
+  CHECK (child != PID_ERROR, "fork");
+
+  write_pages (1, 0x3c);
+  CHECK (wait (child) == 81, "wait for child");
+  CHECK (check_pages (0x5a, 0x3c), "check parent's memory");
+  msg ("%llu cycles to fork.", cycles);
+}
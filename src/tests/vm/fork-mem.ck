@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, IGNORE_TIMINGS => 1, [<<'EOF']);
+(fork-mem) begin
+(fork-mem) fork
+(fork-mem) wait for child
+(fork-mem) check parent's memory
+(fork-mem) end
+EOF
+pass;
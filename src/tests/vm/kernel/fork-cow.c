@@ -0,0 +1,131 @@
+/** Copies a process's address space as fork() does, then checks
+   that the parent and the child each see their own writes and
+   not the other's, and that a write copies a shared page only
+   while the other process still has it.  Reports how long the
+   copy took.
+
+   Page I starts out filled with byte I.  After the copy, the
+   parent writes the odd pages and the child the even ones, so
+   each of them copies those pages.  Then the parent writes the
+   even pages, which the child no longer shares, so they must
+   stay in the frames they were in. */
+
+#include <string.h>
+#include "tests/vm/kernel/tests.h"
+#include "threads/cpu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+#define PAGE_CNT 64
+#define BASE ((uint8_t *) 0x10000000)
+
+static struct semaphore copied, go, child_done;
+static struct thread *parent;
+
+static thread_func child_thread;
+
+/** Returns the address of page I. */
+static uint8_t *
+page_addr (int i) 
+{
+  return BASE + i * PGSIZE;
+}
+
+/** Checks that every byte of page I is VALUE, as WHO sees it. */
+static void
+check_page (const char *who, int i, uint8_t value) 
+{
+  const uint8_t *p = page_addr (i);
+  int j;
+
+  for (j = 0; j < PGSIZE; j++)
+    if (p[j] != value)
+      fail ("%s: page %d has %#x at offset %d, expected %#x",
+            who, i, p[j], j, value);
+}
+
+/** Fills page I with VALUE and returns true if doing so moved it
+   to a different frame. */
+static bool
+write_page (int i, uint8_t value) 
+{
+  struct page *p = page_lookup (thread_current (), page_addr (i));
+  struct frame *before = p->frame;
+
+  memset (page_addr (i), value, PGSIZE);
+  return p->frame != before;
+}
+
+void
+test_fork_cow (void) 
+{
+  uint64_t start, cycles;
+  int i;
+
+  parent = thread_current ();
+  sema_init (&copied, 0);
+  sema_init (&go, 0);
+  sema_init (&child_done, 0);
+
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      if (!page_add_zero (page_addr (i), true))
+        fail ("out of memory adding page %d", i);
+      memset (page_addr (i), i, PGSIZE);
+    }
+
+  start = rdtsc ();
+  if (thread_create ("child", PRI_DEFAULT, child_thread, NULL)
+      == TID_ERROR)
+    fail ("thread_create failed");
+  sema_down (&copied);
+  cycles = rdtsc () - start;
+  msg ("%llu cycles to copy %d pages", cycles, PAGE_CNT);
+
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page ("parent", i, i);
+  for (i = 1; i < PAGE_CNT; i += 2)
+    if (!write_page (i, 0x80 + i))
+      fail ("parent: write to shared page %d did not copy it", i);
+  msg ("parent's writes copied the pages it shared");
+
+  sema_up (&go);
+  sema_down (&child_done);
+
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page ("parent", i, i % 2 ? 0x80 + i : i);
+  for (i = 0; i < PAGE_CNT; i += 2)
+    if (write_page (i, 0x80 + i))
+      fail ("parent: write to unshared page %d copied it", i);
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page ("parent", i, 0x80 + i);
+  msg ("parent kept the pages the child stopped sharing");
+}
+
+/** Copies the parent's address space, then, once the parent has
+   written its pages, checks that they did not change here and
+   writes the even pages. */
+static void
+child_thread (void *aux UNUSED) 
+{
+  int i;
+
+  test_process_init ();
+  if (!page_table_copy (parent))
+    fail ("page_table_copy failed");
+  sema_up (&copied);
+  sema_down (&go);
+
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page ("child", i, i);
+  for (i = 0; i < PAGE_CNT; i += 2)
+    if (!write_page (i, 0x40 + i))
+      fail ("child: write to shared page %d did not copy it", i);
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page ("child", i, i % 2 ? i : 0x40 + i);
+  msg ("child saw only its own writes");
+
+  sema_up (&child_done);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_TIMINGS => 1, [<<'EOF']);
+(fork-cow) begin
+(fork-cow) parent's writes copied the pages it shared
+(fork-cow) child saw only its own writes
+(fork-cow) parent kept the pages the child stopped sharing
+(fork-cow) end
+EOF
+pass;
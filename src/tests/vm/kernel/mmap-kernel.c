@@ -0,0 +1,61 @@
+/** Checks that mmap_map() refuses to map a file at kernel
+   addresses, or so close to PHYS_BASE that the file would run
+   into kernel memory, and that it adds no pages when it refuses.
+   A mapping in user memory is made first, to show that the file
+   itself can be mapped. */
+
+#include "tests/vm/kernel/tests.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+
+#define FILE_PAGES 2
+#define MAP_BASE ((uint8_t *) 0x10000000)
+
+static struct file *file;
+
+/** Checks that mapping the file at ADDR fails, as DESC says, and
+   leaves no pages behind. */
+static void
+check_refused (void *addr, const char *desc) 
+{
+  struct thread *cur = thread_current ();
+  int i;
+
+  if (mmap_map (file, addr) != MAP_FAILED)
+    fail ("mmap_map succeeded %s", desc);
+  for (i = 0; i < FILE_PAGES; i++) 
+    {
+      uint8_t *upage = (uint8_t *) addr + i * PGSIZE;
+      if (is_user_vaddr (upage) && page_lookup (cur, upage) != NULL)
+        fail ("refused mmap_map left page %d %s", i, desc);
+    }
+  msg ("mmap_map refused %s", desc);
+}
+
+void
+test_mmap_kernel (void) 
+{
+  mapid_t map;
+
+  if (!filesys_create ("kmapped", FILE_PAGES * PGSIZE))
+    fail ("create \"kmapped\"");
+  file = filesys_open ("kmapped");
+  if (file == NULL)
+    fail ("open \"kmapped\"");
+
+  map = mmap_map (file, MAP_BASE);
+  if (map == MAP_FAILED)
+    fail ("mmap_map failed in user memory");
+  mmap_unmap (map);
+  msg ("mmap_map succeeded in user memory");
+
+  check_refused (PHYS_BASE, "at PHYS_BASE");
+  check_refused ((void *) 0xfffff000, "at top of kernel memory");
+  check_refused ((uint8_t *) PHYS_BASE - PGSIZE, "across PHYS_BASE");
+
+  file_close (file);
+}
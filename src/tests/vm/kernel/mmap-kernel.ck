@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmap-kernel) begin
+(mmap-kernel) mmap_map succeeded in user memory
+(mmap-kernel) mmap_map refused at PHYS_BASE
+(mmap-kernel) mmap_map refused at top of kernel memory
+(mmap-kernel) mmap_map refused across PHYS_BASE
+(mmap-kernel) end
+EOF
+pass;
@@ -0,0 +1,128 @@
+/** Maps a file of four pages, reads one page and writes another,
+   and checks that only the page that was written goes back to
+   the file, first when the mapping is removed, then when the
+   pages are evicted.
+
+   To tell whether a page was written back, the test changes the
+   file behind the mapping's back, through its own handle, after
+   the page has been read in.  Writing back the page would undo
+   that change. */
+
+#include <string.h>
+#include "tests/vm/kernel/tests.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+
+#define FILE_PAGES 4
+#define MAP_BASE ((uint8_t *) 0x10000000)
+#define FILL_BASE ((uint8_t *) 0x20000000)
+
+static struct file *file;
+static uint8_t *buf;
+
+/** Fills page PAGE of the file with byte VALUE. */
+static void
+write_file_page (int page, uint8_t value) 
+{
+  memset (buf, value, PGSIZE);
+  if (file_write_at (file, buf, PGSIZE, page * PGSIZE) != PGSIZE)
+    fail ("writing page %d of file", page);
+}
+
+/** Checks that every byte of page PAGE of the file is VALUE. */
+static void
+check_file_page (int page, uint8_t value) 
+{
+  int i;
+
+  if (file_read_at (file, buf, PGSIZE, page * PGSIZE) != PGSIZE)
+    fail ("reading page %d of file", page);
+  for (i = 0; i < PGSIZE; i++)
+    if (buf[i] != value)
+      fail ("page %d of file has %#x at offset %d, expected %#x",
+            page, buf[i], i, value);
+}
+
+/** Maps the file, after resetting page I of it to 'a' + I, reads
+   page 0 through the mapping, writes page 1 with byte DIRTY, and
+   then changes page 0 of the file to byte CHANGED.  Returns the
+   mapping. */
+static mapid_t
+map_and_touch (uint8_t dirty, uint8_t changed) 
+{
+  mapid_t map;
+  int i;
+
+  for (i = 0; i < FILE_PAGES; i++)
+    write_file_page (i, 'a' + i);
+  map = mmap_map (file, MAP_BASE);
+  if (map == MAP_FAILED)
+    fail ("mmap_map failed");
+  if (*(volatile uint8_t *) MAP_BASE != 'a')
+    fail ("mapped page 0 does not match file");
+  memset (MAP_BASE + PGSIZE, dirty, PGSIZE);
+  write_file_page (0, changed);
+  return map;
+}
+
+/** Reads a page of each of enough zero pages to fill memory
+   twice over, so that the clock goes all the way around and
+   evicts every page that is not in use. */
+static void
+fill_memory (void) 
+{
+  size_t page_cnt = 2 * init_ram_pages;
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    if (!page_add_zero (FILL_BASE + i * PGSIZE, false))
+      fail ("out of memory adding page %zu", i);
+  for (i = 0; i < page_cnt; i++)
+    if (*(volatile uint8_t *) (FILL_BASE + i * PGSIZE) != 0)
+      fail ("zero page %zu is not zero", i);
+}
+
+void
+test_mmap_writeback (void) 
+{
+  struct thread *cur = thread_current ();
+  mapid_t map;
+
+  buf = palloc_get_page (PAL_ASSERT);
+  if (!filesys_create ("mapped", FILE_PAGES * PGSIZE))
+    fail ("create \"mapped\"");
+  file = filesys_open ("mapped");
+  if (file == NULL)
+    fail ("open \"mapped\"");
+
+  /* Write-back on unmap. */
+  map = map_and_touch ('X', 'C');
+  mmap_unmap (map);
+  check_file_page (0, 'C');
+  check_file_page (1, 'X');
+  check_file_page (2, 'c');
+  check_file_page (3, 'd');
+  msg ("only the dirty page was written back on unmap");
+
+  /* Write-back on eviction. */
+  map = map_and_touch ('Y', 'D');
+  fill_memory ();
+  if (page_lookup (cur, MAP_BASE)->frame != NULL
+      || page_lookup (cur, MAP_BASE + PGSIZE)->frame != NULL)
+    fail ("mapped pages were not evicted");
+  check_file_page (0, 'D');
+  check_file_page (1, 'Y');
+  if (MAP_BASE[PGSIZE] != 'Y')
+    fail ("evicted dirty page did not read back from file");
+  msg ("only the dirty page was written back on eviction");
+
+  mmap_unmap (map);
+  file_close (file);
+  palloc_free_page (buf);
+}
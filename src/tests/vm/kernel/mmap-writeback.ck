@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmap-writeback) begin
+(mmap-writeback) only the dirty page was written back on unmap
+(mmap-writeback) only the dirty page was written back on eviction
+(mmap-writeback) end
+EOF
+pass;
@@ -0,0 +1,130 @@
+#include "tests/vm/kernel/tests.h"
+#include <debug.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+
+/** Tests of the virtual memory system that run in the kernel.
+
+   These tests call the kernel's side of mmap() and fork()
+   directly, so that they can check what a user program cannot
+   see, such as whether a page is in a frame or was written back
+   to its file.  Each test runs in a thread of its own that has
+   a user address space but no executable, so that it can map
+   pages and touch them as a process would; the kernel handles
+   its faults on user addresses just like a process's.  The
+   address space is freed when the thread exits. */
+
+struct test 
+  {
+    const char *name;
+    test_func *function;
+  };
+
+static const struct test tests[] = 
+  {
+    {"mmap-writeback", test_mmap_writeback},
+    {"mmap-kernel", test_mmap_kernel},
+    {"fork-cow", test_fork_cow},
+  };
+
+static const char *test_name;
+static test_func *test_function;
+static struct semaphore test_done;
+
+static thread_func test_thread;
+
+/** Runs the test named NAME, if there is one, and returns true.
+   Returns false if there is no such test. */
+bool
+run_kernel_test (const char *name) 
+{
+  const struct test *t;
+
+  for (t = tests; t < tests + sizeof tests / sizeof *tests; t++)
+    if (!strcmp (name, t->name))
+      {
+        test_name = name;
+        test_function = t->function;
+        sema_init (&test_done, 0);
+        msg ("begin");
+        if (thread_create (name, PRI_DEFAULT, test_thread, NULL)
+            == TID_ERROR)
+          fail ("thread_create failed");
+        sema_down (&test_done);
+        msg ("end");
+        return true;
+      }
+  return false;
+}
+
+/** Runs the test in a thread with a user address space. */
+static void
+test_thread (void *aux UNUSED) 
+{
+  test_process_init ();
+  test_function ();
+  sema_up (&test_done);
+}
+
+/** Gives the running thread an empty user address space, as
+   load() does for a process, which process_exit() frees. */
+void
+test_process_init (void) 
+{
+  struct thread *t = thread_current ();
+
+  if (!page_table_create ())
+    fail ("out of memory creating page table");
+  mmap_table_init ();
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    fail ("out of memory creating page directory");
+  process_activate ();
+}
+
+/** Prints FORMAT as if with printf(),
+   prefixing the output by the name of the test
+   and following it with a new-line character. */
+void
+msg (const char *format, ...) 
+{
+  va_list args;
+  
+  printf ("(%s) ", test_name);
+  va_start (args, format);
+  vprintf (format, args);
+  va_end (args);
+  putchar ('\n');
+}
+
+/** Prints failure message FORMAT as if with printf(),
+   prefixing the output by the name of the test and FAIL:
+   and following it with a new-line character,
+   and then panics the kernel. */
+void
+fail (const char *format, ...) 
+{
+  va_list args;
+  
+  printf ("(%s) FAIL: ", test_name);
+  va_start (args, format);
+  vprintf (format, args);
+  va_end (args);
+  putchar ('\n');
+
+  PANIC ("test failed");
+}
+
+/** Prints a message indicating the current test passed. */
+void
+pass (void) 
+{
+  printf ("(%s) PASS\n", test_name);
+}
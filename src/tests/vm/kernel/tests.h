@@ -0,0 +1,19 @@
+#ifndef TESTS_VM_KERNEL_TESTS_H
+#define TESTS_VM_KERNEL_TESTS_H
+
+#include <stdbool.h>
+
+bool run_kernel_test (const char *);
+
+typedef void test_func (void);
+
+extern test_func test_mmap_writeback;
+extern test_func test_mmap_kernel;
+extern test_func test_fork_cow;
+
+void test_process_init (void);
+void msg (const char *, ...);
+void fail (const char *, ...);
+void pass (void);
+
+#endif /**< tests/vm/kernel/tests.h */
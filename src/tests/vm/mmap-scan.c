@@ -0,0 +1,81 @@
+/** Scans a large file twice, once by reading it into a buffer
+   with the read system call and once through a memory mapping,
+   checks that both scans see the same data, and reports the
+   time each took. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (512 * 1024)
+#define ACTUAL ((unsigned char *) 0x10000000)
+
+/** Buffer for read(), and for writing the file. */
+static unsigned char buf[FILE_SIZE];
+
+/** Reads the time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/** Returns a checksum of the SIZE bytes at P. */
+static unsigned
+scan (const unsigned char *p, size_t size)
+{
+  unsigned sum = 0;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    sum = sum * 31 + p[i];
+  return sum;
+}
+
+void
+test_main (void)
+{
+  unsigned read_sum, mmap_sum;
+  uint64_t start, read_cycles, mmap_cycles;
+  mapid_t map;
+  int handle;
+  size_t i;
+
+  for (i = 0; i < FILE_SIZE; i++)
+    buf[i] = i * 7 + (i >> 12);
+  CHECK (create ("large.bin", FILE_SIZE), "create \"large.bin\"");
+  CHECK ((handle = open ("large.bin")) > 1, "open \"large.bin\"");
+  CHECK (write (handle, buf, FILE_SIZE) == FILE_SIZE,
+         "write \"large.bin\"");
+  close (handle);
+  memset (buf, 0, FILE_SIZE);
+
+  /* Scan with read(). */
+  start = rdtsc ();
+  handle = open ("large.bin");
+  if (handle < 2 || read (handle, buf, FILE_SIZE) != FILE_SIZE)
+    fail ("read \"large.bin\"");
+  read_sum = scan (buf, FILE_SIZE);
+  close (handle);
+  read_cycles = rdtsc () - start;
+
+  /* Scan through a mapping. */
+  start = rdtsc ();
+  handle = open ("large.bin");
+  if (handle < 2 || (map = mmap (handle, ACTUAL)) == MAP_FAILED)
+    fail ("mmap \"large.bin\"");
+  mmap_sum = scan (ACTUAL, FILE_SIZE);
+  munmap (map);
+  close (handle);
+  mmap_cycles = rdtsc () - start;
+
+  CHECK (read_sum == mmap_sum, "compare checksums");
+  msg ("%llu cycles per page with read.",
+       read_cycles / (FILE_SIZE / 4096));
+  msg ("%llu cycles per page with mmap.",
+       mmap_cycles / (FILE_SIZE / 4096));
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, IGNORE_TIMINGS => 1, [<<'EOF']);
+(mmap-scan) begin
+(mmap-scan) create "large.bin"
+(mmap-scan) open "large.bin"
+(mmap-scan) write "large.bin"
+(mmap-scan) compare checksums
+(mmap-scan) end
+EOF
+pass;
@@ -0,0 +1,269 @@
+#include "threads/cpu.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/lapic.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/fpu.h"
+#include "userprog/gdt.h"
+#endif
+
+/** Multiprocessor support.
+
+   The processors are found through the MP configuration table
+   that the BIOS builds, as described in the Intel MultiProcessor
+   Specification [MP], which lists each processor's local APIC
+   ID.  Each application processor is started with an INIT-SIPI-
+   SIPI sequence from the bootstrap processor's local APIC, runs
+   ap-start.S to get into protected mode with paging, and then
+   ap_main(), below, to set itself up and become the idle thread
+   of its own run queue.
+
+   All of the kernel's data is shared, and protected by the
+   giant lock in interrupt.c.  See the comment there. */
+
+/** CPUs, indexed by struct cpu's `id'. */
+struct cpu cpus[CPU_MAX];
+
+/** Number of CPUs online.  They are cpus[0...cpu_cnt - 1]. */
+int cpu_cnt = 1;
+
+/** MP floating pointer structure.  See [MP] 4.1 "MP Floating
+   Pointer Structure". */
+struct mp_float
+  {
+    char signature[4];                  /**< "_MP_". */
+    uint32_t config_paddr;              /**< MP configuration table. */
+    uint8_t length;                     /**< Length, in 16-byte units. */
+    uint8_t revision;                   /**< Specification revision. */
+    uint8_t checksum;                   /**< Makes all bytes sum to 0. */
+    uint8_t features[5];                /**< features[0] != 0: default config. */
+  };
+
+/** MP configuration table header.  See [MP] 4.2 "MP Configuration
+   Table Header". */
+struct mp_config
+  {
+    char signature[4];                  /**< "PCMP". */
+    uint16_t length;                    /**< Base table length. */
+    uint8_t revision;                   /**< Specification revision. */
+    uint8_t checksum;                   /**< Makes all bytes sum to 0. */
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table_paddr;
+    uint16_t oem_table_size;
+    uint16_t entry_cnt;                 /**< Number of entries. */
+    uint32_t lapic_paddr;               /**< Local APIC address. */
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+  };
+
+/** MP configuration table processor entry.  The other types of
+   entry are 8 bytes long.  See [MP] 4.3.1 "Processor Entries". */
+#define MP_PROCESSOR 0
+struct mp_processor
+  {
+    uint8_t type;                       /**< MP_PROCESSOR. */
+    uint8_t lapic_id;                   /**< Local APIC ID. */
+    uint8_t lapic_version;
+    uint8_t flags;                      /**< MP_PROC_* bits. */
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+  };
+#define MP_PROC_ENABLED 0x01            /**< Usable. */
+
+/** Used by ap-start.S: the GDTR and the initial stack pointer of
+   the application processor being started. */
+uint64_t ap_gdtr;
+void *ap_stack;
+
+/** The code in ap-start.S. */
+extern char ap_start[], ap_start_end[];
+
+void ap_main (void) NO_RETURN;
+static int mp_find_cpus (uint8_t lapic_ids[CPU_MAX], uint32_t *lapic_paddr);
+static bool start_ap (uint8_t lapic_id);
+
+/** Starts up the application processors, if this is a
+   multiprocessor.  Must be called by the bootstrap processor
+   with interrupts on, after the timer has been calibrated. */
+void
+cpu_init (void)
+{
+  uint8_t lapic_ids[CPU_MAX];
+  uint32_t lapic_paddr;
+  int cnt, i;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  cnt = mp_find_cpus (lapic_ids, &lapic_paddr);
+  if (cnt < 2)
+    return;
+
+  lapic_init (lapic_paddr);
+  cpus[0].lapic_id = lapic_id ();
+  timer_calibrate_lapic ();
+
+  memcpy (ptov (AP_START), ap_start, ap_start_end - ap_start);
+  asm volatile ("sgdt %0" : "=m" (ap_gdtr));
+  for (i = 0; i < cnt; i++)
+    if (lapic_ids[i] != cpus[0].lapic_id && !start_ap (lapic_ids[i]))
+      printf ("CPU with local APIC ID %d failed to start\n", lapic_ids[i]);
+  printf ("%d CPUs online.\n", cpu_cnt);
+}
+
+/** Interrupts CPU C, so that it reschedules, if it is not the
+   running CPU. */
+void
+cpu_reschedule (struct cpu *c)
+{
+  if (c != cpu_current ())
+    lapic_send_ipi (c->lapic_id, LAPIC_VEC_RESCHEDULE);
+}
+
+/** Starts the application processor whose local APIC ID is
+   LAPIC_ID as cpus[cpu_cnt] and waits for it to come online.
+   Returns true if successful, false on failure. */
+static bool
+start_ap (uint8_t lapic_id)
+{
+  struct cpu *c;
+  struct thread *idle;
+  int i;
+
+  if (cpu_cnt >= CPU_MAX)
+    return false;
+
+  c = &cpus[cpu_cnt];
+  c->id = cpu_cnt;
+  c->lapic_id = lapic_id;
+  idle = thread_create_idle (c);
+  if (idle == NULL)
+    return false;
+  ap_stack = (uint8_t *) idle + PGSIZE;
+
+  lapic_start_ap (lapic_id, AP_START);
+  for (i = 0; i < 100 && !c->started; i++)
+    timer_msleep (1);
+  return c->started;
+}
+
+/** Entry point for application processors, called by
+   ap-start.S on the stack of the CPU's idle thread, with
+   interrupts off. */
+void
+ap_main (void)
+{
+  struct cpu *c = cpu_current ();
+
+  /* Switch from start.S's page directory to the kernel's. */
+  paging_activate ();
+
+  intr_init_ap ();
+  lapic_init_ap ();
+#ifdef USERPROG
+  gdt_init_ap ();
+  fpu_init ();
+#endif
+  timer_init_ap ();
+
+  cpu_cnt++;
+  c->started = true;
+  thread_start_ap ();
+}
+
+/** Returns the sum of the SIZE bytes starting at P. */
+static uint8_t
+sum (const void *p, size_t size)
+{
+  const uint8_t *b = p;
+  uint8_t s = 0;
+
+  while (size-- > 0)
+    s += *b++;
+  return s;
+}
+
+/** Searches SIZE bytes of physical memory starting at PADDR for
+   the MP floating pointer structure and returns it, or a null
+   pointer if it is not there. */
+static struct mp_float *
+mp_search (uint32_t paddr, size_t size)
+{
+  uint8_t *p = ptov (paddr);
+  uint8_t *end = p + size;
+
+  for (; p + sizeof (struct mp_float) <= end; p += 16)
+    {
+      struct mp_float *mpf = (struct mp_float *) p;
+      if (!memcmp (mpf->signature, "_MP_", 4)
+          && sum (mpf, mpf->length * 16) == 0)
+        return mpf;
+    }
+  return NULL;
+}
+
+/** Finds the MP floating pointer structure in one of the places
+   listed in [MP] 4 "MP Configuration Table": the first kB of the
+   extended BIOS data area, the last kB of base memory, or the
+   BIOS ROM.  Returns a null pointer if there is none, as on a
+   uniprocessor. */
+static struct mp_float *
+mp_find (void)
+{
+  uint16_t ebda_seg = *(uint16_t *) ptov (0x40e);
+  uint16_t base_kb = *(uint16_t *) ptov (0x413);
+  struct mp_float *mpf = NULL;
+
+  if (ebda_seg != 0)
+    mpf = mp_search ((uint32_t) ebda_seg << 4, 1024);
+  else
+    mpf = mp_search (base_kb * 1024 - 1024, 1024);
+  if (mpf == NULL)
+    mpf = mp_search (0xf0000, 0x10000);
+  return mpf;
+}
+
+/** Stores the local APIC IDs of the usable processors listed in
+   the MP configuration table into LAPIC_IDS, at most CPU_MAX of
+   them, and the local APIC's physical address into
+   *LAPIC_PADDR.  Returns the number of processors found, which
+   is 0 if the table is missing or one of the default
+   configurations, which we do not support. */
+static int
+mp_find_cpus (uint8_t lapic_ids[CPU_MAX], uint32_t *lapic_paddr)
+{
+  struct mp_float *mpf = mp_find ();
+  struct mp_config *conf;
+  uint8_t *p;
+  int cnt = 0;
+  int i;
+
+  if (mpf == NULL || mpf->config_paddr == 0 || mpf->features[0] != 0
+      || mpf->config_paddr >= 0x100000)
+    return 0;
+  conf = ptov (mpf->config_paddr);
+  if (memcmp (conf->signature, "PCMP", 4) || sum (conf, conf->length) != 0)
+    return 0;
+  *lapic_paddr = conf->lapic_paddr;
+
+  p = (uint8_t *) (conf + 1);
+  for (i = 0; i < conf->entry_cnt; i++)
+    if (*p == MP_PROCESSOR)
+      {
+        struct mp_processor *proc = (struct mp_processor *) p;
+        if ((proc->flags & MP_PROC_ENABLED) && cnt < CPU_MAX)
+          lapic_ids[cnt++] = proc->lapic_id;
+        p += sizeof *proc;
+      }
+    else
+      p += 8;
+  return cnt;
+}
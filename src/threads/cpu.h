@@ -0,0 +1,87 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+/** Physical address of the page at which secondary processors
+   start executing, in real mode, when they are started up.  It
+   must be page-aligned and below 1 MB.  See ap-start.S. */
+#define AP_START 0x8000
+
+#ifndef __ASSEMBLER__
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Maximum number of CPUs. */
+#define CPU_MAX 8
+
+/** A CPU.
+
+   The first processor to run, the one that boots the kernel, is
+   the bootstrap processor (BSP).  It is always cpus[0].  On a
+   multiprocessor, cpu.c starts up the others, called application
+   processors (APs), once the kernel is otherwise initialized. */
+struct cpu
+  {
+    int id;                             /**< Index in cpus[]. */
+    uint8_t lapic_id;                   /**< Local APIC ID. */
+    volatile bool started;              /**< Finished starting up? */
+
+    /* Owned by thread.c. */
+    struct thread *idle_thread;         /**< This CPU's idle thread. */
+    struct thread *current;             /**< Thread running on this CPU. */
+    unsigned thread_ticks;              /**< # of timer ticks since last yield. */
+
+    /* Owned by userprog/fpu.c. */
+    struct thread *fpu_owner;           /**< Thread whose state is in the FPU. */
+
+    /* Owned by userprog/pagedir.c. */
+    uint32_t *pagedir;                  /**< Page directory loaded in CR3. */
+    bool tlb_stale;                     /**< Reload CR3 even if unchanged? */
+
+    /* Owned by threads/kmap.c. */
+    unsigned kmap_gen;                  /**< kmap_gen at last TLB flush. */
+
+    /* Owned by interrupt.c. */
+    bool giant_held;                    /**< Holding the giant lock? */
+    bool in_external_intr;              /**< Processing an external interrupt? */
+    bool yield_on_return;               /**< Yield on interrupt return? */
+  };
+
+extern struct cpu cpus[CPU_MAX];
+extern int cpu_cnt;
+
+struct cpu *cpu_current (void);
+void cpu_init (void);
+void cpu_reschedule (struct cpu *);
+
+/** Reads the processor's time-stamp counter, which counts CPU
+   clock cycles since reset.  Useful for measuring short
+   intervals, such as the time spent in an interrupt handler.
+   See [IA32-v2b] "RDTSC--Read Time-Stamp Counter". */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/** Feature flags returned by CPUID leaf 1 in EDX.  See [IA32-v2a]
+   "CPUID--CPU Identification". */
+#define CPUID_PSE (1u << 3)             /**< 4 MB pages. */
+#define CPUID_PGE (1u << 13)            /**< Global pages. */
+#define CPUID_FXSR (1u << 24)           /**< FXSAVE and FXRSTOR. */
+#define CPUID_SSE (1u << 25)            /**< SSE. */
+
+/** Executes CPUID for leaf LEAF and returns the feature flags that
+   it reports in EDX. */
+static inline uint32_t
+cpuid_edx (uint32_t leaf)
+{
+  uint32_t a, b, c, d;
+  asm volatile ("cpuid"
+                : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (leaf));
+  return d;
+}
+#endif /**< __ASSEMBLER__ */
+
+#endif /**< threads/cpu.h */
@@ -15,13 +15,17 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/kmap.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memprof.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -37,10 +41,24 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#include "tests/vm/kernel/tests.h"
+#endif
 
 /** Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/** CR4 flags. */
+#define CR4_PSE 0x00000010      /**< Page size extensions: 4 MB pages. */
+#define CR4_PGE 0x00000080      /**< Page global enable. */
+
+/** CR4 flags that paging_activate() sets on each CPU, chosen by
+   paging_init() according to what the CPU supports. */
+static uint32_t paging_cr4;
+
 #ifdef FILESYS
 /** -f: Format the file system? */
 static bool format_filesys;
@@ -54,7 +72,10 @@ static const char *swap_bdev_name;
 #endif
 #endif /**< FILESYS */
 
-/** -ul: Maximum number of pages to put into palloc's user pool. */
+/** -memprof: Profile kernel memory allocations? */
+static bool memprof;
+
+/** -ul: Maximum number of pages that palloc gives to user pages. */
 static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
@@ -62,6 +83,7 @@ static void paging_init (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
+static void parse_tpool (char *value);
 static void run_actions (char **argv);
 static void usage (void);
 
@@ -92,12 +114,20 @@ pintos_init (void)
 
   /* Greet user. */
   printf ("Pintos booting with %'"PRIu32" kB RAM...\n",
-          init_ram_pages * PGSIZE / 1024);
+          init_ram_pages * (PGSIZE / 1024));
 
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+  kmap_init ();
+  palloc_init_late ();
+  if (memprof)
+    memprof_init ();
+#ifdef VM
+  page_init ();
+  frame_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -117,15 +147,22 @@ pintos_init (void)
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  workqueue_init ();
   serial_init_queue ();
   timer_calibrate ();
 
+  /* Start the other CPUs, if any. */
+  cpu_init ();
+
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init ();
+#endif
 
   printf ("Boot complete.\n");
   
@@ -154,20 +191,41 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
-/** Populates the base page directory and page table with the
-   kernel virtual mapping, and then sets up the CPU to use the
-   new page directory.  Points init_page_dir to the page
-   directory it creates. */
+/** Populates the base page directory and page tables with the
+   kernel virtual mapping of low memory, and then sets up the CPU
+   to use the new page directory.  Points init_page_dir to the
+   page directory it creates.
+
+   If the CPU supports 4 MB pages, each 4 MB of low memory that
+   is mapped in full is mapped by a single large-page PDE,
+   without a page table, except for the ones that contain kernel
+   text, which still need 4 kB pages so that the text can be
+   read-only.  If the CPU supports global pages, all of these
+   mappings are global, so that they stay in the TLB when a
+   process switch loads CR3.  Nothing may change them afterward,
+   since that would need a TLB flush of global entries too. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
-  size_t page;
+  uint32_t features, global;
+  size_t page, page_cnt;
   extern char _start, _end_kernel_text;
 
+  page_cnt = init_ram_pages;
+  if (page_cnt > LOWMEM_LIMIT / PGSIZE)
+    page_cnt = LOWMEM_LIMIT / PGSIZE;
+
+  features = cpuid_edx (1);
+  if (features & CPUID_PSE)
+    paging_cr4 |= CR4_PSE;
+  if (features & CPUID_PGE)
+    paging_cr4 |= CR4_PGE;
+  global = paging_cr4 & CR4_PGE ? PTE_G : 0;
+
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
-  for (page = 0; page < init_ram_pages; page++)
+  for (page = 0; page < page_cnt; page++)
     {
       uintptr_t paddr = page * PGSIZE;
       char *vaddr = ptov (paddr);
@@ -175,21 +233,47 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pte_idx == 0 && (paging_cr4 & CR4_PSE)
+          && page_cnt - page >= PTSPAN / PGSIZE
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (paddr) | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
+  paging_activate ();
+}
+
+/** Sets the CR4 flags that paging_init() chose, then switches the
+   running CPU to init_page_dir.  Called by the bootstrap
+   processor from paging_init(), and by each application
+   processor as it starts up. */
+void
+paging_activate (void)
+{
+  uint32_t cr4;
+
+  /* CR4.PSE must be set before the CPU walks a page directory
+     with large-page PDEs in it. */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4 | paging_cr4));
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
-  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
 }
 
 /** Breaks the kernel command line into words and returns them as
@@ -260,6 +344,12 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-tpool"))
+        parse_tpool (value);
+      else if (!strcmp (name, "-memprof"))
+        memprof = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -281,6 +371,22 @@ parse_options (char **argv)
   return argv;
 }
 
+/** Parses VALUE, the argument to the "-tpool" option, as
+   "LOW,HIGH" and sets the thread page pool's watermarks. */
+static void
+parse_tpool (char *value) 
+{
+  char *save_ptr;
+  char *low = value != NULL ? strtok_r (value, ",", &save_ptr) : NULL;
+  char *high = low != NULL ? strtok_r (NULL, "", &save_ptr) : NULL;
+
+  if (high == NULL || atoi (low) < 0 || atoi (high) < atoi (low))
+    PANIC ("bad -tpool argument `%s' (need LOW,HIGH)",
+           value != NULL ? value : "");
+  thread_pool_low = atoi (low);
+  thread_pool_high = atoi (high);
+}
+
 /** Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv)
@@ -288,7 +394,10 @@ run_task (char **argv)
   const char *task = argv[1];
   
   printf ("Executing '%s':\n", task);
-#ifdef USERPROG
+#if defined VM
+  if (!run_kernel_test (task))
+    process_wait (process_execute (task));
+#elif defined USERPROG
   process_wait (process_execute (task));
 #else
   run_test (task);
@@ -358,6 +467,9 @@ usage (void)
           "\nAvailable actions:\n"
 #ifdef USERPROG
           "  run 'PROG [ARG...]' Run PROG and wait for it to complete.\n"
+#ifdef VM
+          "  run TEST           Run kernel test TEST, if there is one.\n"
+#endif
 #else
           "  run TEST           Run TEST.\n"
 #endif
@@ -383,6 +495,9 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Use dynamic ticks and one-shot timer.\n"
+          "  -tpool=LOW,HIGH    Pool LOW to HIGH free thread pages.\n"
+          "  -memprof           Profile kernel memory allocations.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
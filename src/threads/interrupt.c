@@ -3,11 +3,14 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/spinlock.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
 #include "devices/timer.h"
 
 /** Programmable Interrupt Controller (PIC) registers.
@@ -37,15 +40,45 @@ static const char *intr_names[INTR_CNT];
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
 
+/** For each external interrupt vector, the number of interrupts
+   handled and the cycles spent handling them, during all of which
+   interrupts were off.  A handler that takes long should do its
+   work in a work queue instead (see workqueue.c). */
+static long long intr_cnt[INTR_CNT];
+static uint64_t intr_cycles[INTR_CNT];
+static uint64_t intr_max_cycles[INTR_CNT];
+
 /** External interrupts are those generated by devices outside the
-   CPU, such as the timer.  External interrupts run with
-   interrupts turned off, so they never nest, nor are they ever
-   pre-empted.  Handlers for external interrupts also may not
-   sleep, although they may invoke intr_yield_on_return() to
-   request that a new process be scheduled just before the
-   interrupt returns. */
-static bool in_external_intr;   /**< Are we processing an external interrupt? */
-static bool yield_on_return;    /**< Should we yield on interrupt return? */
+   CPU, such as the timer, or by another CPU's local APIC.
+   External interrupts run with interrupts turned off, so they
+   never nest, nor are they ever pre-empted.  Handlers for
+   external interrupts also may not sleep, although they may
+   invoke intr_yield_on_return() to request that a new process be
+   scheduled just before the interrupt returns.  Each CPU keeps
+   track of this separately, in its struct cpu. */
+
+/** The giant lock.
+
+   The kernel protects its data by turning interrupts off, which
+   is enough on one CPU, but not when there are several.  So that
+   all of that code still works on a multiprocessor, a CPU holds
+   the giant lock exactly while it has interrupts off: it takes
+   the lock whenever it turns interrupts off, whether by
+   intr_disable() or by taking an interrupt, and releases it
+   whenever it turns them back on.  Thus only one CPU at a time
+   runs with interrupts off, and code that was correct on one
+   CPU stays correct.  This covers the scheduler, the allocators
+   and the synchronization primitives.  Threads still run
+   concurrently on all CPUs whenever they have interrupts on.
+
+   The lock belongs to the CPU, not the thread, so a thread can
+   switch to another with interrupts off, as the scheduler
+   does, and the new thread releases the lock when it turns
+   interrupts on. */
+static struct spinlock giant = SPINLOCK_INITIALIZER;
+
+static void giant_acquire (void);
+static void giant_release (void);
 
 /** Programmable Interrupt Controller helpers. */
 static void pic_init (void);
@@ -58,6 +91,7 @@ static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 
 /** Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
+static void account_intr (uint8_t vec_no, uint64_t cycles);
 static void unexpected_interrupt (const struct intr_frame *);
 
 /** Returns the current interrupt status. */
@@ -90,6 +124,9 @@ intr_enable (void)
   enum intr_level old_level = intr_get_level ();
   ASSERT (!intr_context ());
 
+  if (old_level == INTR_OFF)
+    giant_release ();
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -110,9 +147,62 @@ intr_disable (void)
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
 
+  if (old_level == INTR_ON)
+    giant_acquire ();
+
   return old_level;
 }
-
+
+/** Enables interrupts and waits for the next one, then returns
+   with interrupts on.  Interrupts must be off.
+
+   The `sti' instruction disables interrupts until the completion
+   of the next instruction, so `sti; hlt' is executed atomically.
+   This atomicity is important; otherwise, an interrupt could be
+   handled between re-enabling interrupts and waiting for the
+   next one to occur, wasting as much as one clock tick worth of
+   time.
+
+   See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a] 7.11.1
+   "HLT Instruction". */
+void
+intr_wait (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!intr_context ());
+
+  giant_release ();
+  asm volatile ("sti; hlt" : : : "memory");
+}
+
+/** Takes the giant lock for the running CPU, which must have
+   interrupts off. */
+static void
+giant_acquire (void) 
+{
+  struct cpu *c = cpu_current ();
+
+  ASSERT (!c->giant_held);
+  spinlock_acquire (&giant);
+  c->giant_held = true;
+}
+
+/** Releases the giant lock, if the running CPU holds it.  The
+   bootstrap processor starts out with interrupts off without
+   holding it, which is harmless because it is the only CPU
+   running then. */
+static void
+giant_release (void) 
+{
+  struct cpu *c = cpu_current ();
+
+  if (c->giant_held) 
+    {
+      c->giant_held = false;
+      spinlock_release (&giant);
+    }
+}
+
 /** Initializes the interrupt system. */
 void
 intr_init (void)
@@ -157,6 +247,22 @@ intr_init (void)
   intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/** Initializes the interrupt system on an application processor,
+   which shares the bootstrap processor's IDT.  Interrupts must
+   be off, so this also takes the giant lock. */
+void
+intr_init_ap (void)
+{
+  uint64_t idtr_operand;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  idtr_operand = make_idtr_operand (sizeof idt - 1, idt);
+  asm volatile ("lidt %0" : : "m" (idtr_operand));
+
+  giant_acquire ();
+}
+
 /** Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -174,6 +280,16 @@ register_handler (uint8_t vec_no, int dpl, enum intr_level level,
   intr_names[vec_no] = name;
 }
 
+/** Returns true if VEC_NO is the vector of an external
+   interrupt: one from the PICs, at 0x20...0x2f, or one from the
+   local APIC, at 0x40...0x4f. */
+static bool
+is_external (uint8_t vec_no) 
+{
+  return ((vec_no >= 0x20 && vec_no <= 0x2f)
+          || (vec_no >= 0x40 && vec_no <= 0x4f));
+}
+
 /** Registers external interrupt VEC_NO to invoke HANDLER, which
    is named NAME for debugging purposes.  The handler will
    execute with interrupts disabled. */
@@ -181,7 +297,7 @@ void
 intr_register_ext (uint8_t vec_no, intr_handler_func *handler,
                    const char *name) 
 {
-  ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+  ASSERT (is_external (vec_no));
   register_handler (vec_no, 0, INTR_OFF, handler, name);
 }
 
@@ -202,7 +318,7 @@ void
 intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
                    intr_handler_func *handler, const char *name)
 {
-  ASSERT (vec_no < 0x20 || vec_no > 0x2f);
+  ASSERT (!is_external (vec_no));
   register_handler (vec_no, dpl, level, handler, name);
 }
 
@@ -211,7 +327,7 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
 bool
 intr_context (void) 
 {
-  return in_external_intr;
+  return cpu_current ()->in_external_intr;
 }
 
 /** During processing of an external interrupt, directs the
@@ -222,7 +338,7 @@ void
 intr_yield_on_return (void) 
 {
   ASSERT (intr_context ());
-  yield_on_return = true;
+  cpu_current ()->yield_on_return = true;
 }
 
 /** 8259A Programmable Interrupt Controller. */
@@ -344,28 +460,40 @@ make_idtr_operand (uint16_t limit, void *base)
 void
 intr_handler (struct intr_frame *frame) 
 {
-  bool external;
+  bool external, giant;
   intr_handler_func *handler;
+  struct cpu *c;
+  uint64_t start = 0;
+
+  /* If the interrupt gate turned interrupts off, take the giant
+     lock, unless the interrupted code already had interrupts off
+     and thus holds it.  See the comment on `giant' above. */
+  giant = (frame->eflags & FLAG_IF) && intr_get_level () == INTR_OFF;
+  if (giant)
+    giant_acquire ();
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
-     and they need to be acknowledged on the PIC (see below).
-     An external interrupt handler cannot sleep. */
-  external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+     and they need to be acknowledged on the PIC or local APIC
+     (see below).  An external interrupt handler cannot sleep. */
+  external = is_external (frame->vec_no);
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (!intr_context ());
 
-      in_external_intr = true;
-      yield_on_return = false;
+      c = cpu_current ();
+      c->in_external_intr = true;
+      c->yield_on_return = false;
+      start = rdtsc ();
     }
 
   /* Invoke the interrupt's handler. */
   handler = intr_handlers[frame->vec_no];
   if (handler != NULL)
     handler (frame);
-  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f)
+  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f
+           || frame->vec_no == LAPIC_VEC_SPURIOUS)
     {
       /* There is no handler, but this interrupt can trigger
          spuriously due to a hardware fault or hardware race
@@ -380,12 +508,33 @@ intr_handler (struct intr_frame *frame)
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (intr_context ());
 
-      in_external_intr = false;
-      pic_end_of_interrupt (frame->vec_no); 
+      c = cpu_current ();
+      c->in_external_intr = false;
+      if (frame->vec_no < 0x30)
+        pic_end_of_interrupt (frame->vec_no); 
+      else if (frame->vec_no != LAPIC_VEC_SPURIOUS)
+        lapic_eoi ();
+      account_intr (frame->vec_no, rdtsc () - start);
 
-      if (yield_on_return) 
+      if (c->yield_on_return) 
         thread_yield (); 
     }
+
+  /* Release the giant lock if we took it and still hold it:
+     `iret' will turn interrupts back on. */
+  if (giant && intr_get_level () == INTR_OFF)
+    giant_release ();
+}
+
+/** Records that the handler for external interrupt VEC_NO kept
+   interrupts off for CYCLES. */
+static void
+account_intr (uint8_t vec_no, uint64_t cycles) 
+{
+  intr_cnt[vec_no]++;
+  intr_cycles[vec_no] += cycles;
+  if (cycles > intr_max_cycles[vec_no])
+    intr_max_cycles[vec_no] = cycles;
 }
 
 /** Handles an unexpected interrupt with interrupt frame F.  An
@@ -430,6 +579,21 @@ intr_dump_frame (const struct intr_frame *f)
           f->cs, f->ds, f->es, f->ss);
 }
 
+/** Prints, for each external interrupt that has occurred, how
+   long its handler kept interrupts off. */
+void
+intr_print_stats (void) 
+{
+  int vec;
+
+  for (vec = 0; vec < INTR_CNT; vec++)
+    if (intr_cnt[vec] > 0)
+      printf ("Interrupt %#04x (%s): %lld handled, "
+              "%"PRIu64" cycles average, %"PRIu64" cycles max\n",
+              vec, intr_names[vec], intr_cnt[vec],
+              intr_cycles[vec] / intr_cnt[vec], intr_max_cycles[vec]);
+}
+
 /** Returns the name of interrupt VEC. */
 const char *
 intr_name (uint8_t vec) 
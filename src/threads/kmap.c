@@ -0,0 +1,230 @@
+#include "threads/kmap.h"
+#include <debug.h>
+#include <stdbool.h>
+#include "threads/cpu.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+
+/** Temporary kernel mappings.
+
+   Only low memory is permanently mapped into the kernel's
+   virtual address space (see vaddr.h).  To read or write a frame
+   in high memory, the kernel maps it into one of KMAP_CNT
+   "slots", the pages starting at KMAP_BASE, whose page table is
+   shared by every page directory.  For a frame in low memory,
+   kmap() and kmap_atomic() just return its address in the
+   direct map.
+
+   kmap() may sleep waiting for a free slot, and the mapping that
+   it returns lasts until kunmap().  Unmapping a slot invalidates
+   it in the running CPU's TLB, but another CPU may still have it
+   cached, if the thread that used it moved between CPUs or if
+   the CPU loaded it speculatively.  So a freed slot is not used
+   again until kmap() has gone through all of the slots and
+   wrapped around.  Then it bumps `kmap_gen', which tells every
+   CPU that its TLB may hold stale slots.  A CPU flushes its TLB
+   in kmap_sync() if `kmap_gen' has changed since it last did,
+   which kmap() calls before it hands out any slot, since a
+   thread that has kept running on one CPU may get a slot that
+   another CPU's wrap-around made reusable.  kmap_sync() also
+   runs at every thread switch, which covers a thread that moves
+   to a CPU with a mapping that it already holds.
+
+   kmap_atomic() uses a slot reserved for the running CPU, so it
+   never sleeps.  The mapping must be used and released with
+   interrupts off, so that no other thread can run on the CPU or
+   take over the slot in the meantime. */
+
+/** State of a slot. */
+enum slot_state
+  {
+    SLOT_FREE,                  /**< Free and absent from every TLB. */
+    SLOT_MAPPED,                /**< Mapped by kmap(). */
+    SLOT_STALE,                 /**< Unmapped, maybe still in a TLB. */
+    SLOT_ATOMIC                 /**< Reserved for kmap_atomic(). */
+  };
+
+/** Page table for the slots. */
+static uint32_t *kmap_pt;
+
+/** State of each slot. */
+static enum slot_state slots[KMAP_CNT];
+
+/** Next slot for kmap() to try. */
+static size_t next_slot;
+
+/** Number of slots that are not SLOT_MAPPED or SLOT_ATOMIC. */
+static struct semaphore slot_sema;
+
+/** Number of times the slots have wrapped around. */
+static unsigned kmap_gen;
+
+/** Returns the virtual address of SLOT. */
+static inline uint8_t *
+slot_to_va (size_t slot) 
+{
+  return KMAP_BASE + slot * PGSIZE;
+}
+
+/** Returns the slot that VA is in. */
+static inline size_t
+va_to_slot (const void *va) 
+{
+  ASSERT ((const uint8_t *) va >= KMAP_BASE
+          && (const uint8_t *) va < KMAP_BASE + KMAP_CNT * PGSIZE);
+  return ((const uint8_t *) va - KMAP_BASE) / PGSIZE;
+}
+
+/** Invalidates VA's entry in the running CPU's TLB.  See
+   [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+static inline void
+invlpg (const void *va) 
+{
+  asm volatile ("invlpg (%0)" : : "r" (va) : "memory");
+}
+
+/** Flushes the running CPU's TLB by reloading CR3. */
+static inline void
+flush_tlb (void) 
+{
+  uint32_t cr3;
+  asm volatile ("movl %%cr3, %0; movl %0, %%cr3" : "=r" (cr3) : : "memory");
+}
+
+/** Creates the page table for the slots in the kernel's page
+   directory.  Must be called after paging_init() and before any
+   other page directory is created, so that every page directory
+   shares it. */
+void
+kmap_init (void) 
+{
+  size_t i;
+
+  kmap_pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  init_page_dir[pd_no (KMAP_BASE)] = pde_create (kmap_pt);
+  for (i = 0; i < CPU_MAX; i++)
+    slots[i] = SLOT_ATOMIC;
+  next_slot = CPU_MAX;
+  sema_init (&slot_sema, KMAP_CNT - CPU_MAX);
+}
+
+/** Returns a kernel virtual address at which the frame at
+   physical address PADDR may be accessed, until it is passed to
+   kunmap().  May sleep, so it must not be called from an
+   interrupt handler. */
+void *
+kmap (uintptr_t paddr) 
+{
+  enum intr_level old_level;
+  size_t slot;
+
+  ASSERT (paddr % PGSIZE == 0);
+  if (paddr < LOWMEM_LIMIT)
+    return ptov (paddr);
+
+  ASSERT (!intr_context ());
+  sema_down (&slot_sema);
+
+  old_level = intr_disable ();
+  for (;;) 
+    {
+      if (next_slot >= KMAP_CNT) 
+        {
+          /* Wrap around, making the stale slots usable again. */
+          for (slot = CPU_MAX; slot < KMAP_CNT; slot++)
+            if (slots[slot] == SLOT_STALE)
+              slots[slot] = SLOT_FREE;
+          next_slot = CPU_MAX;
+          kmap_gen++;
+        }
+      slot = next_slot++;
+      if (slots[slot] == SLOT_FREE)
+        break;
+    }
+
+  /* The slot may have been freed by a wrap-around on any CPU,
+     not just this one. */
+  kmap_sync ();
+  slots[slot] = SLOT_MAPPED;
+  kmap_pt[slot] = paddr | PTE_W | PTE_P;
+  intr_set_level (old_level);
+
+  return slot_to_va (slot);
+}
+
+/** Releases PAGE, a mapping returned by kmap(). */
+void
+kunmap (void *page) 
+{
+  enum intr_level old_level;
+  size_t slot;
+
+  ASSERT (pg_ofs (page) == 0);
+  if ((uint8_t *) page < KMAP_BASE)
+    return;
+
+  slot = va_to_slot (page);
+  old_level = intr_disable ();
+  ASSERT (slots[slot] == SLOT_MAPPED);
+  kmap_pt[slot] = 0;
+  invlpg (page);
+  slots[slot] = SLOT_STALE;
+  intr_set_level (old_level);
+
+  sema_up (&slot_sema);
+}
+
+/** Returns a kernel virtual address at which the frame at
+   physical address PADDR may be accessed, until it is passed to
+   kunmap_atomic().  Interrupts must be off, and must stay off
+   until then. */
+void *
+kmap_atomic (uintptr_t paddr) 
+{
+  size_t slot;
+
+  ASSERT (paddr % PGSIZE == 0);
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (paddr < LOWMEM_LIMIT)
+    return ptov (paddr);
+
+  slot = cpu_current ()->id;
+  ASSERT (kmap_pt[slot] == 0);
+  kmap_pt[slot] = paddr | PTE_W | PTE_P;
+  return slot_to_va (slot);
+}
+
+/** Releases PAGE, a mapping returned by kmap_atomic(). */
+void
+kunmap_atomic (void *page) 
+{
+  size_t slot;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if ((uint8_t *) page < KMAP_BASE)
+    return;
+
+  slot = va_to_slot (page);
+  ASSERT (slot == (size_t) cpu_current ()->id);
+  kmap_pt[slot] = 0;
+  invlpg (page);
+}
+
+/** Flushes the running CPU's TLB if slots have been reused since
+   it last did.  Called on every thread switch, with interrupts
+   off. */
+void
+kmap_sync (void) 
+{
+  struct cpu *c = cpu_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (c->kmap_gen != kmap_gen) 
+    {
+      flush_tlb ();
+      c->kmap_gen = kmap_gen;
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef THREADS_KMAP_H
+#define THREADS_KMAP_H
+
+#include <stdint.h>
+#include "threads/vaddr.h"
+
+/** Temporary kernel mappings of physical frames live in the one
+   page table's worth of kernel virtual addresses just past the
+   end of low memory's mapping. */
+#define KMAP_BASE ((uint8_t *) PHYS_BASE + LOWMEM_LIMIT)
+#define KMAP_CNT 1024
+
+void kmap_init (void);
+void *kmap (uintptr_t paddr);
+void kunmap (void *);
+void *kmap_atomic (uintptr_t paddr);
+void kunmap_atomic (void *);
+void kmap_sync (void);
+
+#endif /**< threads/kmap.h */
@@ -5,17 +5,21 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memprof.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /** A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
+   The size of each request, in bytes, is rounded up to the next
+   size class and assigned to the "descriptor" that manages
+   blocks of that size.  The classes are the powers of 2 from 16
+   to 1024 bytes and, between each pair, 1.5 times the smaller,
+   so that no more than a third of a block is wasted.  The
+   descriptor keeps a list of free blocks.  If the free list is
+   nonempty, one of its blocks is used to satisfy the request.
 
    Otherwise, a new page of memory, called an "arena", is
    obtained from the page allocator (if none is available,
@@ -32,7 +36,20 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   Each descriptor is protected by a lock, which every thread
+   that allocates a block of its size would have to take.  So, in
+   front of the descriptors, each thread has a "magazine" for
+   each size class, a small stack of free blocks that only it
+   uses, as in [Bonwick01], "Magazines and Vmem".  malloc() takes
+   a block from the thread's magazine and free() puts one back,
+   without any locking.  Only when a magazine is empty, or full,
+   does the thread take the descriptor's lock, to move
+   MAG_BATCH blocks at once from, or to, the descriptor.  A
+   thread's magazines are allocated on its first call to
+   malloc() and emptied back into the descriptors when it
+   exits. */
 
 /** Descriptor. */
 struct desc
@@ -60,25 +77,55 @@ struct block
     struct list_elem free_elem; /**< Free list element. */
   };
 
+/** Block sizes of the descriptors, in increasing order. */
+static const size_t class_sizes[] =
+  {16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024};
+#define CLASS_CNT (sizeof class_sizes / sizeof *class_sizes)
+
 /** Our set of descriptors. */
-static struct desc descs[10];   /**< Descriptors. */
+static struct desc descs[CLASS_CNT]; /**< Descriptors. */
 static size_t desc_cnt;         /**< Number of descriptors. */
 
+/** Magazines. */
+#define MAG_ROUNDS 8            /**< Capacity of a magazine. */
+#define MAG_BATCH 4             /**< Blocks moved per refill or drain. */
+
+/** A magazine: a stack of free blocks of one size class. */
+struct magazine
+  {
+    size_t cnt;                 /**< Number of blocks in `rounds'. */
+    void *rounds[MAG_ROUNDS];   /**< Free blocks. */
+  };
+
+/** A thread's magazines, one per descriptor. */
+struct magazines
+  {
+    struct magazine mags[CLASS_CNT];
+  };
+
+/** Statistics. */
+static long long refill_cnt;    /**< # of magazine refills. */
+static long long drain_cnt;     /**< # of magazine drains. */
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct desc *size_to_desc (size_t size);
+static void *get_block (size_t size);
+static size_t desc_get (struct desc *, void **blocks, size_t cnt);
+static void desc_put (struct desc *, void **blocks, size_t cnt);
+static struct magazines *get_magazines (void);
 
 /** Initializes the malloc() descriptors. */
 void
 malloc_init (void) 
 {
-  size_t block_size;
+  size_t i;
 
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  for (i = 0; i < CLASS_CNT; i++)
     {
       struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
-      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+      d->block_size = class_sizes[i];
+      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / d->block_size;
       list_init (&d->free_list);
       lock_init (&d->lock);
     }
@@ -88,10 +135,22 @@ malloc_init (void)
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  void *p = get_block (size);
+
+  if (memprof_enabled)
+    memprof_alloc (p, size, __builtin_return_address (0));
+  return p;
+}
+
+/** Does the work of malloc(). */
+static void *
+get_block (size_t size) 
 {
   struct desc *d;
-  struct block *b;
+  struct magazines *m;
   struct arena *a;
+  void *b;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -99,15 +158,13 @@ malloc (size_t size)
 
   /* Find the smallest descriptor that satisfies a SIZE-byte
      request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
-  if (d == descs + desc_cnt) 
+  d = size_to_desc (size);
+  if (d == NULL) 
     {
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-      a = palloc_get_multiple (0, page_cnt);
+      a = palloc_get_multiple (PAL_UNTRACKED, page_cnt);
       if (a == NULL)
         return NULL;
 
@@ -119,38 +176,24 @@ malloc (size_t size)
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
+  /* Take a block from the running thread's magazine, refilling
+     it first if it is empty. */
+  m = get_magazines ();
+  if (m != NULL) 
     {
-      size_t i;
+      struct magazine *mag = &m->mags[d - descs];
 
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
-
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
+      if (mag->cnt == 0) 
         {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
+          mag->cnt = desc_get (d, mag->rounds, MAG_BATCH);
+          refill_cnt++;
+          if (mag->cnt == 0)
+            return NULL;
         }
+      return mag->rounds[--mag->cnt];
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
-  return b;
+  return desc_get (d, &b, 1) == 1 ? b : NULL;
 }
 
 /** Allocates and return A times B bytes initialized to zeroes.
@@ -167,7 +210,9 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = get_block (size);
+  if (memprof_enabled)
+    memprof_alloc (p, size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -201,7 +246,10 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = get_block (new_size);
+
+      if (memprof_enabled)
+        memprof_alloc (new_block, new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -224,35 +272,35 @@ free (void *p)
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
       
+      if (memprof_enabled)
+        memprof_free (p);
+
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct magazines *m = thread_current ()->magazines;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
   
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Put the block in the running thread's magazine,
+             draining it first if it is full. */
+          if (m != NULL) 
             {
-              size_t i;
+              struct magazine *mag = &m->mags[d - descs];
 
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
+              if (mag->cnt == MAG_ROUNDS) 
                 {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
+                  mag->cnt -= MAG_BATCH;
+                  desc_put (d, mag->rounds + mag->cnt, MAG_BATCH);
+                  drain_cnt++;
                 }
-              palloc_free_page (a);
+              mag->rounds[mag->cnt++] = b;
             }
-
-          lock_release (&d->lock);
+          else
+            desc_put (d, &p, 1);
         }
       else
         {
@@ -263,6 +311,148 @@ free (void *p)
     }
 }
 
+/** Returns the running thread's magazines to the descriptors.
+   Called when a thread exits. */
+void
+malloc_thread_exit (void) 
+{
+  struct thread *cur = thread_current ();
+  struct magazines *m = cur->magazines;
+  size_t i;
+
+  if (m == NULL)
+    return;
+
+  cur->magazines = NULL;
+  for (i = 0; i < desc_cnt; i++)
+    desc_put (&descs[i], m->mags[i].rounds, m->mags[i].cnt);
+  free (m);
+}
+
+/** Prints malloc() statistics. */
+void
+malloc_print_stats (void) 
+{
+  printf ("Malloc: %lld magazine refills, %lld magazine drains\n",
+          refill_cnt, drain_cnt);
+}
+
+/** Returns the smallest descriptor whose blocks hold SIZE bytes,
+   or a null pointer if SIZE is too big for any descriptor. */
+static struct desc *
+size_to_desc (size_t size) 
+{
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->block_size >= size)
+      return d;
+  return NULL;
+}
+
+/** Takes up to CNT blocks from descriptor D's free list, creating
+   new arenas as needed, and stores them in BLOCKS.  Returns the
+   number of blocks obtained, which is less than CNT only if
+   memory ran out. */
+static size_t
+desc_get (struct desc *d, void **blocks, size_t cnt) 
+{
+  size_t got;
+
+  lock_acquire (&d->lock);
+  for (got = 0; got < cnt; got++) 
+    {
+      struct block *b;
+      struct arena *a;
+
+      /* If the free list is empty, create a new arena. */
+      if (list_empty (&d->free_list))
+        {
+          size_t i;
+
+          /* Allocate a page.  The profiler tracks the blocks that
+             we hand out, not the arenas that hold them. */
+          a = palloc_get_page (PAL_UNTRACKED);
+          if (a == NULL) 
+            break;
+
+          /* Initialize arena and add its blocks to the free list. */
+          a->magic = ARENA_MAGIC;
+          a->desc = d;
+          a->free_cnt = d->blocks_per_arena;
+          for (i = 0; i < d->blocks_per_arena; i++) 
+            {
+              struct block *b = arena_to_block (a, i);
+              list_push_back (&d->free_list, &b->free_elem);
+            }
+        }
+
+      /* Get a block from free list. */
+      b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+      a = block_to_arena (b);
+      a->free_cnt--;
+      blocks[got] = b;
+    }
+  lock_release (&d->lock);
+
+  return got;
+}
+
+/** Returns the CNT blocks in BLOCKS to descriptor D's free list,
+   giving back to the page allocator any arena that becomes
+   entirely unused. */
+static void
+desc_put (struct desc *d, void **blocks, size_t cnt) 
+{
+  size_t j;
+
+  lock_acquire (&d->lock);
+  for (j = 0; j < cnt; j++) 
+    {
+      struct block *b = blocks[j];
+      struct arena *a = block_to_arena (b);
+
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
+
+      /* If the arena is now entirely unused, free it. */
+      if (++a->free_cnt >= d->blocks_per_arena) 
+        {
+          size_t i;
+
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          for (i = 0; i < d->blocks_per_arena; i++) 
+            {
+              struct block *b = arena_to_block (a, i);
+              list_remove (&b->free_elem);
+            }
+          palloc_free_page (a);
+        }
+    }
+  lock_release (&d->lock);
+}
+
+/** Returns the running thread's magazines, allocating them if
+   this is its first call, or a null pointer if they cannot be
+   allocated. */
+static struct magazines *
+get_magazines (void) 
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->magazines == NULL) 
+    {
+      void *m;
+
+      if (desc_get (size_to_desc (sizeof (struct magazines)), &m, 1) == 1) 
+        {
+          memset (m, 0, sizeof (struct magazines));
+          cur->magazines = m;
+        }
+    }
+  return cur->magazines;
+}
+
 /** Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
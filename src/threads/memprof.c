@@ -0,0 +1,307 @@
+#include "threads/memprof.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/** Kernel allocation profiler.
+
+   When the kernel is started with the -memprof option, malloc.c
+   and palloc.c report every allocation and free to this module,
+   which keeps a record of each live allocation: the address of
+   the code that asked for it, its size, and the thread that
+   asked for it.  The records live in a hash table keyed on the
+   block's kernel virtual address or, for pages, its physical
+   address, with the low bit set to keep the two apart.  The
+   table uses linear probing, with entries moved back on
+   deletion instead of tombstones, so that lookups stay short
+   under churn.
+
+   At shutdown, memprof_print_stats() adds up the live records
+   by call site and prints the sites that hold the most memory.
+   When a thread exits, memprof_thread_exit() reports whatever it
+   allocated and is still allocated: a leak, unless it was handed
+   to some other thread on purpose.  So that this does not
+   require a walk of the whole table at each thread exit, each
+   thread counts the bytes that it allocated and has not freed
+   itself, and the walk is only needed if that is nonzero.
+
+   Allocations made before memprof_init() is called, and those
+   that do not fit once the table is 3/4 full, are not tracked,
+   and frees of untracked blocks are ignored. */
+
+/** The hash table has 2**TABLE_BITS entries. */
+#define TABLE_BITS 15
+#define TABLE_CNT (1u << TABLE_BITS)
+#define TABLE_PAGES (TABLE_CNT * sizeof (struct record) / PGSIZE)
+
+/** Number of call sites that memprof_print_stats() can tell
+   apart, and the number that it prints. */
+#define SITE_CNT 512
+#define TOP_CNT 10
+
+/** Number of call sites printed for an exiting thread. */
+#define EXIT_TOP_CNT 3
+
+/** A live allocation. */
+struct record 
+  {
+    uintptr_t key;              /**< Block address, page paddr | 1, or 0. */
+    const void *caller;         /**< Code that allocated it. */
+    uint32_t size;              /**< Size in bytes. */
+    tid_t tid;                  /**< Thread that allocated it. */
+  };
+
+/** Live allocations summed up by call site. */
+struct site 
+  {
+    const void *caller;         /**< Code that allocated them, or null. */
+    size_t bytes;               /**< Total size. */
+    size_t cnt;                 /**< Number of allocations. */
+  };
+
+bool memprof_enabled;
+
+static struct record *table;    /**< Hash table. */
+static size_t record_cnt;       /**< Number of records in the table. */
+static struct site sites[SITE_CNT];
+
+/** Statistics. */
+static long long drop_cnt;      /**< # of allocations not tracked. */
+static long long leak_cnt;      /**< # of threads that exited owning memory. */
+
+static void record (uintptr_t key, size_t size, const void *caller);
+static void forget (uintptr_t key);
+static size_t sum_sites (tid_t tid);
+static void print_sites (size_t cnt);
+
+/** Turns on the profiler.  Must be called after paging is set
+   up. */
+void
+memprof_init (void) 
+{
+  table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, TABLE_PAGES);
+  memprof_enabled = true;
+}
+
+/** Records that CALLER allocated the SIZE-byte BLOCK. */
+void
+memprof_alloc (const void *block, size_t size, const void *caller) 
+{
+  if (block != NULL)
+    record ((uintptr_t) block, size, caller);
+}
+
+/** Records that BLOCK was freed. */
+void
+memprof_free (const void *block) 
+{
+  if (block != NULL)
+    forget ((uintptr_t) block);
+}
+
+/** Records that CALLER allocated the PAGE_CNT pages starting at
+   physical address PADDR. */
+void
+memprof_alloc_pages (uintptr_t paddr, size_t page_cnt, const void *caller) 
+{
+  if (paddr != 0)
+    record (paddr | 1, page_cnt * PGSIZE, caller);
+}
+
+/** Records that the pages starting at physical address PADDR
+   were freed. */
+void
+memprof_free_pages (uintptr_t paddr) 
+{
+  if (paddr != 0)
+    forget (paddr | 1);
+}
+
+/** Reports the memory that the running thread allocated and that
+   is still allocated, if any.  Called when a thread exits. */
+void
+memprof_thread_exit (void) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  size_t bytes;
+
+  if (!memprof_enabled || cur->memprof_bytes == 0)
+    return;
+
+  old_level = intr_disable ();
+  bytes = sum_sites (cur->tid);
+  if (bytes > 0) 
+    {
+      printf ("Memprof: %s (tid %d) exiting with %zu bytes still allocated\n",
+              cur->name, cur->tid, bytes);
+      print_sites (EXIT_TOP_CNT);
+      leak_cnt++;
+    }
+  intr_set_level (old_level);
+}
+
+/** Prints the call sites that hold the most memory. */
+void
+memprof_print_stats (void) 
+{
+  enum intr_level old_level;
+  size_t bytes;
+
+  if (!memprof_enabled)
+    return;
+
+  old_level = intr_disable ();
+  bytes = sum_sites (TID_ERROR);
+  printf ("Memprof: %zu bytes in %zu allocations live, %lld not tracked, "
+          "%lld threads exited owning memory\n",
+          bytes, record_cnt, drop_cnt, leak_cnt);
+  print_sites (TOP_CNT);
+  intr_set_level (old_level);
+}
+
+/** Returns the hash of KEY. */
+static inline size_t
+hash (uintptr_t key) 
+{
+  return ((key >> 3) * 2654435761u) >> (32 - TABLE_BITS);
+}
+
+/** Adds a record of KEY, of SIZE bytes, allocated by CALLER in the
+   running thread. */
+static void
+record (uintptr_t key, size_t size, const void *caller) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  if (record_cnt < TABLE_CNT / 4 * 3) 
+    {
+      for (i = hash (key); table[i].key != 0; i = (i + 1) % TABLE_CNT)
+        ASSERT (table[i].key != key);
+      table[i].key = key;
+      table[i].caller = caller;
+      table[i].size = size;
+      table[i].tid = cur->tid;
+      record_cnt++;
+      cur->memprof_bytes += size;
+    }
+  else
+    drop_cnt++;
+  intr_set_level (old_level);
+}
+
+/** Removes the record of KEY, if there is one. */
+static void
+forget (uintptr_t key) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  size_t i, j;
+
+  old_level = intr_disable ();
+  for (i = hash (key); table[i].key != key; i = (i + 1) % TABLE_CNT)
+    if (table[i].key == 0)
+      goto done;
+
+  if (table[i].tid == cur->tid)
+    cur->memprof_bytes -= table[i].size;
+  record_cnt--;
+
+  /* Fill the hole at I by moving back the next record in the
+     same cluster that may live there, repeatedly, so that no
+     lookup finds the hole before its record. */
+  for (j = (i + 1) % TABLE_CNT; table[j].key != 0; j = (j + 1) % TABLE_CNT) 
+    {
+      size_t home = hash (table[j].key);
+
+      /* Move the record at J to I unless its home is cyclically
+         in (I, J]. */
+      if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) 
+        {
+          table[i] = table[j];
+          i = j;
+        }
+    }
+  table[i].key = 0;
+
+ done:
+  intr_set_level (old_level);
+}
+
+/** Sums up the records made by thread TID, or all records if TID
+   is TID_ERROR, by call site into sites[], sorted by total size
+   in descending order, and returns their total size.  Call sites
+   that do not fit in sites[] are left out of it, but not out of
+   the total. */
+static size_t
+sum_sites (tid_t tid) 
+{
+  size_t bytes = 0;
+  size_t site_cnt;
+  size_t i, j;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < SITE_CNT; i++)
+    sites[i].caller = NULL;
+
+  /* Add up records in a hash table of call sites. */
+  for (i = 0; i < TABLE_CNT; i++) 
+    {
+      struct record *r = &table[i];
+
+      if (r->key == 0 || (tid != TID_ERROR && r->tid != tid))
+        continue;
+      bytes += r->size;
+      for (j = 0; j < SITE_CNT; j++) 
+        {
+          struct site *s = &sites[((uintptr_t) r->caller + j) % SITE_CNT];
+
+          if (s->caller == NULL) 
+            {
+              s->caller = r->caller;
+              s->bytes = s->cnt = 0;
+            }
+          if (s->caller == r->caller) 
+            {
+              s->bytes += r->size;
+              s->cnt++;
+              break;
+            }
+        }
+    }
+
+  /* Move the sites to the front and sort them, largest first.
+     Insertion sort is quick enough for something done this
+     rarely. */
+  site_cnt = 0;
+  for (i = 0; i < SITE_CNT; i++)
+    if (sites[i].caller != NULL) 
+      {
+        struct site s = sites[i];
+
+        sites[i].caller = NULL;
+        for (j = site_cnt++; j > 0 && sites[j - 1].bytes < s.bytes; j--)
+          sites[j] = sites[j - 1];
+        sites[j] = s;
+      }
+  return bytes;
+}
+
+/** Prints the first CNT call sites in sites[].  The addresses can
+   be turned into function names with the `backtrace' tool. */
+static void
+print_sites (size_t cnt) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt && i < SITE_CNT && sites[i].caller != NULL; i++)
+    printf ("  %zu bytes in %zu allocations from %p\n",
+            sites[i].bytes, sites[i].cnt, sites[i].caller);
+}
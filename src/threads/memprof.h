@@ -0,0 +1,20 @@
+#ifndef THREADS_MEMPROF_H
+#define THREADS_MEMPROF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Is the allocation profiler on?  Set by memprof_init(). */
+extern bool memprof_enabled;
+
+void memprof_init (void);
+void memprof_alloc (const void *block, size_t size, const void *caller);
+void memprof_free (const void *block);
+void memprof_alloc_pages (uintptr_t paddr, size_t page_cnt,
+                          const void *caller);
+void memprof_free_pages (uintptr_t paddr);
+void memprof_thread_exit (void);
+void memprof_print_stats (void);
+
+#endif /**< threads/memprof.h */
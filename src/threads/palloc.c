@@ -1,95 +1,332 @@
 #include "threads/palloc.h"
-#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
+#include "threads/kmap.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/memprof.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 
 /** Page allocator.  Hands out memory in page-size (or
    page-multiple) chunks.  See malloc.h for an allocator that
    hands out smaller chunks.
 
-   System memory is divided into two "pools" called the kernel
-   and user pools.  The user pool is for user (virtual) memory
-   pages, the kernel pool for everything else.  The idea here is
-   that the kernel needs to have memory for its own operations
-   even if user processes are swapping like mad.
+   Free memory is divided into two pools of frames: low memory,
+   which is mapped into the kernel's address space, and high
+   memory, above LOWMEM_LIMIT, which is not (see vaddr.h).
+   palloc_get_page() and palloc_get_multiple() return kernel
+   virtual addresses, so they allocate only from low memory.
+   palloc_get_frame() returns a physical address instead, which
+   the caller maps with kmap() to access, and prefers high
+   memory, so that user pages do not use up low memory that the
+   kernel could use.
 
-   By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   The frames are shared by two "classes" of pages: user pages,
+   for user (virtual) memory, and kernel pages, for everything
+   else.  Each class has a soft quota: by default, the kernel's
+   is half of low memory and the user's is the rest of memory,
+   including all of high memory.  A class may go over its
+   quota by borrowing frames that the other class is not using,
+   as long as it leaves the other class a reserve of an eighth of
+   its quota, so that the kernel still has memory for its own
+   operations even if user processes are swapping like mad.
+   When a class within its quota finds no free frames, because
+   the other class has borrowed them, the allocator asks the
+   borrower to give some back by calling its "reclaim hook".  The
+   kernel's hook frees the object caches' empty slabs; the user
+   hook is registered with palloc_set_reclaim() by whatever
+   manages user frames.  The -ul option sets the user class's
+   quota, and also caps it, so that it does not borrow.
+
+   Each pool is a binary buddy allocator.  Free memory is kept
+   in blocks of 2**ORDER pages, for ORDER from 0 to ORDER_CNT - 1,
+   each aligned on a multiple of its size relative to the start
+   of the pool, with a list of free blocks for each order.  An
+   allocation takes a block from the list of the smallest order
+   that is large enough and not empty, splitting it in halves
+   until it is the right size, and freeing a block merges it
+   with its "buddy", the other half of the block it was split
+   from, for as long as the buddy is free too.  Both take time
+   proportional to the number of orders, not to the size of the
+   pool, and merging keeps free memory in large blocks.
+
+   A request for a number of pages that is not a power of 2 is
+   satisfied from a block of the next larger order, and the pages
+   past the end are freed right away, so no memory is wasted.
+
+   Each page has a descriptor, in an array at the start of low
+   memory, that records whether it is the first page of a free
+   block and, if so, the block's order, and, for an allocated
+   page, which class it belongs to.  Free pages themselves
+   are never written by the allocator, except by
+   palloc_zero_page().
+
+   Freed pages are dirty, so a PAL_ZERO request would have to
+   clear its pages before returning them.  Instead, the idle
+   thread calls palloc_zero_page() to take single pages out of
+   the buddy system, clear them, and keep them on a separate list
+   of zeroed pages, until each pool has ZERO_MAX of them or an
+   eighth of its free pages, whichever is less.  A single-page
+   PAL_ZERO request is served from that list first, without
+   clearing anything.  Any other request falls back on the
+   zeroed pages only when the buddy system has nothing left.
+
+   The free lists are protected by turning off interrupts, so
+   that pages may be freed with interrupts off, as the scheduler
+   does. */
+
+/** Number of block orders.  The largest block is 2**(ORDER_CNT -
+   1) pages, or 4 MB. */
+#define ORDER_CNT 11
+
+/** Maximum number of zeroed pages kept in each pool. */
+#define ZERO_MAX 256
+
+/** Number of pages that start.S maps, which are all that the
+   kernel can touch until paging_init() has run. */
+#define BOOT_PAGES (64 * 1024 * 1024 / PGSIZE)
+
+/** Maximum number of times an allocation reclaims pages and
+   retries. */
+#define RECLAIM_TRIES 3
+
+/** Classes of pages. */
+enum page_class
+  {
+    CLASS_KERNEL,               /**< Kernel pages. */
+    CLASS_USER,                 /**< User pages (PAL_USER). */
+    CLASS_CNT
+  };
+
+/** Page descriptor. */
+struct page_desc
+  {
+    struct list_elem elem;      /**< In free list or zeroed list. */
+    int8_t order;               /**< Order of free block it starts, or -1. */
+    uint8_t class;              /**< If allocated, its enum page_class. */
+  };
 
 /** A memory pool. */
 struct pool
   {
-    struct lock lock;                   /**< Mutual exclusion. */
-    struct bitmap *used_map;            /**< Bitmap of free pages. */
-    uint8_t *base;                      /**< Base of pool. */
+    const char *name;                   /**< Name, for statistics. */
+    struct page_desc *pages;            /**< One descriptor per page. */
+    uintptr_t base;                     /**< Physical address of pool. */
+    size_t page_cnt;                    /**< Number of pages in pool. */
+    size_t free_cnt;                    /**< Number of free pages. */
+    struct list free_lists[ORDER_CNT];  /**< Free blocks, by order. */
+    size_t block_cnt[ORDER_CNT];        /**< Number of free blocks, by order. */
+    struct list zeroed_list;            /**< Free pages already zeroed. */
+    size_t zeroed_cnt;                  /**< Number of pages in zeroed_list. */
   };
 
-/** Two pools: one for kernel data, one for user pages. */
-static struct pool kernel_pool, user_pool;
+/** Two pools: one for low memory, one for high memory. */
+static struct pool low_pool, high_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+/** Number of pages at the start of low_pool that are freed by
+   palloc_init(), the rest being freed by palloc_init_late(). */
+static size_t boot_page_cnt;
+
+/** Frame accounting for a class of pages. */
+struct page_class_info
+  {
+    const char *name;                   /**< Name, for statistics. */
+    size_t quota;                       /**< Soft limit on pages in use. */
+    size_t limit;                       /**< Hard limit on pages in use. */
+    size_t used;                        /**< Pages in use. */
+    size_t peak;                        /**< Maximum of `used'. */
+    palloc_reclaim_func *reclaim;       /**< Frees some of this class's pages. */
+    long long borrow_cnt;               /**< Pages allocated over quota. */
+    long long reclaim_cnt;              /**< Calls to `reclaim'. */
+  };
+
+static size_t reclaim_kernel (size_t page_cnt);
+
+static struct page_class_info classes[CLASS_CNT] =
+  {
+    {"kernel", 0, SIZE_MAX, 0, 0, reclaim_kernel, 0, 0},
+    {"user", 0, SIZE_MAX, 0, 0, NULL, 0, 0},
+  };
+
+/** Statistics. */
+static long long zero_hit_cnt;  /**< PAL_ZERO pages found zeroed. */
+static long long zero_miss_cnt; /**< PAL_ZERO pages zeroed on demand. */
+static long long prezero_cnt;   /**< Pages zeroed by the idle thread. */
+
+static void init_pool (struct pool *, struct page_desc *, uintptr_t base,
+                       size_t page_cnt, const char *name);
+static struct pool *paddr_to_pool (uintptr_t paddr);
+static void *get_multiple (enum palloc_flags, size_t page_cnt,
+                           const void *caller);
+static uintptr_t alloc_pages (enum palloc_flags, size_t page_cnt,
+                              bool high_ok, bool *zeroed);
+static void free_pages (uintptr_t paddr, size_t page_cnt);
+static size_t take_pages (struct page_class_info *, struct pool *,
+                          enum palloc_flags, size_t page_cnt, bool *zeroed);
+static bool reclaim_pages (struct page_class_info *, size_t page_cnt);
+static size_t alloc_block (struct pool *, int order);
+static void free_block (struct pool *, size_t page_idx, int order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t pop_zeroed (struct pool *);
+static bool release_zeroed (struct pool *);
+static void print_pool_stats (const struct pool *);
 
 /** Initializes the page allocator.  At most USER_PAGE_LIMIT
-   pages are put into the user pool. */
+   pages may be in use as user pages.  Only the pages that
+   start.S mapped are made available; palloc_init_late() adds the
+   rest. */
 void
 palloc_init (size_t user_page_limit)
 {
-  /* Free memory starts at 1 MB and runs to the end of RAM. */
-  uint8_t *free_start = ptov (1024 * 1024);
-  uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
-  size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
-  if (user_pages > user_page_limit)
-    user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
+  /* Free memory starts at 1 MB and runs to the end of RAM.  Low
+     memory ends at LOWMEM_LIMIT, if there is that much. */
+  size_t low_start = 1024 * 1024 / PGSIZE;
+  size_t low_end = LOWMEM_LIMIT / PGSIZE;
+  size_t high_pages, low_pages, high_desc_pages, low_desc_pages;
+  size_t user_pages, user_low_pages;
+  enum intr_level old_level;
+  uint8_t *descs = ptov (low_start * PGSIZE);
 
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  if (low_end > init_ram_pages)
+    low_end = init_ram_pages;
+  high_pages = init_ram_pages - low_end;
+  low_pages = low_end - low_start;
+
+  /* The page descriptors for both pools go at the start of low
+     memory.  Calculate the space needed for them and subtract it
+     from low memory. */
+  high_desc_pages = DIV_ROUND_UP (high_pages * sizeof (struct page_desc),
+                                  PGSIZE);
+  low_desc_pages = DIV_ROUND_UP (low_pages * sizeof (struct page_desc),
+                                 PGSIZE);
+  if (low_start + high_desc_pages + low_desc_pages >= BOOT_PAGES)
+    PANIC ("Not enough memory for page descriptors.");
+  low_pages -= high_desc_pages + low_desc_pages;
+
+  init_pool (&high_pool, (struct page_desc *) descs,
+             (uintptr_t) low_end * PGSIZE, high_pages, "high memory");
+  init_pool (&low_pool, (struct page_desc *) (descs + high_desc_pages * PGSIZE),
+             (low_start + high_desc_pages + low_desc_pages) * PGSIZE,
+             low_pages, "low memory");
+
+  /* Free the pages that start.S mapped. */
+  boot_page_cnt = BOOT_PAGES - pg_no ((void *) low_pool.base);
+  if (boot_page_cnt > low_pool.page_cnt)
+    boot_page_cnt = low_pool.page_cnt;
+  old_level = intr_disable ();
+  free_range (&low_pool, 0, boot_page_cnt);
+  intr_set_level (old_level);
+
+  /* Give half of low memory to kernel, the rest to user. */
+  user_pages = high_pool.page_cnt + low_pool.page_cnt / 2;
+  if (user_pages > user_page_limit) 
+    {
+      user_pages = user_page_limit;
+      classes[CLASS_USER].limit = user_page_limit;
+    }
+  user_low_pages = (user_pages > high_pool.page_cnt
+                    ? user_pages - high_pool.page_cnt : 0);
+  classes[CLASS_USER].quota = user_pages;
+  classes[CLASS_KERNEL].quota = low_pool.page_cnt - user_low_pages;
+}
+
+/** Makes available the pages that palloc_init() did not: the
+   rest of low memory and all of high memory.  Must be called
+   after paging_init() has mapped all of low memory and
+   kmap_init() has set up temporary mappings. */
+void
+palloc_init_late (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  free_range (&low_pool, boot_page_cnt, low_pool.page_cnt - boot_page_cnt);
+  free_range (&high_pool, 0, high_pool.page_cnt);
+  intr_set_level (old_level);
+}
+
+/** Sets FUNC as the reclaim hook for user pages, if PAL_USER is
+   set in FLAGS, or for kernel pages otherwise.  When the other
+   class runs out of frames while this one is over its quota,
+   FUNC is called with the number of pages wanted, and should
+   free up to that many of its class's pages and return the
+   number freed.  It is called with interrupts in the state that
+   palloc_get_multiple() was called in, so it must not sleep if
+   they are off. */
+void
+palloc_set_reclaim (enum palloc_flags flags, palloc_reclaim_func *func) 
+{
+  classes[flags & PAL_USER ? CLASS_USER : CLASS_KERNEL].reclaim = func;
+}
+
+/** Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+page_cnt_to_order (size_t page_cnt) 
+{
+  int order = 0;
+
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
 }
 
 /** Obtains and returns a group of PAGE_CNT contiguous free pages.
-   If PAL_USER is set, the pages are obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   If PAL_USER is set, the pages are user pages, otherwise kernel
+   pages.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
-  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
-  size_t page_idx;
-
-  if (page_cnt == 0)
-    return NULL;
+  return get_multiple (flags, page_cnt, __builtin_return_address (0));
+}
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+/** Obtains a single free page and returns its kernel virtual
+   address.
+   If PAL_USER is set, the page is a user page, otherwise a
+   kernel page.  If PAL_ZERO is set in FLAGS,
+   then the page is filled with zeros.  If no pages are
+   available, returns a null pointer, unless PAL_ASSERT is set in
+   FLAGS, in which case the kernel panics. */
+void *
+palloc_get_page (enum palloc_flags flags) 
+{
+  return get_multiple (flags, 1, __builtin_return_address (0));
+}
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+/** Obtains a single free frame and returns its physical
+   address, which may be in high memory, so that it must be
+   mapped with kmap() to be accessed.
+   If PAL_USER is set, the frame is for a user page, otherwise a
+   kernel page.  If PAL_ZERO is set in FLAGS, then the frame is
+   filled with zeros.  If no frames are available, returns 0,
+   unless PAL_ASSERT is set in FLAGS, in which case the kernel
+   panics. */
+uintptr_t
+palloc_get_frame (enum palloc_flags flags) 
+{
+  uintptr_t paddr;
+  bool zeroed;
 
-  if (pages != NULL) 
+  paddr = alloc_pages (flags, 1, true, &zeroed);
+  if (paddr != 0) 
     {
-      if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
+      if (memprof_enabled && !(flags & PAL_UNTRACKED))
+        memprof_alloc_pages (paddr, 1, __builtin_return_address (0));
+      if ((flags & PAL_ZERO) && !zeroed) 
+        {
+          enum intr_level old_level = intr_disable ();
+          void *page = kmap_atomic (paddr);
+          memset (page, 0, PGSIZE);
+          kunmap_atomic (page);
+          intr_set_level (old_level);
+        }
     }
   else 
     {
@@ -97,48 +334,24 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
         PANIC ("palloc_get: out of pages");
     }
 
-  return pages;
-}
-
-/** Obtains a single free page and returns its kernel virtual
-   address.
-   If PAL_USER is set, the page is obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the page is filled with zeros.  If no pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
-void *
-palloc_get_page (enum palloc_flags flags) 
-{
-  return palloc_get_multiple (flags, 1);
+  return paddr;
 }
 
 /** Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
-  struct pool *pool;
-  size_t page_idx;
-
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
-  page_idx = pg_no (pages) - pg_no (pool->base);
-
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  if (memprof_enabled)
+    memprof_free_pages (vtop (pages));
+  free_pages (vtop (pages), page_cnt);
 }
 
 /** Frees the page at PAGE. */
@@ -148,35 +361,538 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
-/** Initializes pool P as starting at START and ending at END,
-   naming it NAME for debugging purposes. */
+/** Frees the frame at physical address PADDR, which must have
+   been obtained with palloc_get_frame().  Does nothing if PADDR
+   is 0. */
+void
+palloc_free_frame (uintptr_t paddr) 
+{
+  ASSERT (paddr % PGSIZE == 0);
+  if (paddr != 0) 
+    {
+      if (memprof_enabled)
+        memprof_free_pages (paddr);
+      free_pages (paddr, 1);
+    }
+}
+
+/** Returns the number of zeroed pages that POOL should keep. */
+static size_t
+zero_target (const struct pool *pool) 
+{
+  size_t target = pool->free_cnt / 8;
+  return target < ZERO_MAX ? target : ZERO_MAX;
+}
+
+/** Zeroes one dirty free page, from low memory if it has too few
+   zeroed pages, otherwise from high memory, and puts it on its
+   pool's zeroed list.  Returns true if successful, false if both
+   pools have enough zeroed pages already.  Called by the idle
+   thread, with interrupts on. */
+bool
+palloc_zero_page (void) 
+{
+  struct pool *pool;
+  enum intr_level old_level;
+  size_t page_idx;
+  uintptr_t paddr;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  if (low_pool.zeroed_cnt < zero_target (&low_pool))
+    pool = &low_pool;
+  else if (high_pool.zeroed_cnt < zero_target (&high_pool))
+    pool = &high_pool;
+  else 
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  page_idx = alloc_block (pool, 0);
+  paddr = pool->base + PGSIZE * page_idx;
+
+  if (pool == &low_pool) 
+    {
+      /* The page is ours now, so clear it with interrupts on. */
+      intr_set_level (old_level);
+      memset (ptov (paddr), 0, PGSIZE);
+      old_level = intr_disable ();
+    }
+  else 
+    {
+      void *page = kmap_atomic (paddr);
+      memset (page, 0, PGSIZE);
+      kunmap_atomic (page);
+    }
+
+  list_push_front (&pool->zeroed_list, &pool->pages[page_idx].elem);
+  pool->zeroed_cnt++;
+  prezero_cnt++;
+  intr_set_level (old_level);
+  return true;
+}
+
+/** Prints free memory and fragmentation statistics, frame use by
+   each class of pages, and how often PAL_ZERO requests found
+   zeroed pages. */
+void
+palloc_print_stats (void) 
+{
+  long long zero_cnt = zero_hit_cnt + zero_miss_cnt;
+  int i;
+
+  print_pool_stats (&low_pool);
+  if (high_pool.page_cnt > 0)
+    print_pool_stats (&high_pool);
+  for (i = 0; i < CLASS_CNT; i++) 
+    {
+      const struct page_class_info *c = &classes[i];
+      printf ("Palloc: %s pages: %zu in use of %zu quota, peak %zu, "
+              "%lld borrowed, %lld reclaims\n",
+              c->name, c->used, c->quota, c->peak,
+              c->borrow_cnt, c->reclaim_cnt);
+    }
+  printf ("Palloc: %lld of %lld PAL_ZERO pages pre-zeroed (%lld%%), "
+          "%lld pages zeroed while idle\n",
+          zero_hit_cnt, zero_cnt,
+          zero_cnt > 0 ? zero_hit_cnt * 100 / zero_cnt : 0, prezero_cnt);
+}
+
+/** Initializes pool P as the PAGE_CNT pages starting at physical
+   address BASE, with descriptors DESCS, naming it NAME for
+   debugging purposes.  All of its pages start out allocated. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *p, struct page_desc *descs, uintptr_t base,
+           size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  size_t i;
 
-  printf ("%zu pages available in %s.\n", page_cnt, name);
+  if (page_cnt > 0)
+    printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  p->name = name;
+  p->pages = descs;
+  p->base = base;
+  p->page_cnt = page_cnt;
+  p->free_cnt = 0;
+  for (i = 0; i < ORDER_CNT; i++) 
+    {
+      list_init (&p->free_lists[i]);
+      p->block_cnt[i] = 0;
+    }
+  list_init (&p->zeroed_list);
+  p->zeroed_cnt = 0;
+  for (i = 0; i < page_cnt; i++)
+    p->pages[i].order = -1;
+}
+
+/** Returns the pool that contains the frame at physical address
+   PADDR. */
+static struct pool *
+paddr_to_pool (uintptr_t paddr) 
+{
+  if (paddr >= low_pool.base
+      && (paddr - low_pool.base) / PGSIZE < low_pool.page_cnt)
+    return &low_pool;
+  else if (paddr >= high_pool.base
+           && (paddr - high_pool.base) / PGSIZE < high_pool.page_cnt)
+    return &high_pool;
+  else
+    NOT_REACHED ();
+}
+
+/** Does the work of palloc_get_multiple(), on behalf of the code
+   at CALLER. */
+static void *
+get_multiple (enum palloc_flags flags, size_t page_cnt, const void *caller)
+{
+  uintptr_t paddr;
+  void *pages;
+  bool zeroed;
+
+  paddr = alloc_pages (flags, page_cnt, false, &zeroed);
+  if (paddr != 0)
+    pages = ptov (paddr);
+  else 
+    pages = NULL;
+
+  if (pages != NULL) 
+    {
+      if ((flags & PAL_ZERO) && !zeroed)
+        memset (pages, 0, PGSIZE * page_cnt);
+      if (memprof_enabled && !(flags & PAL_UNTRACKED))
+        memprof_alloc_pages (paddr, page_cnt, caller);
+    }
+  else 
+    {
+      if (flags & PAL_ASSERT)
+        PANIC ("palloc_get: out of pages");
+    }
+
+  return pages;
+}
+
+/** Allocates PAGE_CNT contiguous pages, as palloc_get_multiple()
+   does with FLAGS, from high memory if HIGH_OK is true and it has
+   room, otherwise from low memory, reclaiming pages if
+   necessary.  Returns the physical address of the first page, or
+   0 on failure, and sets *ZEROED to true if the page came from a
+   zeroed list. */
+static uintptr_t
+alloc_pages (enum palloc_flags flags, size_t page_cnt, bool high_ok,
+             bool *zeroed) 
+{
+  struct page_class_info *c
+    = &classes[flags & PAL_USER ? CLASS_USER : CLASS_KERNEL];
+  struct pool *pool = NULL;
+  size_t page_idx = SIZE_MAX;
+  int tries;
+
+  *zeroed = false;
+  if (page_cnt == 0 || page_cnt_to_order (page_cnt) >= ORDER_CNT)
+    return 0;
+
+  for (tries = 0; ; tries++) 
+    {
+      enum intr_level old_level = intr_disable ();
+      if (high_ok) 
+        {
+          pool = &high_pool;
+          page_idx = take_pages (c, pool, flags, page_cnt, zeroed);
+        }
+      if (page_idx == SIZE_MAX) 
+        {
+          pool = &low_pool;
+          page_idx = take_pages (c, pool, flags, page_cnt, zeroed);
+        }
+      intr_set_level (old_level);
+
+      /* Under memory pressure, ask for pages back and try
+         again. */
+      if (page_idx != SIZE_MAX || tries >= RECLAIM_TRIES
+          || !reclaim_pages (c, page_cnt))
+        break;
+    }
+
+  return page_idx != SIZE_MAX ? pool->base + PGSIZE * page_idx : 0;
+}
+
+/** Frees the PAGE_CNT pages starting at physical address
+   PADDR. */
+static void
+free_pages (uintptr_t paddr, size_t page_cnt) 
+{
+  struct pool *pool = paddr_to_pool (paddr);
+  size_t page_idx = (paddr - pool->base) / PGSIZE;
+  enum intr_level old_level;
+  size_t i;
+
+  ASSERT (page_idx + page_cnt <= pool->page_cnt);
+
+  old_level = intr_disable ();
+  ASSERT (pool->pages[page_idx].order < 0);
+  for (i = 0; i < page_cnt; i++)
+    classes[pool->pages[page_idx + i].class].used--;
+  free_range (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
-/** Returns true if PAGE was allocated from POOL,
-   false otherwise. */
+/** Adds the free block of 2**ORDER pages at PAGE_IDX in POOL to
+   its free list. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order) 
+{
+  struct page_desc *d = &pool->pages[page_idx];
+
+  d->order = order;
+  list_push_front (&pool->free_lists[order], &d->elem);
+  pool->block_cnt[order]++;
+  pool->free_cnt += (size_t) 1 << order;
+}
+
+/** Removes the free block of 2**ORDER pages at PAGE_IDX in POOL
+   from its free list. */
+static void
+remove_block (struct pool *pool, size_t page_idx, int order) 
+{
+  struct page_desc *d = &pool->pages[page_idx];
+
+  ASSERT (d->order == order);
+  d->order = -1;
+  list_remove (&d->elem);
+  pool->block_cnt[order]--;
+  pool->free_cnt -= (size_t) 1 << order;
+}
+
+/** Allocates a block of 2**ORDER pages from POOL and returns the
+   index of its first page, or SIZE_MAX if there is no free block
+   that large.  Interrupts must be off. */
+static size_t
+alloc_block (struct pool *pool, int order) 
+{
+  size_t page_idx;
+  int k;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (k = order; k < ORDER_CNT; k++)
+    if (!list_empty (&pool->free_lists[k]))
+      break;
+  if (k >= ORDER_CNT)
+    return SIZE_MAX;
+
+  page_idx = list_entry (list_front (&pool->free_lists[k]),
+                         struct page_desc, elem) - pool->pages;
+  remove_block (pool, page_idx, k);
+
+  /* Split off upper halves until the block is the right size. */
+  while (k > order) 
+    {
+      k--;
+      push_block (pool, page_idx + ((size_t) 1 << k), k);
+    }
+  return page_idx;
+}
+
+/** Frees the block of 2**ORDER pages at PAGE_IDX in POOL, merging
+   it with its buddy, and the result with its own buddy, and so
+   on, as long as the buddy is free.  Interrupts must be off. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (order < ORDER_CNT - 1) 
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy_idx + ((size_t) 1 << order) > pool->page_cnt
+          || pool->pages[buddy_idx].order != order)
+        break;
+      remove_block (pool, buddy_idx, order);
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+      order++;
+    }
+  push_block (pool, page_idx, order);
+}
+
+/** Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, as the
+   largest aligned blocks that they can be divided into.
+   Interrupts must be off. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  while (page_cnt > 0) 
+    {
+      int order = 0;
+
+      while (order < ORDER_CNT - 1
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/** Returns the number of free pages that a class other than C
+   may not borrow: an eighth of C's quota, or as much of its
+   quota as it is not using, whichever is less. */
+static size_t
+class_reserve (const struct page_class_info *c) 
+{
+  size_t unused = c->used < c->quota ? c->quota - c->used : 0;
+  return unused < c->quota / 8 ? unused : c->quota / 8;
+}
+
+/** Returns the number of free pages in POOL. */
+static size_t
+pool_free_cnt (const struct pool *pool) 
+{
+  return pool->free_cnt + pool->zeroed_cnt;
+}
+
+/** Returns true if class C can use pages from POOL.  Kernel
+   pages must be in low memory. */
+static bool
+class_uses_pool (const struct page_class_info *c, const struct pool *pool) 
+{
+  return pool == &low_pool || c == &classes[CLASS_USER];
+}
+
+/** Tries to allocate PAGE_CNT contiguous pages of class C from
+   POOL, as palloc_get_multiple() does with FLAGS, without
+   reclaiming any pages.  Returns the index of the first page, or
+   SIZE_MAX on failure, and sets *ZEROED to true if the page came
+   from the zeroed list.  Interrupts must be off. */
+static size_t
+take_pages (struct page_class_info *c, struct pool *pool,
+            enum palloc_flags flags, size_t page_cnt, bool *zeroed) 
+{
+  int order = page_cnt_to_order (page_cnt);
+  size_t page_idx = SIZE_MAX;
+  size_t borrowed = 0;
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Check C's limit and, if this takes it over its quota, that
+     the other classes keep their reserves. */
+  if (c->used + page_cnt > c->limit || pool_free_cnt (pool) < page_cnt)
+    return SIZE_MAX;
+  if (c->used + page_cnt > c->quota) 
+    {
+      for (i = 0; i < CLASS_CNT; i++) 
+        {
+          const struct page_class_info *other = &classes[i];
+          size_t free_cnt;
+
+          if (other == c || !class_uses_pool (other, pool))
+            continue;
+          free_cnt = pool_free_cnt (&low_pool);
+          if (class_uses_pool (other, &high_pool))
+            free_cnt += pool_free_cnt (&high_pool);
+          if (free_cnt < page_cnt + class_reserve (other))
+            return SIZE_MAX;
+        }
+      borrowed = c->used + page_cnt - (c->used > c->quota ? c->used : c->quota);
+    }
+
+  /* A single zeroed page can come straight from the zeroed
+     list. */
+  *zeroed = false;
+  if (page_cnt == 1 && (flags & PAL_ZERO))
+    {
+      page_idx = pop_zeroed (pool);
+      *zeroed = page_idx != SIZE_MAX;
+    }
+
+  if (page_idx == SIZE_MAX) 
+    {
+      page_idx = alloc_block (pool, order);
+
+      /* Failing that, fall back on the zeroed pages. */
+      if (page_idx == SIZE_MAX && page_cnt == 1)
+        {
+          page_idx = pop_zeroed (pool);
+          *zeroed = page_idx != SIZE_MAX;
+        }
+      else if (page_idx == SIZE_MAX && release_zeroed (pool))
+        page_idx = alloc_block (pool, order);
+      if (page_idx == SIZE_MAX)
+        return SIZE_MAX;
+      if (!*zeroed)
+        free_range (pool, page_idx + page_cnt,
+                    ((size_t) 1 << order) - page_cnt);
+    }
+
+  /* Account for the pages. */
+  for (i = 0; i < page_cnt; i++)
+    pool->pages[page_idx + i].class = c - classes;
+  c->used += page_cnt;
+  if (c->used > c->peak)
+    c->peak = c->used;
+  c->borrow_cnt += borrowed;
+  if (flags & PAL_ZERO) 
+    {
+      if (*zeroed)
+        zero_hit_cnt++;
+      else
+        zero_miss_cnt += page_cnt;
+    }
+  return page_idx;
+}
+
+/** Asks for pages back so that PAGE_CNT pages of class C can be
+   allocated: first from every other class that is over its
+   quota, through its reclaim hook, then from C itself.  Returns
+   true if any pages were freed. */
+static bool
+reclaim_pages (struct page_class_info *c, size_t page_cnt) 
+{
+  size_t freed = 0;
+  int i;
+
+  for (i = 0; i < CLASS_CNT; i++) 
+    {
+      struct page_class_info *other = &classes[i];
+
+      if (other != c && other->used > other->quota && other->reclaim != NULL) 
+        {
+          other->reclaim_cnt++;
+          freed += other->reclaim (page_cnt);
+        }
+    }
+  if (freed < page_cnt && c->reclaim != NULL) 
+    {
+      c->reclaim_cnt++;
+      freed += c->reclaim (page_cnt);
+    }
+  return freed > 0;
+}
+
+/** Reclaim hook for kernel pages: gives back the object caches'
+   empty slabs. */
+static size_t
+reclaim_kernel (size_t page_cnt UNUSED) 
+{
+  return kmem_cache_reclaim ();
+}
+
+/** Removes a page from POOL's zeroed list and returns its index,
+   or SIZE_MAX if the list is empty.  Interrupts must be off. */
+static size_t
+pop_zeroed (struct pool *pool) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (list_empty (&pool->zeroed_list))
+    return SIZE_MAX;
+  pool->zeroed_cnt--;
+  return list_entry (list_pop_front (&pool->zeroed_list),
+                     struct page_desc, elem) - pool->pages;
+}
+
+/** Returns all of POOL's zeroed pages to its free lists, so that
+   they can be merged into larger blocks.  Returns true if there
+   were any.  Interrupts must be off. */
 static bool
-page_from_pool (const struct pool *pool, void *page) 
+release_zeroed (struct pool *pool) 
 {
-  size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t page_idx;
+  bool released = false;
 
-  return page_no >= start_page && page_no < end_page;
+  while ((page_idx = pop_zeroed (pool)) != SIZE_MAX) 
+    {
+      free_block (pool, page_idx, 0);
+      released = true;
+    }
+  return released;
+}
+
+/** Prints statistics for POOL: its free pages, how many free
+   blocks there are of each order, and external fragmentation,
+   the percentage of free pages that are not in the largest free
+   block. */
+static void
+print_pool_stats (const struct pool *pool) 
+{
+  size_t largest = 0;
+  int order;
+
+  printf ("Palloc: %s: %zu of %zu pages free, %zu zeroed, blocks by order:",
+          pool->name, pool->free_cnt + pool->zeroed_cnt, pool->page_cnt,
+          pool->zeroed_cnt);
+  for (order = 0; order < ORDER_CNT; order++) 
+    {
+      printf (" %zu", pool->block_cnt[order]);
+      if (pool->block_cnt[order] > 0)
+        largest = (size_t) 1 << order;
+    }
+  printf (", %zu%% fragmented\n",
+          pool->free_cnt > 0 ? 100 - largest * 100 / pool->free_cnt : 0);
 }
@@ -1,20 +1,33 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /** How to allocate pages. */
 enum palloc_flags
   {
     PAL_ASSERT = 001,           /**< Panic on failure. */
     PAL_ZERO = 002,             /**< Zero page contents. */
-    PAL_USER = 004              /**< User page. */
+    PAL_USER = 004,             /**< User page. */
+    PAL_UNTRACKED = 010         /**< Hidden from the allocation profiler. */
   };
 
+/** Frees up to PAGE_CNT pages of one class and returns the
+   number freed.  See palloc_set_reclaim(). */
+typedef size_t palloc_reclaim_func (size_t page_cnt);
+
 void palloc_init (size_t user_page_limit);
+void palloc_init_late (void);
+void palloc_set_reclaim (enum palloc_flags, palloc_reclaim_func *);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+uintptr_t palloc_get_frame (enum palloc_flags);
+void palloc_free_frame (uintptr_t paddr);
+bool palloc_zero_page (void);
+void palloc_print_stats (void);
 
 #endif /**< threads/palloc.h */
@@ -64,8 +64,12 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_P 0x1               /**< 1=present, 0=not present. */
 #define PTE_W 0x2               /**< 1=read/write, 0=read-only. */
 #define PTE_U 0x4               /**< 1=user/kernel, 0=kernel only. */
+#define PTE_PWT 0x8             /**< 1=write-through, 0=write-back. */
+#define PTE_PCD 0x10            /**< 1=cache disabled, 0=cache enabled. */
 #define PTE_A 0x20              /**< 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /**< 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /**< 1=4 MB page, 0=page table (PDEs only). */
+#define PTE_G 0x100             /**< 1=global, kept in TLB across CR3 loads. */
 
 /** Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -77,9 +81,20 @@ static inline uint32_t pde_create (uint32_t *pt) {
    PDE, which must "present", points to. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT (!(pde & PTE_PS));
   return ptov (pde & PTE_ADDR);
 }
 
+/** Returns a PDE that maps the 4 MB of memory starting at
+   physical address PADDR, which must be 4 MB-aligned, as a
+   single large page, without a page table.  The page is
+   writable and usable only by ring 0 code (the kernel).  The
+   CPU honors this only once CR4.PSE is set. */
+static inline uint32_t pde_create_large (uintptr_t paddr) {
+  ASSERT (paddr % PTSPAN == 0);
+  return paddr | PTE_PS | PTE_P | PTE_W;
+}
+
 /** Returns a PTE that points to PAGE.
    The PTE's page is readable.
    If WRITABLE is true then it will be writable as well.
@@ -97,11 +112,27 @@ static inline uint32_t pte_create_user (void *page, bool writable) {
   return pte_create_kernel (page, writable) | PTE_U;
 }
 
+/** Returns a PTE that points to the frame at physical address
+   PADDR, which may be in high memory.
+   The PTE's page is readable.
+   If WRITABLE is true then it will be writable as well.
+   The page will be usable by both user and kernel code. */
+static inline uint32_t pte_create_frame (uintptr_t paddr, bool writable) {
+  ASSERT (paddr % PGSIZE == 0);
+  return paddr | PTE_U | PTE_P | (writable ? PTE_W : 0);
+}
+
 /** Returns a pointer to the page that page table entry PTE points
-   to. */
+   to, which must be in low memory. */
 static inline void *pte_get_page (uint32_t pte) {
   return ptov (pte & PTE_ADDR);
 }
 
+/** Returns the physical address of the frame that page table
+   entry PTE points to. */
+static inline uintptr_t pte_get_frame (uint32_t pte) {
+  return pte & PTE_ADDR;
+}
+
 #endif /**< threads/pte.h */
 
@@ -0,0 +1,274 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/** Slab allocator.
+
+   malloc() rounds every request up to a power of 2, so a 536-byte
+   object takes a 1 kB block, and it knows nothing about what the
+   memory is for.  An object cache instead hands out objects of
+   one exact size, as in [Bonwick], "The Slab Allocator: An
+   Object-Caching Kernel Memory Allocator".
+
+   A cache gets memory from the page allocator one page, called
+   a "slab", at a time.  A slab begins with a header and an array
+   of the indexes of its free objects, used as a stack, followed
+   by the objects themselves.  Keeping the free stack outside of
+   the objects means that a free object is never written by the
+   allocator, so an optional constructor can put each object into
+   its initial state just once, when its slab is created, and the
+   cache's user must return it to that state before freeing it.
+
+   Each cache keeps its slabs on three lists: partial slabs, with
+   some objects free, from which allocations are made first; full
+   slabs; and empty slabs, which are kept for reuse until the
+   page allocator runs out of kernel pages and calls
+   kmem_cache_reclaim() to give them back.
+
+   All of this is protected by turning off interrupts, like
+   palloc.c, so that the page allocator can reclaim slabs while a
+   cache is in use. */
+
+/** Maximum number of caches. */
+#define KMEM_CACHE_MAX 16
+
+/** Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/** An object cache. */
+struct kmem_cache
+  {
+    const char *name;           /**< Name, for statistics. */
+    size_t obj_size;            /**< Size of each object, rounded up. */
+    size_t objs_per_slab;       /**< Number of objects in a slab. */
+    size_t obj_ofs;             /**< Offset of first object in slab. */
+    kmem_ctor *ctor;            /**< Constructor, or null. */
+    struct list partial;        /**< Slabs with some objects free. */
+    struct list full;           /**< Slabs with no objects free. */
+    struct list empty;          /**< Slabs with all objects free. */
+    size_t slab_cnt;            /**< Number of slabs. */
+    size_t in_use;              /**< Number of objects allocated. */
+  };
+
+/** A slab: the header at the start of each page of a cache. */
+struct slab
+  {
+    unsigned magic;             /**< Always SLAB_MAGIC. */
+    struct kmem_cache *cache;   /**< Owning cache. */
+    struct list_elem elem;      /**< In one of the cache's lists. */
+    size_t free_cnt;            /**< Number of free objects. */
+    uint16_t free[];            /**< Indexes of free objects. */
+  };
+
+static struct kmem_cache caches[KMEM_CACHE_MAX];
+static size_t cache_cnt;
+
+static struct slab *slab_create (struct kmem_cache *);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+
+/** Creates and returns a cache of objects of SIZE bytes, named
+   NAME.  If CTOR is nonnull, it is called on each object when
+   the object's slab is created.  The cache is never destroyed.
+   Panics if there are too many caches or if SIZE is too large
+   to fit at least one object in a page. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor *ctor) 
+{
+  struct kmem_cache *c;
+  size_t n;
+
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+
+  if (cache_cnt >= KMEM_CACHE_MAX)
+    PANIC ("too many object caches creating \"%s\"", name);
+  c = &caches[cache_cnt];
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, sizeof (void *));
+  c->ctor = ctor;
+  list_init (&c->partial);
+  list_init (&c->full);
+  list_init (&c->empty);
+  c->slab_cnt = 0;
+  c->in_use = 0;
+
+  /* Fit as many objects, and their indexes, as possible. */
+  for (n = (PGSIZE - sizeof (struct slab)) / c->obj_size; n > 0; n--) 
+    {
+      size_t ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                             sizeof (void *));
+      if (ofs + n * c->obj_size <= PGSIZE) 
+        {
+          c->obj_ofs = ofs;
+          break;
+        }
+    }
+  if (n == 0)
+    PANIC ("objects in cache \"%s\" too big (%zu bytes)", name, size);
+  c->objs_per_slab = n;
+
+  cache_cnt++;
+  return c;
+}
+
+/** Allocates and returns an object from cache C, or returns a
+   null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) 
+{
+  enum intr_level old_level;
+  struct slab *s;
+  void *obj;
+
+  ASSERT (c != NULL);
+
+  old_level = intr_disable ();
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty)) 
+    {
+      s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  else 
+    {
+      intr_set_level (old_level);
+      s = slab_create (c);
+      if (s == NULL)
+        return NULL;
+      old_level = intr_disable ();
+      list_push_front (&c->partial, &s->elem);
+      c->slab_cnt++;
+    }
+
+  obj = (uint8_t *) s + c->obj_ofs + s->free[--s->free_cnt] * c->obj_size;
+  if (s->free_cnt == 0) 
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full, &s->elem);
+    }
+  c->in_use++;
+  intr_set_level (old_level);
+
+  return obj;
+}
+
+/** Returns OBJ, which must have been allocated from cache C and
+   restored to its constructed state, to C.  Does nothing if OBJ
+   is a null pointer. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) 
+{
+  enum intr_level old_level;
+  struct slab *s;
+
+  ASSERT (c != NULL);
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (c, obj);
+  old_level = intr_disable ();
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  s->free[s->free_cnt++] = ((uint8_t *) obj - (uint8_t *) s - c->obj_ofs)
+                           / c->obj_size;
+  if (s->free_cnt == 1 || s->free_cnt == c->objs_per_slab) 
+    {
+      list_remove (&s->elem);
+      list_push_front (s->free_cnt == 1 && c->objs_per_slab > 1
+                       ? &c->partial : &c->empty, &s->elem);
+    }
+  c->in_use--;
+  intr_set_level (old_level);
+}
+
+/** Gives the empty slabs of every cache back to the page
+   allocator, and returns the number of pages freed. */
+size_t
+kmem_cache_reclaim (void) 
+{
+  enum intr_level old_level;
+  size_t freed = 0;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < cache_cnt; i++) 
+    {
+      struct kmem_cache *c = &caches[i];
+
+      while (!list_empty (&c->empty)) 
+        {
+          struct slab *s = list_entry (list_pop_front (&c->empty),
+                                       struct slab, elem);
+          s->magic = 0;
+          palloc_free_page (s);
+          c->slab_cnt--;
+          freed++;
+        }
+    }
+  intr_set_level (old_level);
+
+  return freed;
+}
+
+/** Prints statistics for each cache. */
+void
+kmem_print_stats (void) 
+{
+  size_t i;
+
+  for (i = 0; i < cache_cnt; i++) 
+    {
+      struct kmem_cache *c = &caches[i];
+
+      printf ("Slab: %s: %zu-byte objects, %zu per slab, "
+              "%zu in use, %zu slabs (%zu empty)\n",
+              c->name, c->obj_size, c->objs_per_slab, c->in_use,
+              c->slab_cnt, list_size (&c->empty));
+    }
+}
+
+/** Allocates a new slab for cache C, with all of its objects
+   constructed and free, and returns it, or a null pointer if no
+   page is available. */
+static struct slab *
+slab_create (struct kmem_cache *c) 
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++) 
+    {
+      /* Hand out low addresses first. */
+      s->free[i] = c->objs_per_slab - 1 - i;
+      if (c->ctor != NULL)
+        c->ctor ((uint8_t *) s + c->obj_ofs + i * c->obj_size);
+    }
+  return s;
+}
+
+/** Returns the slab that contains OBJ, which must be an object in
+   cache C. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj) 
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT ((pg_ofs (obj) - c->obj_ofs) % c->obj_size == 0);
+
+  return s;
+}
@@ -0,0 +1,63 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Spinlock.
+
+   A spinlock protects data shared between CPUs by busy-waiting,
+   so a CPU must not sleep or take an interrupt that needs the
+   same lock while it holds one.  Almost all kernel code should
+   instead turn interrupts off, which takes the giant lock (see
+   interrupt.c), or use the primitives in synch.h. */
+struct spinlock
+  {
+    volatile uint32_t locked;   /**< 1 if held, 0 if free. */
+  };
+
+/** Initializer for a free spinlock. */
+#define SPINLOCK_INITIALIZER { 0 }
+
+/** Initializes LOCK as free. */
+static inline void
+spinlock_init (struct spinlock *lock)
+{
+  lock->locked = 0;
+}
+
+/** Tries to acquire LOCK and returns true if successful, false
+   if it is held.  The `xchg' instruction is atomic even without
+   a `lock' prefix.  See [IA32-v2b] "XCHG--Exchange Register/Memory
+   with Register". */
+static inline bool
+spinlock_try_acquire (struct spinlock *lock)
+{
+  uint32_t old = 1;
+
+  asm volatile ("xchgl %0, %1" : "+r" (old), "+m" (lock->locked)
+                : : "memory");
+  return old == 0;
+}
+
+/** Acquires LOCK, waiting until it is free if necessary.  While
+   waiting, only reads the lock, so that waiting CPUs do not
+   fight over its cache line. */
+static inline void
+spinlock_acquire (struct spinlock *lock)
+{
+  while (!spinlock_try_acquire (lock))
+    while (lock->locked)
+      asm volatile ("pause");
+}
+
+/** Releases LOCK.  Stores are not reordered with earlier loads
+   and stores on x86, so a compiler barrier suffices. */
+static inline void
+spinlock_release (struct spinlock *lock)
+{
+  asm volatile ("" : : : "memory");
+  lock->locked = 0;
+}
+
+#endif /**< threads/spinlock.h */
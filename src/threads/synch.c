@@ -32,6 +32,29 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/** Priority donation.
+
+   A thread that waits for a lock donates its priority to the
+   lock's holder, and if the holder is itself waiting for a lock,
+   onward to that lock's holder, and so on.  Each lock records
+   the highest priority among its waiters, and each thread keeps
+   the locks it holds in a max-heap ordered by that priority.  A
+   thread's effective priority is the greater of its base
+   priority and the top of its heap, so releasing a lock needs
+   to look at only one other lock, however many are held.
+
+   The walk along a chain of holders stops as soon as a holder's
+   priority does not rise, because nothing beyond it can change
+   either, and in any case after DONATION_DEPTH links, so that
+   acquiring a lock takes bounded time even in a pathologically
+   long chain. */
+#define DONATION_DEPTH 8
+
+static void sema_down_donate (struct semaphore *, struct lock *);
+static void donate_priority (struct thread *);
+static list_less_func thread_priority_greater;
+static heap_less_func lock_priority_less;
+
 /** Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -53,6 +76,9 @@ sema_init (struct semaphore *sema, unsigned value)
 /** Down or "P" operation on a semaphore.  Waits for SEMA's value
    to become positive and then atomically decrements it.
 
+   Waiters are kept in order of priority, highest first, with
+   waiters of equal priority in FIFO order.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but if it sleeps then the next scheduled
@@ -60,6 +86,16 @@ sema_init (struct semaphore *sema, unsigned value)
 void
 sema_down (struct semaphore *sema) 
 {
+  sema_down_donate (sema, NULL);
+}
+
+/** Does the work of sema_down().  If LOCK is nonnull, then SEMA
+   is LOCK's semaphore, and each time the running thread has to
+   wait it donates its priority to LOCK's holder. */
+static void
+sema_down_donate (struct semaphore *sema, struct lock *lock) 
+{
+  struct thread *cur = thread_current ();
   enum intr_level old_level;
 
   ASSERT (sema != NULL);
@@ -68,9 +104,17 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
+      list_insert_ordered (&sema->waiters, &cur->elem,
+                           thread_priority_greater, NULL);
+      cur->waiting_sema = sema;
+      if (lock != NULL && !thread_mlfqs) 
+        {
+          cur->waiting_lock = lock;
+          donate_priority (cur);
+        }
       thread_block ();
     }
+  cur->waiting_lock = NULL;
   sema->value--;
   intr_set_level (old_level);
 }
@@ -102,7 +146,9 @@ sema_try_down (struct semaphore *sema)
 }
 
 /** Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.  Yields the CPU if the woken thread has a higher
+   priority than the running thread.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,9 +160,14 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct thread *t = list_entry (list_pop_front (&sema->waiters),
+                                     struct thread, elem);
+      t->waiting_sema = NULL;
+      thread_unblock (t);
+    }
   sema->value++;
+  thread_preempt ();
   intr_set_level (old_level);
 }
 
@@ -179,6 +230,26 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->priority = PRI_MIN;
+}
+
+/** Makes the running thread the holder of LOCK, which it has
+   just acquired, and takes on the priority of LOCK's remaining
+   waiters, if any.  Interrupts must be off. */
+static void
+lock_grant (struct lock *lock) 
+{
+  struct thread *cur = thread_current ();
+  struct list *waiters = &lock->semaphore.waiters;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  lock->holder = cur;
+  lock->priority = (list_empty (waiters) ? PRI_MIN
+                    : list_entry (list_front (waiters),
+                                  struct thread, elem)->priority);
+  heap_insert (&cur->held_locks, &lock->elem, lock_priority_less, NULL);
+  thread_update_priority (cur);
 }
 
 /** Acquires LOCK, sleeping until it becomes available if
@@ -188,16 +259,26 @@ lock_init (struct lock *lock)
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
-   we need to sleep. */
+   we need to sleep.
+
+   While waiting, the running thread donates its priority to the
+   lock's holder, as described at the top of this file. */
 void
 lock_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  /* Keep interrupts off until the holder is set, so that no
+     thread can find the lock taken but without a holder to
+     donate to. */
+  old_level = intr_disable ();
+  sema_down_donate (&lock->semaphore, lock);
+  lock_grant (lock);
+  intr_set_level (old_level);
 }
 
 /** Tries to acquires LOCK and returns true if successful or false
@@ -209,14 +290,17 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    lock_grant (lock);
+  intr_set_level (old_level);
   return success;
 }
 
@@ -224,15 +308,26 @@ lock_try_acquire (struct lock *lock)
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
-   handler. */
+   handler.
+
+   The running thread gives up any priority donated through LOCK
+   and yields if that leaves it below another ready thread. */
 void
 lock_release (struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  heap_remove (&cur->held_locks, &lock->elem, lock_priority_less, NULL);
   lock->holder = NULL;
+  lock->priority = PRI_MIN;
+  thread_update_priority (cur);
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
 }
 
 /** Returns true if the current thread holds LOCK, false
@@ -246,13 +341,89 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+/** Donates T's priority along the chain of locks that starts
+   with the one T is waiting for.  Interrupts must be off. */
+static void
+donate_priority (struct thread *t) 
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; depth < DONATION_DEPTH && t->waiting_lock != NULL; depth++) 
+    {
+      struct lock *lock = t->waiting_lock;
+      struct thread *holder = lock->holder;
+
+      if (holder == NULL || t->priority <= lock->priority)
+        break;
+      lock->priority = t->priority;
+      heap_increase (&holder->held_locks, &lock->elem,
+                     lock_priority_less, NULL);
+      if (!thread_update_priority (holder))
+        break;
+
+      /* A holder that is itself waiting must move up in its
+         semaphore's wait list.  (If it is ready, then
+         thread_update_priority() already moved it in the run
+         queue.) */
+      if (holder->status == THREAD_BLOCKED && holder->waiting_sema != NULL) 
+        {
+          list_remove (&holder->elem);
+          list_insert_ordered (&holder->waiting_sema->waiters, &holder->elem,
+                               thread_priority_greater, NULL);
+        }
+      t = holder;
+    }
+}
+
+/** Returns true if the thread that contains list element A_ has
+   a higher priority than the one that contains B_. */
+static bool
+thread_priority_greater (const struct list_elem *a_,
+                         const struct list_elem *b_, void *aux UNUSED) 
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->priority > b->priority;
+}
+
+/** Returns true if the lock that contains heap element A_ has a
+   lower donated priority than the one that contains B_. */
+static bool
+lock_priority_less (const struct heap_elem *a_,
+                    const struct heap_elem *b_, void *aux UNUSED) 
+{
+  const struct lock *a = heap_entry (a_, struct lock, elem);
+  const struct lock *b = heap_entry (b_, struct lock, elem);
+
+  return a->priority < b->priority;
+}
+
 /** One semaphore in a list. */
 struct semaphore_elem 
   {
     struct list_elem elem;              /**< List element. */
     struct semaphore semaphore;         /**< This semaphore. */
+    struct thread *thread;              /**< Thread waiting on it. */
   };
 
+/** Returns true if the thread waiting in the semaphore_elem that
+   contains list element A_ has a higher priority than the one
+   waiting in B_'s. */
+static bool
+waiter_priority_greater (const struct list_elem *a_,
+                         const struct list_elem *b_, void *aux UNUSED) 
+{
+  const struct semaphore_elem *a
+    = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b
+    = list_entry (b_, struct semaphore_elem, elem);
+
+  return a->thread->priority > b->thread->priority;
+}
+
 /** Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -275,6 +446,9 @@ cond_init (struct condition *cond)
    the condition after the wait completes and, if necessary, wait
    again.
 
+   Waiters are signaled in order of their priority at the time
+   they began waiting, highest first.
+
    A given condition variable is associated with only a single
    lock, but one lock may be associated with any number of
    condition variables.  That is, there is a one-to-many mapping
@@ -295,15 +469,18 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
+  waiter.thread = thread_current ();
+  list_insert_ordered (&cond->waiters, &waiter.elem,
+                       waiter_priority_greater, NULL);
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
 
 /** If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
-   LOCK must be held before calling this function.
+   this function signals the highest-priority one of them to wake
+   up from its wait.  LOCK must be held before calling this
+   function.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to signal a condition variable within an
@@ -336,3 +513,304 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/** Readers-writer locks.
+
+   A reader may enter only while there is no writer and no
+   waiting writer of equal or higher priority, so that a stream of
+   readers cannot starve a writer.  When the lock is released,
+   the highest-priority waiter decides who goes next: a writer
+   gets the lock to itself, and readers are let in together, each
+   one that outranks every waiting writer.  Waiters of equal
+   priority are served in FIFO order, and a writer wins ties
+   against readers.
+
+   Waiters are granted the lock by the thread that releases it,
+   before they are woken up, so that a thread that arrives in
+   between cannot take it first.  There is no priority donation,
+   because there may be any number of holders to donate to. */
+
+static bool rwlock_reader_may_enter (struct rwlock *, int priority);
+static struct thread *rwlock_first_waiter (struct list *);
+static void rwlock_wake (struct rwlock *);
+
+/** Initializes RW as unheld. */
+void
+rwlock_init (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  rw->writer = NULL;
+  rw->readers = 0;
+  rw->upgrader = NULL;
+  list_init (&rw->read_waiters);
+  list_init (&rw->write_waiters);
+}
+
+/** Acquires RW for reading, sleeping until that is possible.
+   The running thread must not already hold RW.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != cur);
+
+  old_level = intr_disable ();
+  if (rwlock_reader_may_enter (rw, cur->priority))
+    rw->readers++;
+  else 
+    {
+      list_push_back (&rw->read_waiters, &cur->elem);
+      thread_block ();
+    }
+  intr_set_level (old_level);
+}
+
+/** Acquires RW for writing, sleeping until that is possible.
+   The running thread must not already hold RW.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != cur);
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && rw->readers == 0)
+    rw->writer = cur;
+  else 
+    {
+      list_push_back (&rw->write_waiters, &cur->elem);
+      thread_block ();
+    }
+  intr_set_level (old_level);
+}
+
+/** Tries to acquire RW for reading and returns true if
+   successful or false on failure, without sleeping.
+
+   This function will not sleep, so it may be called within an
+   interrupt handler. */
+bool
+rwlock_try_acquire_read (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  success = rwlock_reader_may_enter (rw, thread_current ()->priority);
+  if (success)
+    rw->readers++;
+  intr_set_level (old_level);
+
+  return success;
+}
+
+/** Tries to acquire RW for writing and returns true if
+   successful or false on failure, without sleeping.
+
+   This function will not sleep, so it may be called within an
+   interrupt handler. */
+bool
+rwlock_try_acquire_write (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  success = rw->writer == NULL && rw->readers == 0;
+  if (success)
+    rw->writer = thread_current ();
+  intr_set_level (old_level);
+
+  return success;
+}
+
+/** Converts the running thread's hold on RW from reading to
+   writing, waiting for the other readers to leave, which they
+   do before any waiting writer gets in.  Only one reader can
+   wait to upgrade at a time, because two would wait for each
+   other forever.  Returns true if successful.  Returns false,
+   still holding RW for reading, if another reader is already
+   waiting to upgrade; the caller should then release RW and
+   acquire it for writing, and recheck whatever it read.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+rwlock_upgrade (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool success = true;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer == NULL && rw->readers > 0);
+
+  old_level = intr_disable ();
+  if (rw->readers == 1) 
+    {
+      rw->readers = 0;
+      rw->writer = cur;
+    }
+  else if (rw->upgrader == NULL) 
+    {
+      rw->upgrader = cur;
+      thread_block ();
+    }
+  else
+    success = false;
+  intr_set_level (old_level);
+
+  return success;
+}
+
+/** Converts the running thread's hold on RW from writing to
+   reading, letting in waiting readers that may now enter. */
+void
+rwlock_downgrade (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  rw->writer = NULL;
+  rw->readers = 1;
+  rwlock_wake (rw);
+  intr_set_level (old_level);
+}
+
+/** Releases RW, which the running thread must hold, for reading
+   or for writing.
+
+   An interrupt handler cannot acquire a readers-writer lock
+   except with a try function, so it rarely makes sense to
+   release one within an interrupt handler. */
+void
+rwlock_release (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  if (rw->writer != NULL) 
+    {
+      ASSERT (rw->writer == thread_current ());
+      rw->writer = NULL;
+    }
+  else 
+    {
+      ASSERT (rw->readers > 0);
+      rw->readers--;
+    }
+  rwlock_wake (rw);
+  intr_set_level (old_level);
+}
+
+/** Returns true if the running thread holds RW for writing, false
+   otherwise.  (There is no way to tell whether a particular
+   thread holds a lock for reading.) */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/** Returns true if a thread of the given PRIORITY may take RW for
+   reading right now. */
+static bool
+rwlock_reader_may_enter (struct rwlock *rw, int priority) 
+{
+  if (rw->writer != NULL || rw->upgrader != NULL)
+    return false;
+  if (list_empty (&rw->write_waiters))
+    return true;
+  return priority > rwlock_first_waiter (&rw->write_waiters)->priority;
+}
+
+/** Returns the highest-priority thread in WAITERS, the first one
+   of those with equal priority.  WAITERS is searched, rather
+   than kept sorted, because the waiters' priorities can change
+   through donation while they wait. */
+static struct thread *
+rwlock_first_waiter (struct list *waiters) 
+{
+  return list_entry (list_min (waiters, thread_priority_greater, NULL),
+                     struct thread, elem);
+}
+
+/** Grants RW to the waiters that should have it next, if any, and
+   wakes them up.  Yields the CPU if one of them has a higher
+   priority than the running thread.  Interrupts must be off. */
+static void
+rwlock_wake (struct rwlock *rw) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (rw->writer != NULL)
+    return;
+
+  if (rw->upgrader != NULL) 
+    {
+      /* Only the upgrader itself is left reading. */
+      if (rw->readers == 1) 
+        {
+          rw->readers = 0;
+          rw->writer = rw->upgrader;
+          rw->upgrader = NULL;
+          thread_unblock (rw->writer);
+          thread_preempt ();
+        }
+      return;
+    }
+
+  if (rw->readers == 0 && !list_empty (&rw->write_waiters)) 
+    {
+      struct thread *w = rwlock_first_waiter (&rw->write_waiters);
+
+      if (list_empty (&rw->read_waiters)
+          || w->priority >= rwlock_first_waiter (&rw->read_waiters)->priority) 
+        {
+          list_remove (&w->elem);
+          rw->writer = w;
+          thread_unblock (w);
+          thread_preempt ();
+          return;
+        }
+    }
+
+  while (!list_empty (&rw->read_waiters)) 
+    {
+      struct thread *r = rwlock_first_waiter (&rw->read_waiters);
+
+      if (!rwlock_reader_may_enter (rw, r->priority))
+        break;
+      list_remove (&r->elem);
+      rw->readers++;
+      thread_unblock (r);
+    }
+  thread_preempt ();
+}
@@ -1,6 +1,7 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
 
@@ -20,8 +21,10 @@ void sema_self_test (void);
 /** Lock. */
 struct lock 
   {
-    struct thread *holder;      /**< Thread holding lock (for debugging). */
+    struct thread *holder;      /**< Thread holding lock. */
     struct semaphore semaphore; /**< Binary semaphore controlling access. */
+    int priority;               /**< Highest priority among waiters. */
+    struct heap_elem elem;      /**< Element in holder's held_locks. */
   };
 
 void lock_init (struct lock *);
@@ -41,6 +44,27 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/** Readers-writer lock.  Any number of threads may hold it
+   shared, for reading, or one thread exclusively, for writing. */
+struct rwlock 
+  {
+    struct thread *writer;      /**< Exclusive holder, or null. */
+    unsigned readers;           /**< Number of shared holders. */
+    struct thread *upgrader;    /**< Reader waiting to upgrade, or null. */
+    struct list read_waiters;   /**< Threads waiting for shared access. */
+    struct list write_waiters;  /**< Threads waiting for exclusive access. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+bool rwlock_try_acquire_read (struct rwlock *);
+bool rwlock_try_acquire_write (struct rwlock *);
+bool rwlock_upgrade (struct rwlock *);
+void rwlock_downgrade (struct rwlock *);
+void rwlock_release (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+
 /** Optimization barrier.
 
    The compiler will not reorder operations across an
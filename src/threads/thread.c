@@ -1,16 +1,22 @@
 #include "threads/thread.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/kmap.h"
+#include "threads/malloc.h"
+#include "threads/memprof.h"
 #include "threads/palloc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,17 +26,37 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/** List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/** Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+
+   There is one FIFO list for each priority.  Bit PRI_MAX - P of
+   `occupied' is set if and only if the list for priority P is
+   nonempty, so that the lowest set bit, found with a single
+   `bsf', names the highest-priority ready thread.  Thus adding,
+   removing, and picking the next thread all take constant time,
+   no matter how many threads are ready. */
+struct run_queue
+  {
+    struct list lists[PRI_MAX + 1];     /**< One list per priority. */
+    uint64_t occupied;                  /**< Bitmap of nonempty lists. */
+    int cnt;                            /**< Number of ready threads. */
+  };
+
+/** Run queues, one per CPU, indexed by struct cpu's `id'.
+
+   A ready thread waits in the run queue of the CPU that it last
+   ran on, so that it tends to stay where its cache footprint is.
+   A new thread goes to the CPU with the fewest threads, and a
+   CPU that runs out of ready threads steals one from the CPU
+   with the most before it goes idle.  All of them are protected
+   by the same lock as everything else that runs with interrupts
+   off (see interrupt.c). */
+static struct run_queue ready_queues[CPU_MAX];
 
 /** List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/** Idle thread. */
-static struct thread *idle_thread;
-
 /** Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
@@ -49,19 +75,106 @@ struct kernel_thread_frame
 static long long idle_ticks;    /**< # of timer ticks spent idle. */
 static long long kernel_ticks;  /**< # of timer ticks in kernel threads. */
 static long long user_ticks;    /**< # of timer ticks in user programs. */
+static long long wakeups;       /**< # of blocked threads woken and run. */
+static uint64_t wakeup_cycles;  /**< Total cycles from wakeup to running. */
+static uint64_t wakeup_max;     /**< Longest wakeup latency, in cycles. */
+static long long steals;        /**< # of threads taken from another CPU. */
+static long long pool_hits;     /**< # of thread pages taken from the pool. */
+static long long pool_misses;   /**< # of thread pages from palloc instead. */
+
+/** Pool of thread pages.
+
+   Creating a thread used to cost a call into the page allocator
+   and zeroing a whole page, and exiting one, another call to
+   give the page back.  Instead, pages of threads that have died
+   are kept in a pool, up to `thread_pool_high' of them, and
+   thread_create() takes its page from the pool when it can.
+
+   init_thread() clears `struct thread' itself, at the bottom of
+   the page, so the pool only clears the top THREAD_POOL_ZERO
+   bytes of the stack, where the initial frames go.  The rest of
+   the stack is never read before it is written.
+
+   When the pool falls below `thread_pool_low' pages,
+   thread_create() wakes up the "tpool" thread, which refills it
+   to `thread_pool_high' from the page allocator.  It runs at
+   minimum priority, so that the refill happens when there is
+   nothing better to do.
+
+   The pool is a stack of pages, linked through their first
+   word, so that the most recently freed page, which is likely
+   still in the cache, is reused first.  It is protected by
+   turning off interrupts. */
+struct pool_page
+  {
+    struct pool_page *next;     /**< Next page in pool. */
+  };
+static struct pool_page *pool;  /**< Top of pool, or null if empty. */
+static int pool_cnt;            /**< Number of pages in pool. */
+static struct semaphore pool_refill; /**< Upped to wake "tpool". */
+#define THREAD_POOL_ZERO 512    /**< Bytes of stack to clear. */
+
+/** Pool watermarks.  Controlled by kernel command-line option
+   "-tpool=LOW,HIGH". */
+int thread_pool_low = 4;
+int thread_pool_high = 16;
 
 /** Scheduling. */
 #define TIME_SLICE 4            /**< # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /**< # of timer ticks since last yield. */
 
 /** If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/** Multi-level feedback queue scheduler.
+
+   The 4.4BSD scheduler recomputes every thread's priority every
+   few ticks and decays every thread's recent_cpu once a second.
+   Doing either for all threads from the timer interrupt would
+   cost time proportional to the number of threads, so we do
+   only the work that can change a scheduling decision:
+
+     - Every tick, only the running thread's recent_cpu grows,
+       and every MLFQS_PRI_INTERVAL ticks only its priority is
+       recomputed, because no other thread's inputs change.
+
+     - Once a second, load_avg is updated and the new decay
+       coefficient is appended to decay_history.  Only the
+       running thread and the ready threads, which compete for
+       the CPU right now, are brought up to date.
+
+     - A blocked thread's recent_cpu is decayed lazily, by
+       replaying the coefficients it missed when it is next
+       examined or put back in the run queue. */
+#define MLFQS_PRI_INTERVAL 4    /**< Ticks between priority updates. */
+#define DECAY_HISTORY 256       /**< Seconds of decay coefficients kept. */
+static fixed_t load_avg;        /**< System load average. */
+static int decay_epoch;         /**< Decays performed so far. */
+static fixed_t decay_history[DECAY_HISTORY]; /**< Coefficient by epoch. */
+
+static void mlfqs_tick (struct thread *);
+static void mlfqs_decay (void);
+static void mlfqs_catch_up (struct thread *);
+static void mlfqs_refresh (struct thread *);
+
 static void kernel_thread (thread_func *, void *aux);
 
+static void run_queue_init (struct run_queue *);
+static void run_queue_push (struct run_queue *, struct thread *);
+static struct thread *run_queue_pop (struct run_queue *);
+static void run_queue_remove (struct run_queue *, struct thread *);
+static int run_queue_max_priority (const struct run_queue *);
+static struct thread *run_queue_steal (struct run_queue *);
+static struct run_queue *run_queue_busiest (void);
+static struct cpu *cpu_least_loaded (void);
+
 static void idle (void *aux UNUSED);
+static void pool_refill_thread (void *aux UNUSED);
+static struct thread *alloc_thread_page (void);
+static void free_thread_page (struct thread *);
+static void idle_loop (void) NO_RETURN;
+static bool is_idle (const struct thread *);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
@@ -76,7 +189,7 @@ static tid_t allocate_tid (void);
    general and it is possible in this case only because loader.S
    was careful to put the bottom of the stack at a page boundary.
 
-   Also initializes the run queue and the tid lock.
+   Also initializes the run queues and the tid lock.
 
    After calling this function, be sure to initialize the page
    allocator before trying to create any threads with
@@ -87,15 +200,21 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  sema_init (&pool_refill, 0);
+  for (i = 0; i < CPU_MAX; i++)
+    run_queue_init (&ready_queues[i]);
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
+  initial_thread->cpu = &cpus[0];
+  cpus[0].current = initial_thread;
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
 }
@@ -115,6 +234,9 @@ thread_start (void)
 
   /* Wait for the idle thread to initialize idle_thread. */
   sema_down (&idle_started);
+
+  /* Fill the thread page pool in the background. */
+  thread_create ("tpool", PRI_MIN, pool_refill_thread, NULL);
 }
 
 /** Called by the timer interrupt handler at each timer tick.
@@ -123,9 +245,10 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  struct cpu *c = t->cpu;
 
   /* Update statistics. */
-  if (t == idle_thread)
+  if (t == c->idle_thread)
     idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
@@ -134,8 +257,11 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (++c->thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
@@ -145,6 +271,13 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Wakeup latency: %lld wakeups, %"PRIu64" cycles average, "
+          "%"PRIu64" cycles max\n",
+          wakeups, wakeups > 0 ? wakeup_cycles / wakeups : 0, wakeup_max);
+  if (cpu_cnt > 1)
+    printf ("SMP: %d CPUs, %lld threads stolen\n", cpu_cnt, steals);
+  printf ("Thread pool: %lld hits, %lld misses, %d pages pooled\n",
+          pool_hits, pool_misses, pool_cnt);
 }
 
 /** Creates a new kernel thread named NAME with the given initial
@@ -159,9 +292,8 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread has a higher priority than the running
+   thread, the running thread yields to it immediately. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -170,18 +302,23 @@ thread_create (const char *name, int priority,
   struct kernel_thread_frame *kf;
   struct switch_entry_frame *ef;
   struct switch_threads_frame *sf;
+  enum intr_level old_level;
   tid_t tid;
 
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = alloc_thread_page ();
   if (t == NULL)
     return TID_ERROR;
 
-  /* Initialize thread. */
+  /* Initialize thread.  The new thread inherits its parent's
+     niceness and recent_cpu. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  t->nice = thread_current ()->nice;
+  t->recent_cpu = thread_current ()->recent_cpu;
+  t->decay_epoch = thread_current ()->decay_epoch;
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
@@ -198,8 +335,12 @@ thread_create (const char *name, int priority,
   sf->eip = switch_entry;
   sf->ebp = 0;
 
-  /* Add to run queue. */
+  /* Add to the run queue of the least busy CPU. */
+  old_level = intr_disable ();
+  t->cpu = cpu_least_loaded ();
+  intr_set_level (old_level);
   thread_unblock (t);
+  thread_preempt ();
 
   return tid;
 }
@@ -224,6 +365,11 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
+   T goes into the run queue of the CPU that it last ran on.  If
+   that is another CPU, which is idle or running a thread of
+   lower priority than T, then that CPU is interrupted so that it
+   reschedules.
+
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
@@ -232,14 +378,89 @@ void
 thread_unblock (struct thread *t) 
 {
   enum intr_level old_level;
+  struct cpu *c;
 
   ASSERT (is_thread (t));
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  if (thread_mlfqs)
+    mlfqs_refresh (t);
+  c = t->cpu;
+  run_queue_push (&ready_queues[c->id], t);
   t->status = THREAD_READY;
+  t->unblock_tsc = rdtsc ();
+  if (c != cpu_current ()
+      && (is_idle (c->current) || t->priority > c->current->priority))
+    cpu_reschedule (c);
+  intr_set_level (old_level);
+}
+
+/** Yields the CPU if a ready thread has a higher priority than
+   the running thread.  Within an external interrupt handler, the
+   yield is deferred until the handler returns. */
+void
+thread_preempt (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  struct thread *cur = thread_current ();
+  bool yield = (run_queue_max_priority (&ready_queues[cur->cpu->id])
+                > cur->priority);
+
+  if (yield && intr_context ()) 
+    {
+      intr_yield_on_return ();
+      yield = false;
+    }
   intr_set_level (old_level);
+
+  if (yield)
+    thread_yield ();
+}
+
+/** Recomputes T's effective priority, which is the greater of
+   its base priority and the highest priority donated to it
+   through the locks that it holds.  If T is in a run queue, it
+   moves to the back of the list for its new priority.  Returns
+   true if T's priority changed, false otherwise.
+
+   The highest donation is at the top of T's held_locks heap, so
+   this takes constant time however many locks T holds.  The
+   multi-level feedback queue scheduler does not use donation,
+   so under it this function does nothing.  Interrupts must be
+   off. */
+bool
+thread_update_priority (struct thread *t) 
+{
+  int priority = t->base_priority;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_mlfqs)
+    return false;
+
+  if (!heap_empty (&t->held_locks)) 
+    {
+      struct lock *lock = heap_entry (heap_max (&t->held_locks),
+                                      struct lock, elem);
+      if (lock->priority > priority)
+        priority = lock->priority;
+    }
+  if (priority == t->priority)
+    return false;
+
+  if (t->status == THREAD_READY) 
+    {
+      struct run_queue *rq = &ready_queues[t->cpu->id];
+
+      run_queue_remove (rq, t);
+      t->priority = priority;
+      run_queue_push (rq, t);
+    }
+  else
+    t->priority = priority;
+  return true;
 }
 
 /** Returns the name of the running thread. */
@@ -285,6 +506,8 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  malloc_thread_exit ();
+  memprof_thread_exit ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -307,8 +530,8 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
+  if (!is_idle (cur)) 
+    run_queue_push (&ready_queues[cur->cpu->id], cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -331,89 +554,375 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/** Sets the current thread's priority to NEW_PRIORITY. */
+/** Sets the current thread's base priority to NEW_PRIORITY.
+   Priority donated to the thread still applies until the locks
+   it was donated through are released.  Yields the CPU if the
+   current thread no longer has the highest priority.  Ignored by
+   the multi-level feedback queue scheduler, which computes
+   priorities itself. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
 }
 
-/** Returns the current thread's priority. */
+/** Returns the current thread's effective priority, including
+   any donations. */
 int
 thread_get_priority (void) 
 {
   return thread_current ()->priority;
 }
 
-/** Sets the current thread's nice value to NICE. */
+/** Sets the current thread's nice value to NICE, recomputes its
+   priority, and yields if it no longer has the highest
+   priority. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  mlfqs_catch_up (cur);
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_refresh (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
 }
 
 /** Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /** Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fix_round (fix_mul_int (load_avg, 100));
+  intr_set_level (old_level);
+
+  return load;
 }
 
 /** Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int recent;
+
+  old_level = intr_disable ();
+  mlfqs_catch_up (cur);
+  recent = fix_round (fix_mul_int (cur->recent_cpu, 100));
+  intr_set_level (old_level);
+
+  return recent;
 }
-
+
+/** Does the multi-level feedback queue scheduler's bookkeeping
+   for timer tick, while thread CUR is running. */
+static void
+mlfqs_tick (struct thread *cur) 
+{
+  int64_t now = timer_ticks ();
+
+  ASSERT (intr_context ());
+
+  if (!is_idle (cur))
+    cur->recent_cpu = fix_add_int (cur->recent_cpu, 1);
+
+  /* Every CPU gets timer ticks, but the once-a-second decay is
+     system-wide, so only the bootstrap processor does it. */
+  if (now % TIMER_FREQ == 0 && cur->cpu->id == 0)
+    mlfqs_decay ();
+
+  if (now % MLFQS_PRI_INTERVAL == 0 && !is_idle (cur))
+    mlfqs_refresh (cur);
+}
+
+/** Updates the load average and records a new recent_cpu decay
+   coefficient, then brings the running and ready threads up to
+   date with it.  Called once a second.  Threads running on other
+   CPUs catch up at their next priority update. */
+static void
+mlfqs_decay (void) 
+{
+  struct thread *cur = thread_current ();
+  int ready_cnt = 0;
+  fixed_t twice_load;
+  struct list ready;
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    ready_cnt += ready_queues[i].cnt + !is_idle (cpus[i].current);
+
+  load_avg = fix_div_int (fix_add (fix_mul_int (load_avg, 59),
+                                   fix_int (ready_cnt)), 60);
+  twice_load = fix_mul_int (load_avg, 2);
+  decay_history[decay_epoch % DECAY_HISTORY]
+    = fix_div (twice_load, fix_add_int (twice_load, 1));
+  decay_epoch++;
+
+  if (!is_idle (cur))
+    mlfqs_refresh (cur);
+
+  /* Ready threads' priorities may rise as their recent_cpu
+     decays, so take them all out of the run queues and put them
+     back in at their new priorities.  Popping in priority order
+     and pushing back in the same order keeps threads of equal
+     priority in FIFO order. */
+  for (i = 0; i < cpu_cnt; i++) 
+    {
+      struct run_queue *rq = &ready_queues[i];
+
+      list_init (&ready);
+      while (rq->cnt > 0)
+        list_push_back (&ready, &run_queue_pop (rq)->elem);
+      while (!list_empty (&ready)) 
+        {
+          struct thread *t = list_entry (list_pop_front (&ready),
+                                         struct thread, elem);
+          mlfqs_refresh (t);
+          run_queue_push (rq, t);
+        }
+    }
+}
+
+/** Applies to T's recent_cpu each once-a-second decay that it has
+   missed since it was last brought up to date. */
+static void
+mlfqs_catch_up (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (decay_epoch - t->decay_epoch > DECAY_HISTORY) 
+    {
+      /* The coefficients that far back have been overwritten.
+         After so many decays, recent_cpu has converged on the
+         fixed point of recent_cpu = c * recent_cpu + nice, where
+         c = 2*load_avg / (2*load_avg + 1), so jump straight
+         there. */
+      fixed_t fixed_point = fix_add_int (fix_mul_int (load_avg, 2), 1);
+      t->recent_cpu = fix_mul_int (fixed_point, t->nice);
+    }
+  else 
+    for (; t->decay_epoch < decay_epoch; t->decay_epoch++) 
+      {
+        fixed_t coeff = decay_history[t->decay_epoch % DECAY_HISTORY];
+        t->recent_cpu = fix_add_int (fix_mul (coeff, t->recent_cpu), t->nice);
+      }
+  t->decay_epoch = decay_epoch;
+}
+
+/** Brings T's recent_cpu up to date and recomputes its priority
+   from it.  T must not be in the run queue. */
+static void
+mlfqs_refresh (struct thread *t) 
+{
+  int priority;
+
+  mlfqs_catch_up (t);
+  priority = fix_trunc (fix_sub (fix_int (PRI_MAX - t->nice * 2),
+                                 fix_div_int (t->recent_cpu, 4)));
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->priority = priority;
+}
+
 /** Idle thread.  Executes when no other thread is ready to run.
 
-   The idle thread is initially put on the ready list by
-   thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   The bootstrap processor's idle thread is initially put on the
+   ready list by thread_start().  It will be scheduled once
+   initially, at which point it initializes its CPU's
+   `idle_thread', "up"s the semaphore passed to it to enable
+   thread_start() to continue, and immediately blocks.  After
+   that, the idle thread never appears in a run queue.  It is
+   returned by next_thread_to_run() as a special case when there
+   is nothing else to run.  Each secondary processor starts out
+   running its idle thread instead: see thread_create_idle(). */
 static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  cpu_current ()->idle_thread = thread_current ();
   sema_up (idle_started);
 
+  idle_loop ();
+}
+
+/** Runs the idle thread's loop on the current CPU. */
+static void
+idle_loop (void) 
+{
+  struct run_queue *rq = &ready_queues[cpu_current ()->id];
+
   for (;;) 
     {
       /* Let someone else run. */
       intr_disable ();
       thread_block ();
 
-      /* Re-enable interrupts and wait for the next one.
+      /* Zero free pages for palloc, one at a time, until it has
+         enough or another thread becomes ready to run. */
+      while (rq->occupied == 0) 
+        {
+          bool zeroed;
+
+          intr_enable ();
+          zeroed = palloc_zero_page ();
+          intr_disable ();
+          if (!zeroed)
+            break;
+        }
+      if (rq->occupied != 0)
+        continue;
+
+      /* Let the timer skip ticks while we wait, if it can. */
+      timer_idle_enter ();
+
+      /* Re-enable interrupts and wait for the next one. */
+      intr_wait ();
+    }
+}
+
+/** Creates and returns the idle thread for secondary processor
+   C, or returns a null pointer if memory is not available.
+   Unlike other threads, it is created already running, because
+   C starts up on its stack, in cpu.c's ap_main(), and then calls
+   thread_start_ap() to enter the idle loop. */
+struct thread *
+thread_create_idle (struct cpu *c) 
+{
+  struct thread *t = alloc_thread_page ();
+  char name[16];
+
+  if (t == NULL)
+    return NULL;
+
+  snprintf (name, sizeof name, "idle%d", c->id);
+  init_thread (t, name, PRI_MIN);
+  t->tid = allocate_tid ();
+  t->status = THREAD_RUNNING;
+  t->cpu = c;
+  c->idle_thread = c->current = t;
+  return t;
+}
 
-         The `sti' instruction disables interrupts until the
-         completion of the next instruction, so these two
-         instructions are executed atomically.  This atomicity is
-         important; otherwise, an interrupt could be handled
-         between re-enabling interrupts and waiting for the next
-         one to occur, wasting as much as one clock tick worth of
-         time.
+/** Makes a secondary processor, running the thread returned by
+   thread_create_idle(), start scheduling threads.  Interrupts
+   must be off. */
+void
+thread_start_ap (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (is_idle (thread_current ()));
+
+  idle_loop ();
+}
 
-         See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
-         7.11.1 "HLT Instruction". */
-      asm volatile ("sti; hlt" : : : "memory");
+/** Thread that refills the thread page pool up to
+   `thread_pool_high' pages whenever alloc_thread_page() finds
+   it below `thread_pool_low'. */
+static void
+pool_refill_thread (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      struct pool_page *p;
+
+      while (pool_cnt < thread_pool_high
+             && (p = palloc_get_page (0)) != NULL) 
+        {
+          enum intr_level old_level = intr_disable ();
+          p->next = pool;
+          pool = p;
+          pool_cnt++;
+          intr_set_level (old_level);
+        }
+      sema_down (&pool_refill);
     }
 }
 
+/** Returns a page for a new thread, with the top of its stack
+   cleared, taking it from the pool if possible.  The caller
+   clears its `struct thread' with init_thread().  Returns a null
+   pointer if no memory is available. */
+static struct thread *
+alloc_thread_page (void) 
+{
+  enum intr_level old_level;
+  struct pool_page *p;
+
+  old_level = intr_disable ();
+  p = pool;
+  if (p != NULL) 
+    {
+      pool = p->next;
+      pool_cnt--;
+      pool_hits++;
+    }
+  else
+    pool_misses++;
+  if (pool_cnt < thread_pool_low && pool_refill.value == 0)
+    sema_up (&pool_refill);
+  intr_set_level (old_level);
+
+  if (p == NULL) 
+    {
+      p = palloc_get_page (0);
+      if (p == NULL)
+        return NULL;
+    }
+  memset ((uint8_t *) p + PGSIZE - THREAD_POOL_ZERO, 0, THREAD_POOL_ZERO);
+  return (struct thread *) p;
+}
+
+/** Returns dead thread T's page to the pool, or to the page
+   allocator if the pool is full.  Called with interrupts
+   off. */
+static void
+free_thread_page (struct thread *t) 
+{
+  struct pool_page *p = (struct pool_page *) t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t->magic = 0;
+  if (pool_cnt < thread_pool_high) 
+    {
+      p->next = pool;
+      pool = p;
+      pool_cnt++;
+    }
+  else
+    palloc_free_page (t);
+}
+
 /** Function used as the basis for a kernel thread. */
 static void
 kernel_thread (thread_func *function, void *aux) 
@@ -439,6 +948,24 @@ running_thread (void)
   return pg_round_down (esp);
 }
 
+/** Returns the CPU that is running this code.  Before the
+   threading system is initialized, that can only be the
+   bootstrap processor. */
+struct cpu *
+cpu_current (void) 
+{
+  struct thread *t = initial_thread != NULL ? running_thread () : NULL;
+
+  return t != NULL && t->cpu != NULL ? t->cpu : &cpus[0];
+}
+
+/** Returns true if T is its CPU's idle thread. */
+static bool
+is_idle (const struct thread *t) 
+{
+  return t == t->cpu->idle_thread;
+}
+
 /** Returns true if T appears to point to a valid thread. */
 static bool
 is_thread (struct thread *t)
@@ -461,8 +988,14 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  heap_init (&t->held_locks);
+  t->nice = NICE_DEFAULT;
+  t->decay_epoch = decay_epoch;
   t->magic = THREAD_MAGIC;
+#ifdef USERPROG
+  list_init (&t->children);
+#endif
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
@@ -482,18 +1015,199 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-/** Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+/** Chooses and returns the next thread to be scheduled on this
+   CPU.  Should return a thread from this CPU's run queue, unless
+   the run queue is empty.  (If the running thread can continue
+   running, then it will be in the run queue.)  If the run queue
+   is empty, steal the highest-priority thread that can move from
+   the CPU with the most ready threads.  If there is none, return
+   this CPU's idle thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
-    return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+  struct cpu *c = cpu_current ();
+  struct run_queue *rq = &ready_queues[c->id];
+  struct thread *t;
+
+  if (rq->cnt > 0)
+    return run_queue_pop (rq);
+
+  rq = run_queue_busiest ();
+  if (rq != NULL && (t = run_queue_steal (rq)) != NULL) 
+    {
+      steals++;
+      return t;
+    }
+  return c->idle_thread;
+}
+
+/** Returns the index of the least significant set bit in X,
+   which must be nonzero. */
+static inline int
+bsf64 (uint64_t x) 
+{
+  uint32_t lo = x, hi = x >> 32;
+  uint32_t bit;
+
+  ASSERT (x != 0);
+
+  /* See [IA32-v2a] "BSF--Bit Scan Forward". */
+  if (lo != 0)
+    {
+      asm ("bsfl %1, %0" : "=r" (bit) : "rm" (lo));
+      return bit;
+    }
+  asm ("bsfl %1, %0" : "=r" (bit) : "rm" (hi));
+  return bit + 32;
+}
+
+/** Returns the bit in a run queue's `occupied' map that stands
+   for PRIORITY. */
+static inline uint64_t
+priority_bit (int priority) 
+{
+  return (uint64_t) 1 << (PRI_MAX - priority);
+}
+
+/** Initializes RQ as an empty run queue. */
+static void
+run_queue_init (struct run_queue *rq) 
+{
+  int pri;
+
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    list_init (&rq->lists[pri]);
+  rq->occupied = 0;
+  rq->cnt = 0;
+}
+
+/** Adds T to the back of the list for its priority in RQ. */
+static void
+run_queue_push (struct run_queue *rq, struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  list_push_back (&rq->lists[t->priority], &t->elem);
+  rq->occupied |= priority_bit (t->priority);
+  rq->cnt++;
+}
+
+/** Removes and returns the thread at the front of the
+   highest-priority nonempty list in RQ, which must not be
+   empty. */
+static struct thread *
+run_queue_pop (struct run_queue *rq) 
+{
+  int pri = PRI_MAX - bsf64 (rq->occupied);
+  struct list *list = &rq->lists[pri];
+  struct thread *t = list_entry (list_pop_front (list), struct thread, elem);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (list_empty (list))
+    rq->occupied &= ~priority_bit (pri);
+  rq->cnt--;
+  return t;
+}
+
+/** Removes T, which must be in RQ, from RQ. */
+static void
+run_queue_remove (struct run_queue *rq, struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (list_empty (&rq->lists[t->priority]))
+    rq->occupied &= ~priority_bit (t->priority);
+  rq->cnt--;
+}
+
+/** Returns the priority of the highest-priority thread in RQ, or
+   PRI_MIN - 1 if RQ is empty. */
+static int
+run_queue_max_priority (const struct run_queue *rq) 
+{
+  return rq->occupied != 0 ? PRI_MAX - bsf64 (rq->occupied) : PRI_MIN - 1;
+}
+
+/** Removes and returns the highest-priority thread in RQ that
+   may move to another CPU, or returns a null pointer if there is
+   none.  A thread whose FPU registers are still loaded in its
+   CPU must stay there (see userprog/fpu.c). */
+static struct thread *
+run_queue_steal (struct run_queue *rq) 
+{
+  uint64_t occupied = rq->occupied;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (occupied != 0) 
+    {
+      int pri = PRI_MAX - bsf64 (occupied);
+      struct list *list = &rq->lists[pri];
+      struct list_elem *e;
+
+      for (e = list_begin (list); e != list_end (list); e = list_next (e)) 
+        {
+          struct thread *t = list_entry (e, struct thread, elem);
+          if (t->cpu->fpu_owner != t) 
+            {
+              run_queue_remove (rq, t);
+              return t;
+            }
+        }
+      occupied &= ~priority_bit (pri);
+    }
+  return NULL;
+}
+
+/** Returns the run queue with the most ready threads, or a null
+   pointer if every run queue is empty. */
+static struct run_queue *
+run_queue_busiest (void) 
+{
+  struct run_queue *busiest = NULL;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (ready_queues[i].cnt > 0
+        && (busiest == NULL || ready_queues[i].cnt > busiest->cnt))
+      busiest = &ready_queues[i];
+  return busiest;
+}
+
+/** Returns the number of threads that are ready to run or running
+   on CPU C, not counting its idle thread. */
+static int
+cpu_load (const struct cpu *c) 
+{
+  return ready_queues[c->id].cnt + !is_idle (c->current);
+}
+
+/** Returns the CPU with the fewest threads ready to run or
+   running, preferring the current CPU in a tie. */
+static struct cpu *
+cpu_least_loaded (void) 
+{
+  struct cpu *best = cpu_current ();
+  int best_load = cpu_load (best);
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < cpu_cnt; i++) 
+    {
+      int load = cpu_load (&cpus[i]);
+      if (load < best_load) 
+        {
+          best = &cpus[i];
+          best_load = load;
+        }
+    }
+  return best;
 }
 
 /** Completes a thread switch by activating the new thread's page
@@ -521,15 +1235,31 @@ thread_schedule_tail (struct thread *prev)
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  cur->cpu->current = cur;
 
   /* Start new time slice. */
-  thread_ticks = 0;
+  cur->cpu->thread_ticks = 0;
+
+  /* Account for how long we waited to run after being woken. */
+  if (cur->unblock_tsc != 0) 
+    {
+      uint64_t latency = rdtsc () - cur->unblock_tsc;
+
+      wakeups++;
+      wakeup_cycles += latency;
+      if (latency > wakeup_max)
+        wakeup_max = latency;
+      cur->unblock_tsc = 0;
+    }
 
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate ();
 #endif
 
+  /* Drop TLB entries for reused temporary kernel mappings. */
+  kmap_sync ();
+
   /* If the thread we switched from is dying, destroy its struct
      thread.  This must happen late so that thread_exit() doesn't
      pull out the rug under itself.  (We don't free
@@ -538,7 +1268,7 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      free_thread_page (prev);
     }
 }
 
@@ -560,6 +1290,9 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  if (is_idle (cur) && next != cur)
+    timer_idle_exit ();
+  next->cpu = cur->cpu;
   if (cur != next)
     prev = switch_threads (cur, next);
   thread_schedule_tail (prev);
@@ -2,8 +2,11 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
+#include <heap.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 
 /** States in a thread's life cycle. */
 enum thread_status
@@ -24,6 +27,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /**< Default priority. */
 #define PRI_MAX 63                      /**< Highest priority. */
 
+/** Thread niceness, for the multi-level feedback queue scheduler. */
+#define NICE_MIN -20                    /**< Most favorable. */
+#define NICE_DEFAULT 0                  /**< Default niceness. */
+#define NICE_MAX 20                     /**< Least favorable. */
+
 /** A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -74,12 +82,15 @@ typedef int tid_t;
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
-/** The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+/** The `elem' member has a triple purpose.  It can be an element
+   in the run queue (thread.c), an element in a semaphore wait
+   list (synch.c), or an element in a timing wheel slot while the
+   thread sleeps in timer_sleep() (devices/timer.c).  It can be
+   used these ways only because they are mutually exclusive: only
+   a thread in the ready state is on the run queue, whereas only
+   a thread in the blocked state is on a semaphore wait list or
+   in the timing wheel, and a sleeping thread is not waiting on
+   any semaphore. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -87,15 +98,57 @@ struct thread
     enum thread_status status;          /**< Thread state. */
     char name[16];                      /**< Name (for debugging purposes). */
     uint8_t *stack;                     /**< Saved stack pointer. */
-    int priority;                       /**< Priority. */
+    int priority;                       /**< Effective priority. */
+    int base_priority;                  /**< Priority before donation. */
     struct list_elem allelem;           /**< List element for all threads list. */
+    uint64_t unblock_tsc;               /**< TSC when last unblocked, or 0. */
+    struct cpu *cpu;                    /**< CPU it runs or last ran on. */
+
+    /* Owned by thread.c, for the multi-level feedback queue. */
+    int nice;                           /**< Niceness. */
+    fixed_t recent_cpu;                 /**< Recent CPU time received. */
+    int decay_epoch;                    /**< Decays applied to recent_cpu. */
 
-    /* Shared between thread.c and synch.c. */
+    /* Owned by synch.c, for priority donation. */
+    struct heap held_locks;             /**< Held locks, by donated priority. */
+    struct lock *waiting_lock;          /**< Lock being waited for, if any. */
+    struct semaphore *waiting_sema;     /**< Semaphore being waited on, if any. */
+
+    /* Shared between thread.c, synch.c and devices/timer.c. */
     struct list_elem elem;              /**< List element. */
 
+    /* Owned by devices/timer.c. */
+    int64_t wakeup_tick;                /**< Tick (or PIT cycle) to wake up at. */
+
+    /* Owned by threads/malloc.c. */
+    struct magazines *magazines;        /**< Free blocks, per size class. */
+
+    /* Owned by threads/memprof.c. */
+    size_t memprof_bytes;               /**< Bytes allocated, not freed here. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /**< Page directory. */
+    struct child *child;                /**< Exit status for parent, or null. */
+    struct list children;               /**< `struct child' of each child. */
+
+    /* Owned by userprog/syscall.c. */
+    struct list files;                  /**< Open files. */
+    int next_fd;                        /**< Next file descriptor. */
+
+    /* Owned by userprog/fpu.c. */
+    struct fpu_state *fpu;              /**< Saved FPU registers, or null. */
+#endif
+#ifdef VM
+    /* Owned by userprog/process.c. */
+    struct file *exec_file;             /**< Executable, for demand paging. */
+
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /**< Supplemental page table. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /**< Memory-mapped files. */
+    int next_mapid;                     /**< Next mapping identifier. */
 #endif
 
     /* Owned by thread.c. */
@@ -107,9 +160,19 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/** Low and high watermarks for the pool of free pages that new
+   threads are allocated from.  Controlled by kernel command-line
+   option "-tpool=LOW,HIGH". */
+extern int thread_pool_low;
+extern int thread_pool_high;
+
 void thread_init (void);
 void thread_start (void);
 
+struct cpu;
+struct thread *thread_create_idle (struct cpu *);
+void thread_start_ap (void) NO_RETURN;
+
 void thread_tick (void);
 void thread_print_stats (void);
 
@@ -118,6 +181,8 @@ tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_preempt (void);
+bool thread_update_priority (struct thread *);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -52,6 +52,14 @@ static inline void *pg_round_down (const void *va) {
    virtual address space belongs to the kernel. */
 #define	PHYS_BASE ((void *) LOADER_PHYS_BASE)
 
+/** Physical memory below this address, 896 MB, is "low memory",
+   mapped at PHYS_BASE as described above.  Physical memory above
+   it is "high memory", which does not fit in the kernel's 1 GB of
+   virtual address space along with everything else that lives
+   there.  The kernel can access a high memory frame only by
+   mapping it temporarily with kmap() (see kmap.c). */
+#define LOWMEM_LIMIT 0x38000000
+
 /** Returns true if VADDR is a user virtual address. */
 static inline bool
 is_user_vaddr (const void *vaddr) 
@@ -67,11 +75,11 @@ is_kernel_vaddr (const void *vaddr)
 }
 
 /** Returns kernel virtual address at which physical address PADDR
-   is mapped. */
+   is mapped.  PADDR must be in low memory. */
 static inline void *
 ptov (uintptr_t paddr)
 {
-  ASSERT ((void *) paddr < PHYS_BASE);
+  ASSERT (paddr < LOWMEM_LIMIT);
 
   return (void *) (paddr + PHYS_BASE);
 }
@@ -0,0 +1,127 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/** Deferred work.
+
+   An external interrupt handler runs with interrupts off, so
+   while it runs, no other interrupt can be serviced.  A handler
+   should therefore do only what must be done right away, such as
+   reading a device register to acknowledge the interrupt, and
+   leave the rest to a work item that it queues with
+   work_queue().  Each queue has a worker thread that runs its
+   items in FIFO order, with interrupts on, so they may take
+   their time and even sleep.
+
+   Items in the WORK_HIGH queue run at PRI_MAX, so that they
+   preempt ordinary threads as soon as the interrupt returns.
+   Items in the WORK_NORMAL queue compete with other threads at
+   PRI_DEFAULT.
+
+   The queues are usable before their workers are started by
+   workqueue_init(): items queued earlier wait for the worker. */
+
+/** A work queue. */
+struct workqueue
+  {
+    struct list items;          /**< Pending work items. */
+    struct thread *worker;      /**< Worker thread, or null. */
+    bool waiting;               /**< Worker blocked waiting for work? */
+    long long run_cnt;          /**< Number of items run. */
+  };
+
+static struct workqueue queues[WORK_PRIORITY_CNT] =
+  {
+    [WORK_HIGH] = {LIST_INITIALIZER (queues[WORK_HIGH].items),
+                   NULL, false, 0},
+    [WORK_NORMAL] = {LIST_INITIALIZER (queues[WORK_NORMAL].items),
+                     NULL, false, 0},
+  };
+
+static void worker (void *wq_);
+
+/** Starts the worker threads.  Must be called after
+   thread_start(). */
+void
+workqueue_init (void) 
+{
+  thread_create ("work-high", PRI_MAX, worker, &queues[WORK_HIGH]);
+  thread_create ("work-normal", PRI_DEFAULT, worker, &queues[WORK_NORMAL]);
+}
+
+/** Initializes W to call FUNC, passing AUX, when it runs. */
+void
+work_init (struct work *w, work_func *func, void *aux) 
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->pending = false;
+}
+
+/** Queues W to run in the worker thread for PRIORITY, unless it
+   is already queued and has not yet started.
+
+   This function may be called from an interrupt handler. */
+void
+work_queue (enum work_priority priority, struct work *w) 
+{
+  struct workqueue *wq;
+  enum intr_level old_level;
+
+  ASSERT (priority < WORK_PRIORITY_CNT);
+  ASSERT (w != NULL);
+
+  wq = &queues[priority];
+  old_level = intr_disable ();
+  if (!w->pending) 
+    {
+      w->pending = true;
+      list_push_back (&wq->items, &w->elem);
+      if (wq->waiting) 
+        {
+          wq->waiting = false;
+          thread_unblock (wq->worker);
+          thread_preempt ();
+        }
+    }
+  intr_set_level (old_level);
+}
+
+/** Prints work queue statistics. */
+void
+workqueue_print_stats (void) 
+{
+  printf ("Work queues: %lld high-priority items, %lld normal items\n",
+          queues[WORK_HIGH].run_cnt, queues[WORK_NORMAL].run_cnt);
+}
+
+/** Worker thread for work queue WQ_. */
+static void
+worker (void *wq_) 
+{
+  struct workqueue *wq = wq_;
+
+  wq->worker = thread_current ();
+  for (;;) 
+    {
+      struct work *w;
+
+      intr_disable ();
+      while (list_empty (&wq->items)) 
+        {
+          wq->waiting = true;
+          thread_block ();
+        }
+      w = list_entry (list_pop_front (&wq->items), struct work, elem);
+      w->pending = false;
+      wq->run_cnt++;
+      intr_enable ();
+
+      w->func (w->aux);
+    }
+}
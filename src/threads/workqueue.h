@@ -0,0 +1,37 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+
+/** Work queues, one per priority, each served by a kernel
+   thread of that priority. */
+enum work_priority
+  {
+    WORK_HIGH,                  /**< Runs at PRI_MAX. */
+    WORK_NORMAL,                /**< Runs at PRI_DEFAULT. */
+    WORK_PRIORITY_CNT
+  };
+
+/** A function to run later, in a worker thread. */
+typedef void work_func (void *aux);
+
+/** An item of deferred work.  The owner allocates it, usually
+   statically, and initializes it with work_init().  It is queued
+   at most once at a time, so queuing it again before it runs
+   does nothing: the function must handle everything that has
+   accumulated by the time it runs. */
+struct work
+  {
+    struct list_elem elem;      /**< Element in a work queue. */
+    work_func *func;            /**< Function to call. */
+    void *aux;                  /**< Argument to pass to it. */
+    bool pending;               /**< Queued but not yet started? */
+  };
+
+void workqueue_init (void);
+void work_init (struct work *, work_func *, void *aux);
+void work_queue (enum work_priority, struct work *);
+void workqueue_print_stats (void);
+
+#endif /**< threads/workqueue.h */
@@ -1,15 +1,21 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include "userprog/fpu.h"
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /** Number of page faults processed. */
 static long long page_fault_cnt;
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void device_not_available (struct intr_frame *);
 
 /** Registers handlers for interrupts that can be caused by user
    programs.
@@ -20,9 +26,10 @@ static void page_fault (struct intr_frame *);
    signals.  Instead, we'll make them simply kill the user
    process.
 
-   Page faults are an exception.  Here they are treated the same
-   way as other exceptions, but this will need to change to
-   implement virtual memory.
+   Page faults are an exception.  With virtual memory, a fault
+   on a page that is part of the process's address space but not
+   yet in memory brings it in; other page faults are treated the
+   same way as other exceptions.
 
    Refer to [IA32-v3a] section 5.15 "Exception and Interrupt
    Reference" for a description of each of these exceptions. */
@@ -45,7 +52,7 @@ exception_init (void)
   intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
   intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
   intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-  intr_register_int (7, 0, INTR_ON, kill,
+  intr_register_int (7, 0, INTR_ON, device_not_available,
                      "#NM Device Not Available Exception");
   intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
   intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
@@ -58,6 +65,10 @@ exception_init (void)
      We need to disable interrupts for page faults because the
      fault address is stored in CR2 and needs to be preserved. */
   intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
+
+  /* The FPU is switched lazily, with #NM telling us when a
+     process first uses it after a thread switch.  See fpu.c. */
+  fpu_init ();
 }
 
 /** Prints exception statistics. */
@@ -148,9 +159,19 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in the page that FAULT_ADDR refers to, if it is part of
+     the process's address space, or copy it if it is shared
+     after fork().  A fault in the kernel, while it accesses user
+     memory on the process's behalf, does not tell us the user
+     stack pointer, so it cannot grow the stack. */
+  if (is_user_vaddr (fault_addr) && thread_current ()->pagedir != NULL
+      && (not_present
+          ? page_handle_fault (fault_addr, write, user ? f->esp : NULL)
+          : write && page_handle_cow (fault_addr)))
+    return;
+#endif
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
@@ -159,3 +180,14 @@ page_fault (struct intr_frame *f)
   kill (f);
 }
 
+
+/** Device-not-available (#NM) handler.  A user process used the
+   FPU while this CPU's FPU registers belonged to another thread,
+   so switch them over.  Kernel code never uses the FPU, so #NM
+   in the kernel is a bug. */
+static void
+device_not_available (struct intr_frame *f) 
+{
+  if (f->cs != SEL_UCSEG || !fpu_trap ())
+    kill (f);
+}
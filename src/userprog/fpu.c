@@ -0,0 +1,283 @@
+#include "userprog/fpu.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+
+/** Lazy floating-point context switching.
+
+   The kernel itself is compiled with -msoft-float and never
+   touches the x87 FPU or the SSE registers, so their contents
+   only matter to user processes, and only to those that use
+   them.  Instead of saving and restoring them on every thread
+   switch, each CPU leaves them alone and records the thread that
+   they belong to, its `fpu_owner'.
+
+   Whenever any other thread is switched in, fpu_activate() sets
+   the task-switched (TS) flag in CR0, so that its first
+   floating-point instruction raises a device-not-available (#NM)
+   exception.  The handler in exception.c then calls fpu_trap(),
+   which clears TS, saves the owner's registers into the owner's
+   save area, loads the running thread's (or initializes them,
+   the first time), and makes it the owner.  A switch to the
+   owner just clears TS.  Thus switching among threads that do
+   not use floating point costs nothing but a CR0 update, and a
+   thread that does use it pays for a save and restore only when
+   another thread used it in between.
+
+   Each thread's save area is allocated the first time it uses
+   floating point.  On a multiprocessor, a thread's registers may
+   be held by the CPU that it last ran on, so thread.c does not
+   let other CPUs steal it while it is that CPU's `fpu_owner'.
+
+   Refer to [IA32-v3a] 12.5 "Designing OS Facilities for
+   Automatically Saving x87 FPU, MMX, and SSE State". */
+
+/** CR0 flags. */
+#define CR0_MP 0x00000002       /**< Monitor coprocessor. */
+#define CR0_EM 0x00000004       /**< (Floating-point) emulation. */
+#define CR0_TS 0x00000008       /**< Task switched. */
+#define CR0_NE 0x00000020       /**< Numeric error reporting. */
+
+/** CR4 flags. */
+#define CR4_OSFXSR 0x00000200   /**< FXSAVE/FXRSTOR save SSE state. */
+#define CR4_OSXMMEXCPT 0x00000400 /**< Unmasked SSE errors raise #XF. */
+
+/** Size of the area saved by FXSAVE, which must be 16-byte
+   aligned.  FNSAVE, used on CPUs without FXSAVE, needs only 108
+   bytes. */
+#define FPU_AREA_SIZE 512
+
+/** Default MXCSR: all SIMD exceptions masked. */
+#define MXCSR_DEFAULT 0x1f80
+
+/** A thread's saved floating-point registers. */
+struct fpu_state
+  {
+    bool saved;                         /**< Has `area' been saved into? */
+    uint8_t buf[FPU_AREA_SIZE + 15];    /**< Save area, once aligned. */
+  };
+
+/** Object cache for save areas, which malloc() would round up
+   to 1 kB. */
+static struct kmem_cache *fpu_cache;
+
+/** Does the CPU support FXSAVE?  SSE? */
+static bool has_fxsr, has_sse;
+
+/** Statistics. */
+static long long trap_cnt;      /**< # of #NM exceptions handled. */
+static long long save_cnt;      /**< # of FPU states saved. */
+
+/** Returns the 16-byte aligned save area in FS. */
+static inline void *
+fpu_area (struct fpu_state *fs)
+{
+  return (void *) ROUND_UP ((uintptr_t) fs->buf, 16);
+}
+
+static inline uint32_t
+read_cr0 (void)
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+static inline void
+write_cr0 (uint32_t cr0)
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0));
+}
+
+/** Enables the FPU on the running CPU for lazy switching: turns
+   off emulation, which start.S enabled, turns on SSE if the CPU
+   has it, and sets TS, so that the first floating-point
+   instruction traps.  Called once by each CPU. */
+void
+fpu_init (void)
+{
+  uint32_t features = cpuid_edx (1);
+
+  if (fpu_cache == NULL)
+    fpu_cache = kmem_cache_create ("fpu", sizeof (struct fpu_state), NULL);
+  has_fxsr = (features & CPUID_FXSR) != 0;
+  has_sse = has_fxsr && (features & CPUID_SSE) != 0;
+  if (has_fxsr)
+    {
+      uint32_t cr4;
+
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_OSFXSR | (has_sse ? CR4_OSXMMEXCPT : 0);
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
+  write_cr0 ((read_cr0 () & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+}
+
+/** Sets up the FPU for the thread just switched in: if its
+   registers are already loaded, lets it use them without a
+   trap, otherwise arranges for its first use to trap.  Called
+   on every thread switch, with interrupts off. */
+void
+fpu_activate (void)
+{
+  struct thread *cur = thread_current ();
+  uint32_t cr0 = read_cr0 ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (cpu_current ()->fpu_owner == cur)
+    {
+      if (cr0 & CR0_TS)
+        asm volatile ("clts");
+    }
+  else if (!(cr0 & CR0_TS))
+    write_cr0 (cr0 | CR0_TS);
+}
+
+/** Saves the FPU registers into thread T's save area. */
+static void
+fpu_save (struct thread *t)
+{
+  void *area = fpu_area (t->fpu);
+
+  if (has_fxsr)
+    asm volatile ("fxsave %0" : "=m" (*(uint8_t (*)[FPU_AREA_SIZE]) area));
+  else
+    asm volatile ("fnsave %0; fwait"
+                  : "=m" (*(uint8_t (*)[FPU_AREA_SIZE]) area));
+  t->fpu->saved = true;
+  save_cnt++;
+}
+
+/** Loads the FPU registers from thread T's save area, or puts
+   them in their initial state if T has never used them. */
+static void
+fpu_load (struct thread *t)
+{
+  void *area = fpu_area (t->fpu);
+
+  if (!t->fpu->saved)
+    {
+      uint32_t mxcsr = MXCSR_DEFAULT;
+
+      asm volatile ("fninit");
+      if (has_sse)
+        asm volatile ("ldmxcsr %0" : : "m" (mxcsr));
+    }
+  else if (has_fxsr)
+    asm volatile ("fxrstor %0" : : "m" (*(uint8_t (*)[FPU_AREA_SIZE]) area));
+  else
+    asm volatile ("frstor %0" : : "m" (*(uint8_t (*)[FPU_AREA_SIZE]) area));
+}
+
+/** Handles a device-not-available (#NM) exception raised by the
+   running thread's use of floating point while TS was set, by
+   giving it the FPU.  Returns true if successful, false if its
+   save area could not be allocated.  Must be called with
+   interrupts on, since allocation may sleep. */
+bool
+fpu_trap (void)
+{
+  struct thread *cur = thread_current ();
+  struct cpu *c;
+  enum intr_level old_level;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  if (cur->fpu == NULL)
+    {
+      cur->fpu = kmem_cache_alloc (fpu_cache);
+      if (cur->fpu == NULL)
+        return false;
+      cur->fpu->saved = false;
+    }
+
+  old_level = intr_disable ();
+  c = cpu_current ();
+  asm volatile ("clts");
+  if (c->fpu_owner != cur)
+    {
+      if (c->fpu_owner != NULL)
+        fpu_save (c->fpu_owner);
+      fpu_load (cur);
+      c->fpu_owner = cur;
+    }
+  trap_cnt++;
+  intr_set_level (old_level);
+  return true;
+}
+
+/** Frees the running thread's floating-point state.  Called when
+   a process exits. */
+void
+fpu_release (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (cpu_current ()->fpu_owner == cur)
+    {
+      cpu_current ()->fpu_owner = NULL;
+      fpu_activate ();
+    }
+  intr_set_level (old_level);
+
+  kmem_cache_free (fpu_cache, cur->fpu);
+  cur->fpu = NULL;
+}
+
+/** Stores in *COPY a copy of the running thread's floating-point
+   state, for fork(), or a null pointer if it has never used
+   floating point.  The copy belongs to no thread until it is
+   assigned to one's `fpu' member, and must be freed with
+   fpu_free() if it never is.  Returns true if successful, false
+   if out of memory. */
+bool
+fpu_copy (struct fpu_state **copy)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  *copy = NULL;
+  if (cur->fpu == NULL)
+    return true;
+  *copy = kmem_cache_alloc (fpu_cache);
+  if (*copy == NULL)
+    return false;
+
+  /* If the registers are live on this CPU, TS is clear, so they
+     can be saved without a trap. */
+  old_level = intr_disable ();
+  if (cpu_current ()->fpu_owner == cur)
+    fpu_save (cur);
+  intr_set_level (old_level);
+
+  /* The two save areas need not have the same alignment within
+     their buffers. */
+  (*copy)->saved = cur->fpu->saved;
+  memcpy (fpu_area (*copy), fpu_area (cur->fpu), FPU_AREA_SIZE);
+  return true;
+}
+
+/** Frees COPY, a copy of floating-point state made by fpu_copy()
+   that was never given to a thread.  COPY may be a null
+   pointer. */
+void
+fpu_free (struct fpu_state *copy)
+{
+  kmem_cache_free (fpu_cache, copy);
+}
+
+/** Prints floating-point statistics. */
+void
+fpu_print_stats (void)
+{
+  printf ("FPU: %lld traps, %lld context saves\n", trap_cnt, save_cnt);
+}
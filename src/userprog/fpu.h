@@ -0,0 +1,16 @@
+#ifndef USERPROG_FPU_H
+#define USERPROG_FPU_H
+
+#include <stdbool.h>
+
+struct fpu_state;
+
+void fpu_init (void);
+void fpu_activate (void);
+bool fpu_trap (void);
+void fpu_release (void);
+bool fpu_copy (struct fpu_state **);
+void fpu_free (struct fpu_state *);
+void fpu_print_stats (void);
+
+#endif /**< userprog/fpu.h */
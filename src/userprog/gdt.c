@@ -1,6 +1,7 @@
 #include "userprog/gdt.h"
 #include <debug.h>
 #include "userprog/tss.h"
+#include "threads/cpu.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
@@ -36,6 +37,7 @@ void
 gdt_init (void)
 {
   uint64_t gdtr_operand;
+  int i;
 
   /* Initialize GDT. */
   gdt[SEL_NULL / sizeof *gdt] = 0;
@@ -43,7 +45,8 @@ gdt_init (void)
   gdt[SEL_KDSEG / sizeof *gdt] = make_data_desc (0);
   gdt[SEL_UCSEG / sizeof *gdt] = make_code_desc (3);
   gdt[SEL_UDSEG / sizeof *gdt] = make_data_desc (3);
-  gdt[SEL_TSS / sizeof *gdt] = make_tss_desc (tss_get ());
+  for (i = 0; i < CPU_MAX; i++)
+    gdt[SEL_TSS_CPU (i) / sizeof *gdt] = make_tss_desc (tss_get (i));
 
   /* Load GDTR, TR.  See [IA32-v3a] 2.4.1 "Global Descriptor
      Table Register (GDTR)", 2.4.4 "Task Register (TR)", and
@@ -52,6 +55,14 @@ gdt_init (void)
   asm volatile ("lgdt %0" : : "m" (gdtr_operand));
   asm volatile ("ltr %w0" : : "q" (SEL_TSS));
 }
+
+/** Loads the running application processor's TSS.  The processor
+   already uses the GDT set up by gdt_init(). */
+void
+gdt_init_ap (void)
+{
+  asm volatile ("ltr %w0" : : "q" (SEL_TSS_CPU (cpu_current ()->id)));
+}
 
 /** System segment or code/data segment? */
 enum seg_class
@@ -1,15 +1,20 @@
 #ifndef USERPROG_GDT_H
 #define USERPROG_GDT_H
 
+#include "threads/cpu.h"
 #include "threads/loader.h"
 
 /** Segment selectors.
    More selectors are defined by the loader in loader.h. */
 #define SEL_UCSEG       0x1B    /**< User code selector. */
 #define SEL_UDSEG       0x23    /**< User data selector. */
-#define SEL_TSS         0x28    /**< Task-state segment. */
-#define SEL_CNT         6       /**< Number of segments. */
+#define SEL_TSS         0x28    /**< Task-state segment of CPU 0. */
+#define SEL_CNT         (5 + CPU_MAX) /**< Number of segments. */
+
+/** Task-state segment of the CPU whose id is CPU. */
+#define SEL_TSS_CPU(CPU) (SEL_TSS + 8 * (CPU))
 
 void gdt_init (void);
+void gdt_init_ap (void);
 
 #endif /**< userprog/gdt.h */
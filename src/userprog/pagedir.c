@@ -1,13 +1,54 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
-static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+/** Address space switching.
+
+   Each CPU records the page directory that is loaded in its CR3
+   as its `pagedir'.  process_activate() loads a process's page
+   directory only if it is not already loaded, and does not load
+   any page directory at all for a kernel thread, which has no
+   user address space and so runs on whatever page directory the
+   CPU had loaded.  Thus a switch from a process to a kernel
+   thread, such as the idle thread, and back costs no CR3 load
+   and keeps the process's TLB entries.
+
+   The price is that a page directory may still be loaded on
+   some CPU after its process has exited.  pagedir_destroy()
+   frees its user mappings at once, but keeps the page directory
+   itself as a "zombie" until every CPU has switched away from
+   it.
+
+   When a mapping in a page directory changes, the running CPU
+   invalidates just the affected pages with INVLPG, if it has the
+   page directory loaded.  Any other CPU that has it loaded is
+   marked `tlb_stale', so that it reloads CR3 the next time it
+   switches to a process, even the same one.  (This does not
+   cover a CPU that is running the process at that moment, but
+   for now only a process changes its own mappings while it
+   runs.) */
+
+/** Range operations on more pages than this flush the whole TLB
+   instead of invalidating the pages one by one. */
+#define INVLPG_MAX 32
+
+/** Destroyed page directories still loaded on some CPU. */
+static uint32_t *zombies[CPU_MAX];
+
+/** Statistics. */
+static long long load_cnt;      /**< # of CR3 loads. */
+static long long skip_cnt;      /**< # of CR3 loads avoided. */
+static long long invlpg_cnt;    /**< # of pages invalidated one by one. */
+
+static bool is_loaded (uint32_t *);
+static void invalidate_pages (uint32_t *, const void *upage, size_t cnt);
 
 /** Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -29,10 +70,14 @@ pagedir_destroy (uint32_t *pd)
 {
   uint32_t *pde;
 
+  enum intr_level old_level;
+  size_t i;
+
   if (pd == NULL)
     return;
 
   ASSERT (pd != init_page_dir);
+  ASSERT (cpu_current ()->pagedir != pd);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
     if (*pde & PTE_P) 
       {
@@ -41,10 +86,62 @@ pagedir_destroy (uint32_t *pd)
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
+            palloc_free_frame (pte_get_frame (*pte));
+        *pde = 0;
         palloc_free_page (pt);
       }
-  palloc_free_page (pd);
+
+  /* Free PD itself unless another CPU still has it loaded.  It
+     now maps the kernel only, so that CPU may keep using it
+     until it switches to a process. */
+  old_level = intr_disable ();
+  if (!is_loaded (pd))
+    palloc_free_page (pd);
+  else
+    {
+      for (i = 0; zombies[i] != NULL; i++)
+        ASSERT (i + 1 < CPU_MAX);
+      zombies[i] = pd;
+    }
+  intr_set_level (old_level);
+}
+
+/** Returns true if some CPU has PD loaded. */
+static bool
+is_loaded (uint32_t *pd) 
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (cpus[i].pagedir == pd)
+      return true;
+  return false;
+}
+
+/** Frees PD, which the running CPU just switched away from, if it
+   is a zombie that no other CPU has loaded. */
+static void
+release_zombie (uint32_t *pd) 
+{
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < CPU_MAX && zombies[i] != NULL; i++)
+    if (zombies[i] == pd) 
+      {
+        if (!is_loaded (pd)) 
+          {
+            /* Keep zombies[] packed at the front. */
+            for (; i + 1 < CPU_MAX && zombies[i + 1] != NULL; i++)
+              zombies[i] = zombies[i + 1];
+            zombies[i] = NULL;
+            palloc_free_page (pd);
+          }
+        break;
+      }
 }
 
 /** Returns the address of the page table entry for virtual
@@ -79,6 +176,8 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
       else
         return NULL;
     }
+  else if (*pde & PTE_PS)
+    return NULL;                /* 4 MB kernel page: no page table. */
 
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
@@ -97,13 +196,30 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
    failed. */
 bool
 pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+  ASSERT (pg_ofs (kpage) == 0);
+  return pagedir_set_frame (pd, upage, vtop (kpage), writable);
+}
+
+/** Adds a mapping in page directory PD from user virtual page
+   UPAGE to the physical frame at PADDR, which may be in high
+   memory.
+   UPAGE must not already be mapped.
+   PADDR should probably be a frame obtained with
+   palloc_get_frame (PAL_USER).
+   If WRITABLE is true, the new page is read/write;
+   otherwise it is read-only.
+   Returns true if successful, false if memory allocation
+   failed. */
+bool
+pagedir_set_frame (uint32_t *pd, void *upage, uintptr_t paddr, bool writable)
 {
   uint32_t *pte;
 
   ASSERT (pg_ofs (upage) == 0);
-  ASSERT (pg_ofs (kpage) == 0);
+  ASSERT (paddr % PGSIZE == 0);
   ASSERT (is_user_vaddr (upage));
-  ASSERT (vtop (kpage) >> PTSHIFT < init_ram_pages);
+  ASSERT (paddr >> PTSHIFT < init_ram_pages);
   ASSERT (pd != init_page_dir);
 
   pte = lookup_page (pd, upage, true);
@@ -111,7 +227,7 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
   if (pte != NULL) 
     {
       ASSERT ((*pte & PTE_P) == 0);
-      *pte = pte_create_user (kpage, writable);
+      *pte = pte_create_frame (paddr, writable);
       return true;
     }
   else
@@ -121,9 +237,21 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
 /** Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
-   UADDR is unmapped. */
+   UADDR is unmapped.  The frame must be in low memory; use
+   pagedir_get_frame() for a frame that may not be. */
 void *
 pagedir_get_page (uint32_t *pd, const void *uaddr) 
+{
+  uintptr_t paddr = pagedir_get_frame (pd, uaddr);
+
+  return paddr != 0 ? ptov (paddr) : NULL;
+}
+
+/** Looks up the physical address that corresponds to user virtual
+   address UADDR in PD.  Returns that physical address, or 0 if
+   UADDR is unmapped. */
+uintptr_t
+pagedir_get_frame (uint32_t *pd, const void *uaddr) 
 {
   uint32_t *pte;
 
@@ -131,9 +259,9 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
   
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
-    return pte_get_page (*pte) + pg_ofs (uaddr);
+    return pte_get_frame (*pte) + pg_ofs (uaddr);
   else
-    return NULL;
+    return 0;
 }
 
 /** Marks user virtual page UPAGE "not present" in page
@@ -152,8 +280,44 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_pages (pd, upage, 1);
+    }
+}
+
+/** Marks the PAGE_CNT user virtual pages starting at UPAGE "not
+   present" in page directory PD, as pagedir_clear_page() does
+   for each one, but invalidates the TLB just once for the whole
+   range.  The pages need not be mapped. */
+void
+pagedir_clear_pages (uint32_t *pd, void *upage, size_t page_cnt) 
+{
+  uint8_t *page = upage;
+  bool changed = false;
+  size_t i;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (page_cnt <= (size_t) ((uint8_t *) PHYS_BASE - page) / PGSIZE);
+
+  for (i = 0; i < page_cnt; i++) 
+    {
+      uint32_t *pte = lookup_page (pd, page + i * PGSIZE, false);
+      if (pte != NULL && (*pte & PTE_P) != 0) 
+        {
+          *pte &= ~PTE_P;
+          changed = true;
+        }
     }
+  if (changed)
+    invalidate_pages (pd, upage, page_cnt);
+}
+
+/** Returns true if virtual page VPAGE is mapped in PD and the
+   mapping is writable. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_W)) == (PTE_P | PTE_W);
 }
 
 /** Returns true if the PTE for virtual page VPAGE in PD is dirty,
@@ -180,7 +344,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_pages (pd, vpage, 1);
         }
     }
 }
@@ -209,55 +373,124 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_pages (pd, vpage, 1);
         }
     }
 }
 
-/** Loads page directory PD into the CPU's page directory base
-   register. */
+/** Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD.  Making a page writable needs no TLB
+   invalidation, since a write through a stale read-only entry
+   just faults, which invalidates the entry. */
 void
-pagedir_activate (uint32_t *pd) 
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable) 
 {
-  if (pd == NULL)
-    pd = init_page_dir;
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL) 
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else 
+        {
+          *pte &= ~(uint32_t) PTE_W;
+          invalidate_pages (pd, vpage, 1);
+        }
+    }
+}
 
-  /* Store the physical address of the page directory into CR3
-     aka PDBR (page directory base register).  This activates our
-     new page tables immediately.  See [IA32-v2a] "MOV--Move
-     to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
-     Address of the Page Directory". */
+/** Loads the physical address of page directory PD into CR3 aka
+   PDBR (page directory base register).  This activates its page
+   tables immediately and flushes the TLB of all but global
+   entries.  See [IA32-v2a] "MOV--Move to/from Control
+   Registers" and [IA32-v3a] 3.7.5 "Base Address of the Page
+   Directory". */
+static inline void
+load_cr3 (uint32_t *pd) 
+{
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
 }
 
-/** Returns the currently active page directory. */
-static uint32_t *
-active_pd (void) 
+/** Makes page directory PD the running CPU's active page
+   directory, or the kernel-only page directory if PD is a null
+   pointer.  Does not load CR3 if PD is already loaded and the
+   TLB has nothing stale in it. */
+void
+pagedir_activate (uint32_t *pd) 
 {
-  /* Copy CR3, the page directory base register (PDBR), into
-     `pd'.
-     See [IA32-v2a] "MOV--Move to/from Control Registers" and
-     [IA32-v3a] 3.7.5 "Base Address of the Page Directory". */
-  uintptr_t pd;
-  asm volatile ("movl %%cr3, %0" : "=r" (pd));
-  return ptov (pd);
+  enum intr_level old_level;
+  struct cpu *c;
+
+  if (pd == NULL)
+    pd = init_page_dir;
+
+  old_level = intr_disable ();
+  c = cpu_current ();
+  if (c->pagedir != pd || c->tlb_stale) 
+    {
+      uint32_t *old = c->pagedir;
+
+      load_cr3 (pd);
+      c->pagedir = pd;
+      c->tlb_stale = false;
+      load_cnt++;
+      if (old != pd)
+        release_zombie (old);
+    }
+  else
+    skip_cnt++;
+  intr_set_level (old_level);
 }
 
-/** Seom page table changes can cause the CPU's translation
+/** Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
-
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   table.  This function brings the TLB up to date after a
+   change to the PAGE_CNT pages starting at user virtual address
+   UPAGE in PD, by invalidating each of them in the running CPU's
+   TLB, or flushing it entirely if there are more than INVLPG_MAX
+   of them, if PD is loaded here, and by marking the TLB of any
+   other CPU that has PD loaded as stale.  (If no CPU has PD
+   loaded then its entries are not in any TLB, so there is no
+   need to invalidate anything.)  See [IA32-v3a] 3.12
+   "Translation Lookaside Buffers (TLBs)". */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_pages (uint32_t *pd, const void *upage, size_t page_cnt) 
 {
-  if (active_pd () == pd) 
+  enum intr_level old_level;
+  struct cpu *self;
+  int i;
+
+  old_level = intr_disable ();
+  self = cpu_current ();
+  for (i = 0; i < cpu_cnt; i++) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
+      struct cpu *c = &cpus[i];
+
+      if (c->pagedir != pd)
+        continue;
+      else if (c != self)
+        c->tlb_stale = true;
+      else if (page_cnt > INVLPG_MAX) 
+        {
+          load_cr3 (pd);
+          load_cnt++;
+        }
+      else 
+        {
+          const uint8_t *page = upage;
+          size_t j;
+
+          for (j = 0; j < page_cnt; j++)
+            asm volatile ("invlpg (%0)" : : "r" (page + j * PGSIZE) : "memory");
+          invlpg_cnt += page_cnt;
+        }
+    }
+  intr_set_level (old_level);
+}
+
+/** Prints page directory statistics. */
+void
+pagedir_print_stats (void) 
+{
+  printf ("Paging: %lld CR3 loads, %lld avoided, %lld pages invalidated\n",
+          load_cnt, skip_cnt, invlpg_cnt);
 }
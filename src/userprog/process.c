@@ -5,8 +5,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/fpu.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -14,55 +16,142 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/kmap.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
+
+/** What a process shares with its parent, so that the parent
+   can wait for it to exit and get its exit status.  It stays
+   around until both of them are done with it: the process when it
+   exits, and the parent when it waits for the process or exits
+   itself.  `ref_cnt' is protected by turning off interrupts. */
+struct child
+  {
+    struct list_elem elem;              /**< Element in parent's `children'. */
+    tid_t tid;                          /**< Child's thread id. */
+    int exit_status;                    /**< Status passed to exit(). */
+    struct semaphore exited;            /**< Upped when child exits. */
+    int ref_cnt;                        /**< 2 if both hold it, else 1. */
+  };
+
+/** What process_execute() passes to the process it starts. */
+struct exec_info
+  {
+    char *cmd_line;                     /**< Command line, in a page. */
+    struct child *child;                /**< Shared with the parent. */
+    struct semaphore loaded;            /**< Upped when load is done. */
+    bool success;                       /**< Did it load? */
+  };
 
+static struct child *child_create (void);
+static void child_release (struct child *);
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static bool push_args (const char *cmd_line, void **esp);
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+static bool copy_process (struct thread *parent);
 
-/** Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+/** What process_fork() passes to the child it creates. */
+struct fork_info
+  {
+    struct thread *parent;              /**< Process being forked. */
+    struct intr_frame if_;              /**< Parent's user registers. */
+    struct fpu_state *fpu;              /**< Copy of parent's FPU state. */
+    struct child *child;                /**< Shared with the parent. */
+    struct semaphore done;              /**< Upped when child is set up. */
+    bool success;                       /**< Did the child start? */
+  };
+#endif
+
+/** Starts a new thread running a user program loaded from the
+   first word of CMD_LINE, and passes it the words of CMD_LINE,
+   separated by spaces, as arguments.  Waits for the program to
+   load, but the new process may run (and may even exit) before
+   process_execute() returns.  Returns the new process's thread
+   id, or TID_ERROR if the thread cannot be created or the
+   program cannot be loaded. */
 tid_t
-process_execute (const char *file_name) 
+process_execute (const char *cmd_line) 
 {
-  char *fn_copy;
+  struct exec_info info;
+  char name[16];
   tid_t tid;
 
-  /* Make a copy of FILE_NAME.
+  /* Make a copy of CMD_LINE.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  info.cmd_line = palloc_get_page (0);
+  if (info.cmd_line == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
-
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
-  if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+  strlcpy (info.cmd_line, cmd_line, PGSIZE);
+  info.child = child_create ();
+  if (info.child == NULL) 
+    {
+      palloc_free_page (info.cmd_line);
+      return TID_ERROR;
+    }
+  sema_init (&info.loaded, 0);
+  info.success = false;
+
+  /* Name the thread after the program.  File names are shorter
+     than thread names, so start_process() loads the program by
+     its thread name. */
+  while (*cmd_line == ' ')
+    cmd_line++;
+  strlcpy (name, cmd_line, sizeof name);
+  name[strcspn (name, " ")] = '\0';
+
+  /* Create a new thread to execute CMD_LINE. */
+  tid = thread_create (name, PRI_DEFAULT, start_process, &info);
+  if (tid != TID_ERROR)
+    sema_down (&info.loaded);
+  palloc_free_page (info.cmd_line);
+  if (tid == TID_ERROR) 
+    {
+      free (info.child);
+      return TID_ERROR;
+    }
+  if (!info.success) 
+    {
+      child_release (info.child);
+      return TID_ERROR;
+    }
+  info.child->tid = tid;
+  list_push_back (&thread_current ()->children, &info.child->elem);
   return tid;
 }
 
-/** A thread function that loads a user process and starts it
-   running. */
+/** A thread function that loads a user program according to
+   INFO_, a struct exec_info, and starts it running. */
 static void
-start_process (void *file_name_)
+start_process (void *info_)
 {
-  char *file_name = file_name_;
+  struct exec_info *info = info_;
+  struct thread *cur = thread_current ();
   struct intr_frame if_;
   bool success;
 
+  cur->child = info->child;
+  fd_table_init ();
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = (load (cur->name, &if_.eip, &if_.esp)
+             && push_args (info->cmd_line, &if_.esp));
 
-  /* If load failed, quit. */
-  palloc_free_page (file_name);
+  /* INFO is gone once the parent wakes up. */
+  info->success = success;
+  sema_up (&info->loaded);
   if (!success) 
     thread_exit ();
 
@@ -76,21 +165,154 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/** Starts a new process that is a copy of the running one, whose
+   user registers at the time of the system call are in IF_.  The
+   child returns to user mode with those same registers, except
+   that its EAX is 0.  Its address space is the parent's, shared
+   copy-on-write (see page.c), but without the parent's
+   memory-mapped files.  It also gets a copy of the parent's
+   floating-point registers, its open files, and its priority.
+   The parent can wait for it like a child that it exec()'d.
+   Returns the child's thread id, or TID_ERROR if it could not be
+   created. */
+tid_t
+process_fork (const struct intr_frame *if_) 
+{
+  struct fork_info info;
+  tid_t tid;
+
+  info.parent = thread_current ();
+  info.if_ = *if_;
+  sema_init (&info.done, 0);
+  info.success = false;
+  info.child = child_create ();
+  if (info.child == NULL)
+    return TID_ERROR;
+  if (!fpu_copy (&info.fpu)) 
+    {
+      free (info.child);
+      return TID_ERROR;
+    }
+
+  /* The child copies our address space, which must not change
+     until it is done, so wait for it. */
+  tid = thread_create (info.parent->name, thread_get_priority (),
+                       start_fork, &info);
+  if (tid == TID_ERROR) 
+    {
+      fpu_free (info.fpu);
+      free (info.child);
+      return TID_ERROR;
+    }
+  sema_down (&info.done);
+  if (!info.success) 
+    {
+      child_release (info.child);
+      return TID_ERROR;
+    }
+  info.child->tid = tid;
+  list_push_back (&info.parent->children, &info.child->elem);
+  return tid;
+}
+
+/** A thread function that makes a copy of the process that
+   process_fork() was called in, according to INFO_, a struct
+   fork_info, and starts it running. */
+static void
+start_fork (void *info_) 
+{
+  struct fork_info *info = info_;
+  struct intr_frame if_ = info->if_;
+  bool success;
+
+  /* process_exit() frees these if the copy fails. */
+  thread_current ()->fpu = info->fpu;
+  thread_current ()->child = info->child;
+  fd_table_init ();
+  success = copy_process (info->parent);
+
+  /* INFO is gone once the parent wakes up. */
+  info->success = success;
+  sema_up (&info->done);
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/** Gives the running thread a copy of PARENT's address space,
+   executable, and open files.  Returns true if successful, false
+   otherwise, in which case process_exit() frees whatever was
+   copied. */
+static bool
+copy_process (struct thread *parent) 
+{
+  struct thread *t = thread_current ();
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    return false;
+  if (!page_table_create ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      return false;
+    }
+  mmap_table_init ();
+  process_activate ();
+
+  t->exec_file = file_reopen (parent->exec_file);
+  if (t->exec_file == NULL)
+    return false;
+  file_deny_write (t->exec_file);
+  return page_table_copy (parent) && fd_table_copy (parent);
+}
+#endif
+
 /** Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
+  struct list *children = &thread_current ()->children;
+  struct list_elem *e;
+
+  for (e = list_begin (children); e != list_end (children); e = list_next (e)) 
+    {
+      struct child *c = list_entry (e, struct child, elem);
+      if (c->tid == child_tid) 
+        {
+          int status;
+
+          sema_down (&c->exited);
+          status = c->exit_status;
+          list_remove (&c->elem);
+          child_release (c);
+          return status;
+        }
+    }
   return -1;
 }
 
+/** Sets the status that the running process reports to its
+   parent when it exits.  Until this is called, it is -1, as for
+   a process that the kernel kills. */
+void
+process_set_exit_status (int status) 
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->child != NULL)
+    cur->child->exit_status = status;
+}
+
 /** Free the current process's resources. */
 void
 process_exit (void)
@@ -98,6 +320,33 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  /* Report the exit, but only for a user process, not for a
+     kernel thread. */
+  if (cur->child != NULL) 
+    {
+      printf ("%s: exit(%d)\n", cur->name, cur->child->exit_status);
+      fd_table_destroy ();
+    }
+
+  /* Its children no longer have a parent to wait for them. */
+  while (!list_empty (&cur->children))
+    child_release (list_entry (list_pop_front (&cur->children),
+                               struct child, elem));
+
+  /* Give up the FPU. */
+  fpu_release ();
+
+#ifdef VM
+  /* Write back its memory-mapped files and free its pages, which
+     also takes them out of the frame table, while its page
+     directory is still in place. */
+  if (cur->pagedir != NULL) 
+    {
+      mmap_table_destroy ();
+      page_table_destroy ();
+    }
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -114,6 +363,51 @@ process_exit (void)
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+#ifdef VM
+  file_close (cur->exec_file);
+  cur->exec_file = NULL;
+#endif
+
+  /* Now that its memory-mapped files are written back, let the
+     parent know. */
+  if (cur->child != NULL) 
+    {
+      sema_up (&cur->child->exited);
+      child_release (cur->child);
+      cur->child = NULL;
+    }
+}
+
+/** Returns a new `struct child', held by both the parent and the
+   child, or a null pointer if out of memory. */
+static struct child *
+child_create (void) 
+{
+  struct child *c = malloc (sizeof *c);
+
+  if (c != NULL) 
+    {
+      c->tid = TID_ERROR;
+      c->exit_status = -1;
+      sema_init (&c->exited, 0);
+      c->ref_cnt = 2;
+    }
+  return c;
+}
+
+/** Lets go of C, on behalf of either the parent or the child, and
+   frees it if the other one already did. */
+static void
+child_release (struct child *c) 
+{
+  enum intr_level old_level;
+  bool last;
+
+  old_level = intr_disable ();
+  last = --c->ref_cnt == 0;
+  intr_set_level (old_level);
+  if (last)
+    free (c);
 }
 
 /** Sets up the CPU for running user code in the current
@@ -124,12 +418,20 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A kernel thread has no user
+     address space, so it keeps running on the page directory
+     that is already loaded, whichever process that belongs to.
+     See pagedir.c. */
+  if (t->pagedir != NULL)
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
   tss_update ();
+
+  /* Let the thread use the FPU registers without a trap if they
+     are still its own. */
+  fpu_activate ();
 }
 
 /** We load ELF binaries.  The following definitions are taken
@@ -219,6 +521,15 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
+#ifdef VM
+  if (!page_table_create ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto done;
+    }
+  mmap_table_init ();
+#endif
   process_activate ();
 
   /* Open executable file. */
@@ -311,14 +622,27 @@ load (const char *file_name, void (**eip) (void), void **esp)
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. */
+  /* We arrive here whether the load is successful or not.  With
+     demand paging, a loaded executable stays open, and must not
+     change, since its pages are read from it as they are first
+     touched. */
+#ifdef VM
+  if (success)
+    {
+      file_deny_write (file);
+      t->exec_file = file;
+      return true;
+    }
+#endif
   file_close (file);
   return success;
 }
 
 /** load() helpers. */
 
-static bool install_page (void *upage, void *kpage, bool writable);
+#ifndef VM
+static bool install_page (void *upage, uintptr_t frame, bool writable);
+#endif
 
 /** Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -377,6 +701,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With demand paging, the pages are only recorded in the
+   supplemental page table here, and read in by the page fault
+   handler when they are first accessed.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -387,6 +715,21 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  while (read_bytes > 0 || zero_bytes > 0) 
+    {
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+
+      if (!page_add_file (upage, file, ofs, page_read_bytes, writable))
+        return false;
+
+      read_bytes -= page_read_bytes;
+      zero_bytes -= PGSIZE - page_read_bytes;
+      ofs += page_read_bytes;
+      upage += PGSIZE;
+    }
+  return true;
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -396,23 +739,27 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-      /* Get a page of memory. */
-      uint8_t *kpage = palloc_get_page (PAL_USER);
-      if (kpage == NULL)
+      /* Get a frame of memory and map it into the kernel. */
+      uintptr_t frame = palloc_get_frame (PAL_USER);
+      uint8_t *kpage;
+      if (frame == 0)
         return false;
+      kpage = kmap (frame);
 
       /* Load this page. */
       if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
         {
-          palloc_free_page (kpage);
+          kunmap (kpage);
+          palloc_free_frame (frame);
           return false; 
         }
       memset (kpage + page_read_bytes, 0, page_zero_bytes);
+      kunmap (kpage);
 
       /* Add the page to the process's address space. */
-      if (!install_page (upage, kpage, writable)) 
+      if (!install_page (upage, frame, writable)) 
         {
-          palloc_free_page (kpage);
+          palloc_free_frame (frame);
           return false; 
         }
 
@@ -422,44 +769,103 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /** Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory.  With demand paging, the page is only
+   recorded, and below it the stack grows as it is touched. */
 static bool
 setup_stack (void **esp) 
 {
-  uint8_t *kpage;
+#ifdef VM
+  if (!page_add_zero (((uint8_t *) PHYS_BASE) - PGSIZE, true))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
+  uintptr_t frame;
   bool success = false;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (kpage != NULL) 
+  frame = palloc_get_frame (PAL_USER | PAL_ZERO);
+  if (frame != 0) 
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
+      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, frame, true);
       if (success)
         *esp = PHYS_BASE;
       else
-        palloc_free_page (kpage);
+        palloc_free_frame (frame);
     }
   return success;
+#endif
+}
+
+/** Copies CMD_LINE to the top of the stack that setup_stack()
+   created, at *ESP, and pushes below it what _start() in
+   lib/user/entry.c expects: a null array of pointers to the
+   words of CMD_LINE, separated by spaces, a pointer to that
+   array, the number of words, and a null return address.
+   Updates *ESP.  Returns true if successful, false if the
+   arguments do not fit in the stack's first page. */
+static bool
+push_args (const char *cmd_line, void **esp) 
+{
+  uint8_t *bottom = (uint8_t *) PHYS_BASE - PGSIZE;
+  size_t len = strlen (cmd_line) + 1;
+  char *args, *word, *save_ptr, *p;
+  char **argv;
+  uint32_t *sp;
+  int argc;
+
+  if (len > PGSIZE)
+    return false;
+  args = (char *) *esp - len;
+  memcpy (args, cmd_line, len);
+
+  argc = 0;
+  for (word = strtok_r (args, " ", &save_ptr); word != NULL;
+       word = strtok_r (NULL, " ", &save_ptr))
+    argc++;
+  argv = (char **) ((uintptr_t) args & ~(sizeof (char *) - 1)) - (argc + 1);
+  if ((uint8_t *) ((uint32_t *) argv - 3) < bottom)
+    return false;
+
+  /* strtok_r() ended each word with a null terminator and left
+     any other spaces in place, so a word starts wherever one of
+     those is followed by something else. */
+  argc = 0;
+  for (p = args; p < args + len; p++)
+    if (*p != ' ' && *p != '\0'
+        && (p == args || p[-1] == ' ' || p[-1] == '\0'))
+      argv[argc++] = p;
+  argv[argc] = NULL;
+
+  sp = (uint32_t *) argv;
+  *--sp = (uint32_t) argv;
+  *--sp = argc;
+  *--sp = 0;
+  *esp = sp;
+  return true;
 }
 
-/** Adds a mapping from user virtual address UPAGE to kernel
-   virtual address KPAGE to the page table.
+#ifndef VM
+/** Adds a mapping from user virtual address UPAGE to the
+   physical frame at FRAME to the page table.
    If WRITABLE is true, the user process may modify the page;
    otherwise, it is read-only.
    UPAGE must not already be mapped.
-   KPAGE should probably be a page obtained from the user pool
-   with palloc_get_page().
+   FRAME should probably be a frame obtained with
+   palloc_get_frame (PAL_USER).
    Returns true on success, false if UPAGE is already mapped or
    if memory allocation fails. */
 static bool
-install_page (void *upage, void *kpage, bool writable)
+install_page (void *upage, uintptr_t frame, bool writable)
 {
   struct thread *t = thread_current ();
 
   /* Verify that there's not already a page at that virtual
      address, then map our page there. */
-  return (pagedir_get_page (t->pagedir, upage) == NULL
-          && pagedir_set_page (t->pagedir, upage, kpage, writable));
+  return (pagedir_get_frame (t->pagedir, upage) == 0
+          && pagedir_set_frame (t->pagedir, upage, frame, writable));
 }
+#endif
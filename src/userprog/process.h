@@ -3,8 +3,14 @@
 
 #include "threads/thread.h"
 
-tid_t process_execute (const char *file_name);
+struct intr_frame;
+
+tid_t process_execute (const char *cmd_line);
+#ifdef VM
+tid_t process_fork (const struct intr_frame *);
+#endif
 int process_wait (tid_t);
+void process_set_exit_status (int);
 void process_exit (void);
 void process_activate (void);
 
@@ -1,20 +1,453 @@
 #include "userprog/syscall.h"
+#include <list.h>
 #include <stdio.h>
 #include <syscall-nr.h>
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
+
+/** System calls.
+
+   A user process makes a system call with "int $0x30", after
+   pushing the call's arguments and then its number on its stack
+   (see lib/user/syscall.c).  The handler reads them from there
+   and returns the call's value, if any, in EAX.
+
+   Every address that a process passes in, its stack pointer
+   included, is checked before the kernel uses it: each page that
+   it spans must be part of the process's address space, and
+   writable if the kernel will write to it.  A process that
+   passes a bad address exits with status -1.  With virtual
+   memory, the check also grows the stack, as a fault in user
+   mode would, since a fault in the kernel does not tell
+   exception.c the user stack pointer.
+
+   Each process has a list of the files that it has open, each
+   with its own file descriptor.  Descriptors 0 and 1 are the
+   console, so the first file opened gets 2.  A child that
+   fork() creates gets the same descriptors for its own copies of
+   the parent's files.  The file system does no locking of its
+   own, so the calls that use it hold `fs_lock'. */
+
+/** A file that a process has open. */
+struct open_file
+  {
+    struct list_elem elem;      /**< Element in thread's `files'. */
+    int fd;                     /**< File descriptor. */
+    struct file *file;          /**< The file. */
+  };
+
+static struct lock fs_lock;
 
 static void syscall_handler (struct intr_frame *);
+static void sys_exit (int status) NO_RETURN;
+static int sys_open (const char *);
+static int sys_read (struct intr_frame *, int fd, void *, unsigned size);
+static int sys_write (struct intr_frame *, int fd, const void *,
+                      unsigned size);
+static void sys_close (int fd);
+#ifdef VM
+static mapid_t sys_mmap (int fd, void *);
+#endif
+static struct open_file *lookup_fd (int fd);
+static uint32_t arg (struct intr_frame *, int);
+static const char *check_string (struct intr_frame *, const char *);
+static void check_user (struct intr_frame *, const void *, size_t,
+                        bool write);
+static bool is_user_page (struct intr_frame *, const void *, bool write);
 
 void
-syscall_init (void) 
+syscall_init (void)
 {
+  lock_init (&fs_lock);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+syscall_handler (struct intr_frame *f)
+{
+  struct open_file *of;
+
+  switch (arg (f, 0))
+    {
+    case SYS_HALT:
+      shutdown_power_off ();
+
+    case SYS_EXIT:
+      sys_exit (arg (f, 1));
+
+    case SYS_EXEC:
+      f->eax = process_execute (check_string (f, (const char *) arg (f, 1)));
+      break;
+
+    case SYS_WAIT:
+      f->eax = process_wait (arg (f, 1));
+      break;
+
+    case SYS_CREATE:
+      check_string (f, (const char *) arg (f, 1));
+      lock_acquire (&fs_lock);
+      f->eax = filesys_create ((const char *) arg (f, 1), arg (f, 2));
+      lock_release (&fs_lock);
+      break;
+
+    case SYS_REMOVE:
+      check_string (f, (const char *) arg (f, 1));
+      lock_acquire (&fs_lock);
+      f->eax = filesys_remove ((const char *) arg (f, 1));
+      lock_release (&fs_lock);
+      break;
+
+    case SYS_OPEN:
+      f->eax = sys_open (check_string (f, (const char *) arg (f, 1)));
+      break;
+
+    case SYS_FILESIZE:
+      of = lookup_fd (arg (f, 1));
+      if (of == NULL)
+        f->eax = -1;
+      else
+        {
+          lock_acquire (&fs_lock);
+          f->eax = file_length (of->file);
+          lock_release (&fs_lock);
+        }
+      break;
+
+    case SYS_READ:
+      f->eax = sys_read (f, arg (f, 1), (void *) arg (f, 2), arg (f, 3));
+      break;
+
+    case SYS_WRITE:
+      f->eax = sys_write (f, arg (f, 1), (const void *) arg (f, 2),
+                          arg (f, 3));
+      break;
+
+    case SYS_SEEK:
+      of = lookup_fd (arg (f, 1));
+      if (of != NULL)
+        {
+          lock_acquire (&fs_lock);
+          file_seek (of->file, arg (f, 2));
+          lock_release (&fs_lock);
+        }
+      break;
+
+    case SYS_TELL:
+      of = lookup_fd (arg (f, 1));
+      if (of == NULL)
+        f->eax = -1;
+      else
+        {
+          lock_acquire (&fs_lock);
+          f->eax = file_tell (of->file);
+          lock_release (&fs_lock);
+        }
+      break;
+
+    case SYS_CLOSE:
+      sys_close (arg (f, 1));
+      break;
+
+#ifdef VM
+    case SYS_MMAP:
+      f->eax = sys_mmap (arg (f, 1), (void *) arg (f, 2));
+      break;
+
+    case SYS_MUNMAP:
+      lock_acquire (&fs_lock);
+      mmap_unmap (arg (f, 1));
+      lock_release (&fs_lock);
+      break;
+
+    case SYS_FORK:
+      f->eax = process_fork (f);
+      break;
+#endif
+
+    default:
+      sys_exit (-1);
+    }
+}
+
+/** Initializes the running process's table of open files. */
+void
+fd_table_init (void)
+{
+  struct thread *cur = thread_current ();
+
+  list_init (&cur->files);
+  cur->next_fd = 2;
+}
+
+/** Opens each of the files that PARENT has open in the running
+   process, which must have none, with the same file descriptor
+   and at the same position, for fork().  The two processes do not
+   share positions from then on.  PARENT must not run until this
+   returns.  Returns true if successful, false if out of
+   memory. */
+bool
+fd_table_copy (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+  bool success = true;
+
+  lock_acquire (&fs_lock);
+  for (e = list_begin (&parent->files); e != list_end (&parent->files);
+       e = list_next (e))
+    {
+      struct open_file *p = list_entry (e, struct open_file, elem);
+      struct open_file *q = malloc (sizeof *q);
+
+      if (q == NULL)
+        {
+          success = false;
+          break;
+        }
+      q->file = file_reopen (p->file);
+      if (q->file == NULL)
+        {
+          free (q);
+          success = false;
+          break;
+        }
+      file_seek (q->file, file_tell (p->file));
+      q->fd = p->fd;
+      list_push_back (&cur->files, &q->elem);
+    }
+  cur->next_fd = parent->next_fd;
+  lock_release (&fs_lock);
+  return success;
+}
+
+/** Closes all of the running process's open files.  Called when
+   it exits. */
+void
+fd_table_destroy (void)
+{
+  struct list *files = &thread_current ()->files;
+
+  while (!list_empty (files))
+    sys_close (list_entry (list_front (files), struct open_file, elem)->fd);
+}
+
+/** Ends the running process with exit status STATUS. */
+static void
+sys_exit (int status)
 {
-  printf ("system call!\n");
+  process_set_exit_status (status);
   thread_exit ();
 }
+
+/** Opens the file named NAME and returns a new file descriptor
+   for it, or -1 if it cannot be opened. */
+static int
+sys_open (const char *name)
+{
+  struct thread *cur = thread_current ();
+  struct open_file *of;
+
+  of = malloc (sizeof *of);
+  if (of == NULL)
+    return -1;
+  lock_acquire (&fs_lock);
+  of->file = filesys_open (name);
+  lock_release (&fs_lock);
+  if (of->file == NULL)
+    {
+      free (of);
+      return -1;
+    }
+  of->fd = cur->next_fd++;
+  list_push_back (&cur->files, &of->elem);
+  return of->fd;
+}
+
+/** Reads up to SIZE bytes into user BUFFER from file descriptor
+   FD, which may be the keyboard.  Returns the number of bytes
+   read, or -1 if FD is not open. */
+static int
+sys_read (struct intr_frame *f, int fd, void *buffer, unsigned size)
+{
+  struct open_file *of;
+  int bytes_read;
+
+  check_user (f, buffer, size, true);
+  if (fd == STDIN_FILENO)
+    {
+      uint8_t *dst = buffer;
+      unsigned i;
+
+      for (i = 0; i < size; i++)
+        dst[i] = input_getc ();
+      return size;
+    }
+
+  of = lookup_fd (fd);
+  if (of == NULL)
+    return -1;
+  lock_acquire (&fs_lock);
+  bytes_read = file_read (of->file, buffer, size);
+  lock_release (&fs_lock);
+  return bytes_read;
+}
+
+/** Writes SIZE bytes from user BUFFER to file descriptor FD,
+   which may be the console.  Returns the number of bytes
+   written, or -1 if FD is not open. */
+static int
+sys_write (struct intr_frame *f, int fd, const void *buffer, unsigned size)
+{
+  struct open_file *of;
+  int bytes_written;
+
+  check_user (f, buffer, size, false);
+  if (fd == STDOUT_FILENO)
+    {
+      putbuf (buffer, size);
+      return size;
+    }
+
+  of = lookup_fd (fd);
+  if (of == NULL)
+    return -1;
+  lock_acquire (&fs_lock);
+  bytes_written = file_write (of->file, buffer, size);
+  lock_release (&fs_lock);
+  return bytes_written;
+}
+
+/** Closes file descriptor FD, if it is open. */
+static void
+sys_close (int fd)
+{
+  struct open_file *of = lookup_fd (fd);
+
+  if (of != NULL)
+    {
+      lock_acquire (&fs_lock);
+      file_close (of->file);
+      lock_release (&fs_lock);
+      list_remove (&of->elem);
+      free (of);
+    }
+}
+
+#ifdef VM
+/** Maps the file open as FD at user address ADDR.  Returns the
+   new mapping's identifier, or MAP_FAILED if FD is not open or
+   mmap_map() fails. */
+static mapid_t
+sys_mmap (int fd, void *addr)
+{
+  struct open_file *of = lookup_fd (fd);
+  mapid_t id;
+
+  if (of == NULL)
+    return MAP_FAILED;
+  lock_acquire (&fs_lock);
+  id = mmap_map (of->file, addr);
+  lock_release (&fs_lock);
+  return id;
+}
+#endif
+
+/** Returns the running process's open file with descriptor FD,
+   or a null pointer if it has none. */
+static struct open_file *
+lookup_fd (int fd)
+{
+  struct list *files = &thread_current ()->files;
+  struct list_elem *e;
+
+  for (e = list_begin (files); e != list_end (files); e = list_next (e))
+    {
+      struct open_file *of = list_entry (e, struct open_file, elem);
+      if (of->fd == fd)
+        return of;
+    }
+  return NULL;
+}
+
+/** Returns word I on the user stack of the process whose
+   interrupt frame is F: the system call number if I is 0,
+   otherwise its Ith argument. */
+static uint32_t
+arg (struct intr_frame *f, int i)
+{
+  const uint32_t *p = (const uint32_t *) f->esp + i;
+
+  check_user (f, p, sizeof *p, false);
+  return *p;
+}
+
+/** Checks that the null-terminated string at user address USTR
+   can be read, and returns it. */
+static const char *
+check_string (struct intr_frame *f, const char *ustr)
+{
+  const char *p;
+
+  for (p = ustr; ; p++)
+    {
+      if (p == ustr || pg_ofs (p) == 0)
+        check_user (f, p, 1, false);
+      if (*p == '\0')
+        return ustr;
+    }
+}
+
+/** Checks that the SIZE bytes at user address UADDR are in the
+   address space of the process whose interrupt frame is F, and
+   writable if WRITE is true.  If not, the process exits. */
+static void
+check_user (struct intr_frame *f, const void *uaddr, size_t size, bool write)
+{
+  const uint8_t *start = uaddr;
+  const uint8_t *end = start + size;
+  const uint8_t *page;
+
+  if (end < start)
+    sys_exit (-1);
+  for (page = pg_round_down (start); page < end; page += PGSIZE)
+    if (!is_user_page (f, page, write))
+      sys_exit (-1);
+}
+
+/** Returns true if UPAGE is a page in the address space of the
+   process whose interrupt frame is F, and writable if WRITE is
+   true. */
+static bool
+is_user_page (struct intr_frame *f UNUSED, const void *upage, bool write)
+{
+  struct thread *t = thread_current ();
+#ifdef VM
+  struct page *p;
+#endif
+
+  if (!is_user_vaddr (upage))
+    return false;
+#ifdef VM
+  p = page_lookup (t, upage);
+  if (p == NULL)
+    return page_handle_fault ((void *) upage, write, f->esp);
+  return !write || p->writable;
+#else
+  return (write
+          ? pagedir_is_writable (t->pagedir, upage)
+          : pagedir_get_page (t->pagedir, upage) != NULL);
+#endif
+}
@@ -1,6 +1,13 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+
+struct thread;
+
 void syscall_init (void);
+void fd_table_init (void);
+bool fd_table_copy (struct thread *parent);
+void fd_table_destroy (void);
 
 #endif /**< userprog/syscall.h */
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
+#include "threads/cpu.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -72,35 +73,44 @@ struct tss
     uint16_t trace, bitmap;
   };
 
-/** Kernel TSS. */
+/** Kernel TSSes, one for each CPU, since each CPU runs a
+   different thread on a different kernel stack.  They all fit
+   in a single page. */
 static struct tss *tss;
 
-/** Initializes the kernel TSS. */
+/** Initializes the kernel TSSes. */
 void
 tss_init (void) 
 {
+  int i;
+
   /* Our TSS is never used in a call gate or task gate, so only a
      few fields of it are ever referenced, and those are the only
      ones we initialize. */
+  ASSERT (CPU_MAX * sizeof *tss <= PGSIZE);
   tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
-  tss->ss0 = SEL_KDSEG;
-  tss->bitmap = 0xdfff;
+  for (i = 0; i < CPU_MAX; i++) 
+    {
+      tss[i].ss0 = SEL_KDSEG;
+      tss[i].bitmap = 0xdfff;
+    }
   tss_update ();
 }
 
-/** Returns the kernel TSS. */
+/** Returns the kernel TSS of the CPU whose id is CPU. */
 struct tss *
-tss_get (void) 
+tss_get (int cpu) 
 {
   ASSERT (tss != NULL);
-  return tss;
+  ASSERT (cpu >= 0 && cpu < CPU_MAX);
+  return &tss[cpu];
 }
 
-/** Sets the ring 0 stack pointer in the TSS to point to the end
-   of the thread stack. */
+/** Sets the ring 0 stack pointer in the running CPU's TSS to
+   point to the end of the thread stack. */
 void
 tss_update (void) 
 {
   ASSERT (tss != NULL);
-  tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
+  tss[cpu_current ()->id].esp0 = (uint8_t *) thread_current () + PGSIZE;
 }
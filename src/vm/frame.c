@@ -0,0 +1,657 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/kmap.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/** Frame table.
+
+   Every frame that holds a user page is in the frame table,
+   along with the process and the page of its address space that
+   it belongs to.  When palloc_get_frame() finds no free frame
+   for a user page, a frame is evicted from the table, chosen by
+   the clock algorithm: the table is a circular list, and a
+   "hand" sweeps around it, clearing the accessed bit of each
+   frame it passes, until it comes to a frame whose accessed bit
+   is already clear, which has not been used since the hand last
+   went by.  page_out() then saves the page, if it has to be,
+   and the frame is freed.
+
+   A page that has to be written to swap is written along with
+   the other pages of its group of SWAP_CLUSTER virtual pages
+   that are in frames, are not pinned or recently accessed, and
+   would also have to be written.  They all go out in a single
+   batch to consecutive swap slots, which is cheaper than writing
+   them one by one as the hand comes around to each of them, and
+   lets page_load() read them back together.
+
+   The same eviction serves as the user class's reclaim hook in
+   palloc.c, so that the kernel can take back frames that user
+   pages borrowed from it.
+
+   A frame is pinned while its page is being read in, so that it
+   is not evicted before it is even mapped.  The frame table,
+   and each frame's page while the frame is in the table, are
+   protected by `frame_lock', which is held for all of an
+   eviction, I/O included.  Thus a process that faults on a page
+   in the middle of being evicted can wait for the eviction to
+   finish by acquiring the lock; see frame_wait().  Eviction
+   looks up the victim's neighbors in its owner's supplemental
+   page table, so the owner also holds the lock while it adds to
+   the table; see frame_table_lock().
+
+   fork() shares each of the parent's frames with the child
+   instead of copying it: the child's page is added to the
+   frame's `sharers', and both processes map the frame read-only.
+   A write to it faults, and frame_unshare() gives the writer a
+   copy of its own, unless no other process shares the frame any
+   more, in which case the writer just maps it writable again.
+
+   A shared frame is evicted like any other, but by itself, not
+   in a cluster, and only if none of the pages that share it was
+   accessed recently and none of their processes is running on
+   another CPU.  It is unmapped from every process that shares
+   it, and its contents are saved once: if they go to swap, every
+   page that shared the frame shares the swap slot instead.
+
+   The page directory code does not shoot down the TLBs of other
+   CPUs, so a frame whose owner is running on another CPU is
+   never evicted.  Unmapping the page with interrupts off, after
+   checking, makes sure that the owner reloads its page directory
+   before it runs again. */
+
+/** Frames that hold user pages, in clock order. */
+static struct list frames;
+
+/** The clock hand: the next frame to consider for eviction, or
+   the list tail to start over from the beginning. */
+static struct list_elem *hand;
+
+/** Protects the frame table. */
+static struct lock frame_lock;
+
+/** Object cache for struct frame. */
+static struct kmem_cache *frame_cache;
+
+/** Statistics. */
+static size_t frame_cnt;        /**< # of frames in the table. */
+static long long evict_cnt;     /**< # of frames evicted. */
+static long long scan_cnt;      /**< # of frames passed over by the hand. */
+static long long cluster_cnt;   /**< # of evictions of more than one frame. */
+static long long share_cnt;     /**< # of frames shared by fork(). */
+static long long copy_cnt;      /**< # of shared frames copied on write. */
+
+static palloc_reclaim_func frame_reclaim;
+static struct frame *get_frame (enum palloc_flags);
+static void put_frame (struct frame *);
+static size_t evict (bool wait);
+static void detach (struct frame *, struct page *);
+static void drop_sharers (struct frame *);
+static void remap_sharers (struct frame *);
+static void remove_frame (struct frame *);
+
+/** Initializes the frame table. */
+void
+frame_init (void) 
+{
+  list_init (&frames);
+  hand = list_end (&frames);
+  lock_init (&frame_lock);
+  frame_cache = kmem_cache_create ("frame", sizeof (struct frame), NULL);
+  palloc_set_reclaim (PAL_USER, frame_reclaim);
+}
+
+/** Allocates a frame for page P of the running process, evicting
+   another page if necessary, and adds it to the frame table as
+   P's frame.  The frame is pinned, so the caller must call
+   frame_unpin() once P is in it and mapped.  FLAGS are passed
+   along to palloc_get_frame(), along with PAL_USER.  Returns the
+   frame, or a null pointer if no frame can be freed up. */
+struct frame *
+frame_alloc (struct page *p, enum palloc_flags flags) 
+{
+  struct frame *f;
+
+  ASSERT (p->frame == NULL);
+
+  f = get_frame (flags);
+  if (f == NULL)
+    return NULL;
+  f->page = p;
+  f->pinned = true;
+
+  lock_acquire (&frame_lock);
+  list_insert (hand, &f->elem);
+  frame_cnt++;
+  p->frame = f;
+  lock_release (&frame_lock);
+  return f;
+}
+
+/** Allows F to be evicted. */
+void
+frame_unpin (struct frame *f) 
+{
+  lock_acquire (&frame_lock);
+  ASSERT (f->pinned);
+  f->pinned = false;
+  lock_release (&frame_lock);
+}
+
+/** Unmaps page P from its process's page directory, if it is in
+   a frame, and frees the frame.  Page P must belong to the
+   running process. */
+void
+frame_release (struct page *p) 
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = p->frame;
+  if (f != NULL) 
+    {
+      pagedir_clear_page (thread_current ()->pagedir, p->upage);
+      if (f->ref_cnt > 1)
+        detach (f, p);
+      else 
+        {
+          ASSERT (f->owner == thread_current ());
+          remove_frame (f);
+        }
+    }
+  lock_release (&frame_lock);
+}
+
+/** Shares page P's frame with page Q of the running process, which
+   is a copy of P's process made by fork(), and maps it into the
+   running process's page directory at Q's address.  Both pages
+   are mapped read-only, so that a write to either of them faults
+   and makes a copy; see frame_unshare().  Returns true if
+   successful, false if out of memory.  P must be in a frame, and
+   the frame table must be locked. */
+bool
+frame_share (struct page *p, struct page *q) 
+{
+  struct frame *f = p->frame;
+  uint32_t *pd = p->owner->pagedir;
+  uint32_t *child_pd = thread_current ()->pagedir;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (f != NULL && q->frame == NULL);
+
+  if (!pagedir_set_frame (child_pd, q->upage, f->paddr, false))
+    return false;
+
+  /* The dirty bit tells eviction whether the page differs from
+     where it was loaded from, so the copy needs it too. */
+  if (pagedir_is_dirty (pd, p->upage))
+    pagedir_set_dirty (child_pd, q->upage, true);
+  if (p->writable)
+    pagedir_set_writable (pd, p->upage, false);
+
+  list_push_back (&f->sharers, &q->share_elem);
+  f->ref_cnt++;
+  q->frame = f;
+  share_cnt++;
+  return true;
+}
+
+/** Makes page P of the running process, which is in a frame that
+   fork() made read-only, writable, after a write to it faulted.
+   If the frame is still shared with another process, gives P a
+   copy of it, in a frame of its own; otherwise, P just maps the
+   frame writable.  Returns true if successful, including if P
+   was evicted meanwhile, so that the faulting access only needs
+   to be retried, or false if out of memory. */
+bool
+frame_unshare (struct page *p) 
+{
+  struct thread *cur = thread_current ();
+  struct frame *f, *copy = NULL;
+  uint8_t *src, *dst;
+
+  ASSERT (p->writable);
+
+  for (;;) 
+    {
+      lock_acquire (&frame_lock);
+      f = p->frame;
+      if (f == NULL || f->ref_cnt == 1) 
+        {
+          /* The last process to share a frame owns it. */
+          if (f != NULL)
+            pagedir_set_writable (cur->pagedir, p->upage, true);
+          lock_release (&frame_lock);
+          if (copy != NULL)
+            put_frame (copy);
+          return true;
+        }
+      if (copy != NULL)
+        break;
+      lock_release (&frame_lock);
+
+      /* Allocating may evict, which needs the lock. */
+      copy = get_frame (0);
+      if (copy == NULL)
+        return false;
+    }
+
+  dst = kmap (copy->paddr);
+  src = kmap (f->paddr);
+  memcpy (dst, src, PGSIZE);
+  kunmap (src);
+  kunmap (dst);
+  pagedir_clear_page (cur->pagedir, p->upage);
+  detach (f, p);
+
+  copy->page = p;
+  copy->pinned = false;
+  list_insert (hand, &copy->elem);
+  frame_cnt++;
+  p->frame = copy;
+
+  /* P was just mapped, so its page table is there and this
+     cannot fail. */
+  pagedir_set_frame (cur->pagedir, p->upage, copy->paddr, true);
+  copy_cnt++;
+  lock_release (&frame_lock);
+  return true;
+}
+
+/** Waits until no frame is being evicted. */
+void
+frame_wait (void) 
+{
+  lock_acquire (&frame_lock);
+  lock_release (&frame_lock);
+}
+
+/** Locks the frame table, which keeps eviction from looking at
+   supplemental page tables until frame_table_unlock(). */
+void
+frame_table_lock (void) 
+{
+  lock_acquire (&frame_lock);
+}
+
+/** Unlocks the frame table. */
+void
+frame_table_unlock (void) 
+{
+  lock_release (&frame_lock);
+}
+
+/** Prints frame table statistics. */
+void
+frame_print_stats (void) 
+{
+  printf ("Frame: %zu user frames, %lld evicted, %lld evictions of "
+          "clusters, %lld passed over, %lld shared, %lld copied on "
+          "write\n",
+          frame_cnt, evict_cnt, cluster_cnt, scan_cnt, share_cnt, copy_cnt);
+}
+
+/** Allocates a frame for the running process, evicting another
+   page if necessary, but does not add it to the frame table.
+   FLAGS are passed along to palloc_get_frame(), along with
+   PAL_USER.  Returns the frame, or a null pointer if no frame
+   can be freed up. */
+static struct frame *
+get_frame (enum palloc_flags flags) 
+{
+  struct frame *f;
+
+  f = kmem_cache_alloc (frame_cache);
+  if (f == NULL)
+    return NULL;
+
+  /* palloc_get_frame() tries frame_reclaim() by itself, but it
+     gives up if another thread is evicting at the same time, so
+     wait for our turn and evict here. */
+  while ((f->paddr = palloc_get_frame (PAL_USER | flags)) == 0)
+    if (evict (true) == 0) 
+      {
+        kmem_cache_free (frame_cache, f);
+        return NULL;
+      }
+  f->owner = thread_current ();
+  f->ref_cnt = 1;
+  list_init (&f->sharers);
+  return f;
+}
+
+/** Frees F, which get_frame() returned, without ever having added
+   it to the frame table. */
+static void
+put_frame (struct frame *f) 
+{
+  palloc_free_frame (f->paddr);
+  kmem_cache_free (frame_cache, f);
+}
+
+/** Returns true if T is running on a CPU other than this one.
+   Interrupts must be off. */
+static bool
+running_elsewhere (struct thread *t) 
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (cpus[i].current == t && &cpus[i] != cpu_current ())
+      return true;
+  return false;
+}
+
+/** Returns true if the process of any page that shares F is
+   running on a CPU other than this one.  Interrupts must be
+   off. */
+static bool
+in_use_elsewhere (struct frame *f) 
+{
+  struct list_elem *e;
+
+  if (running_elsewhere (f->owner))
+    return true;
+  for (e = list_begin (&f->sharers); e != list_end (&f->sharers);
+       e = list_next (e))
+    if (running_elsewhere (list_entry (e, struct page, share_elem)->owner))
+      return true;
+  return false;
+}
+
+/** Returns true if any page that shares F was accessed since the
+   clock hand last passed F, and clears their accessed bits. */
+static bool
+was_accessed (struct frame *f) 
+{
+  bool accessed = false;
+  struct list_elem *e;
+
+  if (pagedir_is_accessed (f->owner->pagedir, f->page->upage)) 
+    {
+      pagedir_set_accessed (f->owner->pagedir, f->page->upage, false);
+      accessed = true;
+    }
+  for (e = list_begin (&f->sharers); e != list_end (&f->sharers);
+       e = list_next (e)) 
+    {
+      struct page *q = list_entry (e, struct page, share_elem);
+      if (pagedir_is_accessed (q->owner->pagedir, q->upage)) 
+        {
+          pagedir_set_accessed (q->owner->pagedir, q->upage, false);
+          accessed = true;
+        }
+    }
+  return accessed;
+}
+
+/** Advances the clock hand and returns the frame it was on.  The
+   frame table must not be empty. */
+static struct frame *
+advance_hand (void) 
+{
+  if (hand == list_end (&frames))
+    hand = list_begin (&frames);
+  ASSERT (hand != list_end (&frames));
+  hand = list_next (hand);
+  return list_entry (list_prev (hand), struct frame, elem);
+}
+
+/** Returns true if page P, in a frame mapped in page directory
+   PD, would have to be written to swap to be evicted. */
+static bool
+needs_swap (struct page *p, uint32_t *pd) 
+{
+  return (p->type == PAGE_ANON
+          || (p->type != PAGE_MMAP && pagedir_is_dirty (pd, p->upage)));
+}
+
+/** Stores into CLUSTER the frames to evict along with VICTIM, in
+   order of virtual address, VICTIM included, and returns how
+   many there are.  If VICTIM's page would have to be written to
+   swap, and it is not shared, these are the frames of the other
+   pages in its group that would too and that are not pinned,
+   shared, or recently accessed. */
+static size_t
+gather_cluster (struct frame *victim, struct frame *cluster[SWAP_CLUSTER]) 
+{
+  uint32_t *pd = victim->owner->pagedir;
+  uint8_t *group;
+  size_t cnt = 0;
+  int i;
+
+  if (victim->ref_cnt > 1 || !needs_swap (victim->page, pd)) 
+    {
+      cluster[0] = victim;
+      return 1;
+    }
+
+  group = (uint8_t *) ((uintptr_t) victim->page->upage
+                       & ~(uintptr_t) (SWAP_CLUSTER * PGSIZE - 1));
+  for (i = 0; i < SWAP_CLUSTER; i++) 
+    {
+      void *upage = group + i * PGSIZE;
+      struct page *p;
+
+      if (upage == victim->page->upage)
+        cluster[cnt++] = victim;
+      else if ((p = page_lookup (victim->owner, upage)) != NULL
+               && p->frame != NULL && !p->frame->pinned
+               && p->frame->ref_cnt == 1
+               && !pagedir_is_accessed (pd, upage) && needs_swap (p, pd))
+        cluster[cnt++] = p->frame;
+    }
+  return cnt;
+}
+
+/** Evicts VICTIM, along with the frames that gather_cluster()
+   picks for it, unless a process whose page is in VICTIM is
+   running on another CPU.  Returns the number of frames
+   freed. */
+static size_t
+evict_cluster (struct frame *victim) 
+{
+  struct frame *cluster[SWAP_CLUSTER];
+  struct page *pages[SWAP_CLUSTER];
+  bool saved[SWAP_CLUSTER];
+  uint32_t *pd = victim->owner->pagedir;
+  enum intr_level old_level;
+  size_t cnt, freed, i;
+
+  cnt = gather_cluster (victim, cluster);
+  old_level = intr_disable ();
+  if (in_use_elsewhere (victim)) 
+    {
+      intr_set_level (old_level);
+      return 0;
+    }
+  for (i = 0; i < cnt; i++) 
+    {
+      struct list_elem *e;
+
+      pages[i] = cluster[i]->page;
+      pagedir_clear_page (pd, pages[i]->upage);
+      for (e = list_begin (&cluster[i]->sharers);
+           e != list_end (&cluster[i]->sharers); e = list_next (e)) 
+        {
+          struct page *q = list_entry (e, struct page, share_elem);
+          pagedir_clear_page (q->owner->pagedir, q->upage);
+          if (pagedir_is_dirty (q->owner->pagedir, q->upage))
+            pagedir_set_dirty (pd, pages[i]->upage, true);
+        }
+    }
+  intr_set_level (old_level);
+
+  page_out (pages, saved, cnt, pd);
+  freed = 0;
+  for (i = 0; i < cnt; i++) 
+    if (saved[i]) 
+      {
+        drop_sharers (cluster[i]);
+        remove_frame (cluster[i]);
+        freed++;
+      }
+    else
+      remap_sharers (cluster[i]);
+  if (freed > 1)
+    cluster_cnt++;
+  return freed;
+}
+
+/** Evicts a frame chosen by the clock algorithm, possibly with
+   some of its neighbors, and frees them.  If WAIT is false,
+   gives up at once if another thread is evicting.  Returns the
+   number of frames freed, which is 0 if none could be. */
+static size_t
+evict (bool wait) 
+{
+  size_t freed = 0;
+  size_t i;
+
+  if (wait)
+    lock_acquire (&frame_lock);
+  else if (!lock_try_acquire (&frame_lock))
+    return 0;
+
+  /* Two trips around the clock clear every accessed bit, so if
+     no frame is found by then, every frame is pinned, in use
+     elsewhere, or cannot be saved. */
+  for (i = 0; freed == 0 && i < 2 * frame_cnt; i++) 
+    {
+      struct frame *f = advance_hand ();
+
+      scan_cnt++;
+      if (f->pinned || was_accessed (f))
+        continue;
+      freed = evict_cluster (f);
+    }
+  evict_cnt += freed;
+  lock_release (&frame_lock);
+  return freed;
+}
+
+/** Takes page P, which is not the only page that shares frame F,
+   out of the pages that share it, and records that P is no
+   longer in memory.  If P was F's `page', one of the others
+   takes its place.  P must already be unmapped.  The frame table
+   must be locked. */
+static void
+detach (struct frame *f, struct page *p) 
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (f->ref_cnt > 1 && p->frame == f);
+
+  if (f->page == p) 
+    {
+      struct list_elem *e = list_pop_front (&f->sharers);
+      f->page = list_entry (e, struct page, share_elem);
+      f->owner = f->page->owner;
+    }
+  else
+    list_remove (&p->share_elem);
+  f->ref_cnt--;
+  p->frame = NULL;
+}
+
+/** Records that the pages other than F's `page' that share F,
+   which must be unmapped, are no longer in memory, after
+   page_out() saved F's page.  If it went to swap, they share its
+   swap slot, since they have the same contents.  The frame table
+   must be locked. */
+static void
+drop_sharers (struct frame *f) 
+{
+  struct page *p = f->page;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  while (!list_empty (&f->sharers)) 
+    {
+      struct list_elem *e = list_pop_front (&f->sharers);
+      struct page *q = list_entry (e, struct page, share_elem);
+
+      if (p->swap_slot != SWAP_NONE) 
+        {
+          swap_dup (p->swap_slot);
+          q->swap_slot = p->swap_slot;
+        }
+      q->type = p->type;
+      q->frame = NULL;
+    }
+  f->ref_cnt = 1;
+}
+
+/** Maps the pages that share F again, read-only, after page_out()
+   could not save F's page, which it mapped again by itself.  The
+   frame table must be locked. */
+static void
+remap_sharers (struct frame *f) 
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (f->ref_cnt == 1)
+    return;
+  pagedir_set_writable (f->owner->pagedir, f->page->upage, false);
+  for (e = list_begin (&f->sharers); e != list_end (&f->sharers);
+       e = list_next (e)) 
+    {
+      struct page *q = list_entry (e, struct page, share_elem);
+      uint32_t *pd = q->owner->pagedir;
+      bool dirty = pagedir_is_dirty (pd, q->upage);
+
+      /* The page was mapped until just now, so its page table is
+         there and this cannot fail. */
+      pagedir_set_frame (pd, q->upage, f->paddr, false);
+      if (dirty)
+        pagedir_set_dirty (pd, q->upage, true);
+    }
+}
+
+/** Takes F out of the frame table, frees it, and records that its
+   page is no longer in memory.  The frame table must be
+   locked. */
+static void
+remove_frame (struct frame *f) 
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  frame_cnt--;
+  f->page->frame = NULL;
+  palloc_free_frame (f->paddr);
+  kmem_cache_free (frame_cache, f);
+}
+
+/** Reclaim hook for user pages: evicts frames until PAGE_CNT have
+   been freed, or no more can be, and returns the number freed.
+   That may be more than PAGE_CNT, since frames are evicted in
+   clusters.  Gives up if it may not sleep, or if the running
+   thread is already evicting. */
+static size_t
+frame_reclaim (size_t page_cnt) 
+{
+  size_t freed = 0;
+  size_t cnt;
+
+  if (intr_get_level () == INTR_OFF || intr_context ()
+      || lock_held_by_current_thread (&frame_lock))
+    return 0;
+  while (freed < page_cnt && (cnt = evict (false)) > 0)
+    freed += cnt;
+  return freed;
+}
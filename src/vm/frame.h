@@ -0,0 +1,38 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+
+struct page;
+
+/** A frame that holds a user page.
+
+   After fork(), a frame may hold a page of more than one
+   process.  Then `owner' and `page' are one of them, and the
+   others are in `sharers'. */
+struct frame
+  {
+    struct list_elem elem;      /**< Element in the frame table. */
+    uintptr_t paddr;            /**< Physical address. */
+    struct thread *owner;       /**< Process whose page it holds. */
+    struct page *page;          /**< Page it holds. */
+    bool pinned;                /**< Exempt from eviction? */
+    unsigned ref_cnt;           /**< Number of pages that share it. */
+    struct list sharers;        /**< Pages other than `page' sharing it. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, enum palloc_flags);
+void frame_unpin (struct frame *);
+void frame_release (struct page *);
+bool frame_share (struct page *, struct page *);
+bool frame_unshare (struct page *);
+void frame_wait (void);
+void frame_table_lock (void);
+void frame_table_unlock (void);
+void frame_print_stats (void);
+
+#endif /**< vm/frame.h */
@@ -0,0 +1,146 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/** Memory-mapped files.
+
+   mmap_map() maps a file into consecutive pages of the running
+   process's address space, by adding a PAGE_MMAP page for each
+   page of the file to its supplemental page table.  Nothing is
+   read until the process touches a page, and a page is written
+   back to the file only if the process modified it, when it is
+   evicted or when the mapping goes away.  See page.c.
+
+   Each mapping has its own reopened file, so that it outlives
+   the file descriptor that it was created from. */
+
+/** A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;      /**< Element in thread's `mappings'. */
+    mapid_t id;                 /**< Mapping identifier. */
+    struct file *file;          /**< File mapped. */
+    uint8_t *base;              /**< First user page of the mapping. */
+    size_t page_cnt;            /**< Number of pages mapped. */
+  };
+
+static void unmap (struct mapping *);
+
+/** Initializes the running process's list of mappings. */
+void
+mmap_table_init (void) 
+{
+  struct thread *cur = thread_current ();
+
+  list_init (&cur->mappings);
+  cur->next_mapid = 0;
+}
+
+/** Unmaps all of the running process's mappings, writing back
+   the pages that were modified.  Called when it exits. */
+void
+mmap_table_destroy (void) 
+{
+  struct list *mappings = &thread_current ()->mappings;
+
+  while (!list_empty (mappings))
+    unmap (list_entry (list_front (mappings), struct mapping, elem));
+}
+
+/** Maps FILE into the running process's address space, starting
+   at user virtual address ADDR, which must be page-aligned.  The
+   last page's bytes past the end of FILE read as zeros, and are
+   not written back.  Returns the new mapping's identifier, or
+   MAP_FAILED if FILE is empty, ADDR is null, not aligned, or
+   not a user address, the pages do not fit below PHYS_BASE or
+   overlap pages that the process already has, or memory runs
+   out. */
+mapid_t
+mmap_map (struct file *file, void *addr) 
+{
+  struct thread *cur = thread_current ();
+  struct mapping *m;
+  uint8_t *base = addr;
+  off_t length;
+  size_t page_cnt, i;
+
+  length = file_length (file);
+  if (length == 0 || base == NULL || pg_ofs (base) != 0
+      || !is_user_vaddr (base))
+    return MAP_FAILED;
+  page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  if (page_cnt > (size_t) ((uint8_t *) PHYS_BASE - base) / PGSIZE)
+    return MAP_FAILED;
+  for (i = 0; i < page_cnt; i++)
+    if (page_lookup (cur, base + i * PGSIZE) != NULL)
+      return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL) 
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->id = MAP_FAILED;
+  m->base = base;
+  for (m->page_cnt = 0; m->page_cnt < page_cnt; m->page_cnt++) 
+    {
+      off_t ofs = m->page_cnt * PGSIZE;
+      off_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!page_add_mmap (base + ofs, m->file, ofs, read_bytes)) 
+        {
+          unmap (m);
+          return MAP_FAILED;
+        }
+    }
+
+  m->id = cur->next_mapid++;
+  list_push_back (&cur->mappings, &m->elem);
+  return m->id;
+}
+
+/** Unmaps the running process's mapping with identifier ID,
+   writing back the pages that were modified.  Does nothing if
+   there is no such mapping. */
+void
+mmap_unmap (mapid_t id) 
+{
+  struct list *mappings = &thread_current ()->mappings;
+  struct list_elem *e;
+
+  for (e = list_begin (mappings); e != list_end (mappings); e = list_next (e)) 
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == id) 
+        {
+          unmap (m);
+          return;
+        }
+    }
+}
+
+/** Removes M's pages from the process's address space, writing
+   back the ones that were modified, and frees M.  M is in the
+   process's list of mappings unless its `id' is MAP_FAILED. */
+static void
+unmap (struct mapping *m) 
+{
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->base + i * PGSIZE);
+  file_close (m->file);
+  if (m->id != MAP_FAILED)
+    list_remove (&m->elem);
+  free (m);
+}
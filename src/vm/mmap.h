@@ -0,0 +1,15 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+struct file;
+
+/** Memory-mapped file identifier. */
+typedef int mapid_t;
+#define MAP_FAILED ((mapid_t) -1)
+
+void mmap_table_init (void);
+void mmap_table_destroy (void);
+mapid_t mmap_map (struct file *, void *addr);
+void mmap_unmap (mapid_t);
+
+#endif /**< vm/mmap.h */
@@ -0,0 +1,683 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/cpu.h"
+#include "threads/kmap.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/** Demand paging.
+
+   load() in process.c does not read a program's segments into
+   memory.  Instead, it records each page of them in the
+   process's supplemental page table, as a page to be read from
+   the executable (PAGE_FILE) or to be zeroed (PAGE_ZERO), and
+   leaves it unmapped in the page directory.  The first access to
+   the page faults, and page_handle_fault() gives it a frame,
+   fills it, and maps it.  So the cost of starting a program
+   depends on the pages it touches, not on the size of its
+   executable.
+
+   A page of a memory-mapped file (PAGE_MMAP, see mmap.c) is
+   loaded the same way as a page of an executable, but it is
+   written back to its file, if it was modified, when it is
+   evicted or unmapped.  Whether it was modified is told by the
+   dirty bit in its page table entry, so a page that was only
+   read is never written.
+
+   When any other page is evicted from its frame (see frame.c), it
+   is simply dropped if it was not modified since it was loaded,
+   since it can be read or zeroed again.  Otherwise, it is
+   written to swap and becomes PAGE_ANON, and from then on it is
+   written to swap whenever it is evicted.  Pages of a group of
+   SWAP_CLUSTER virtual pages are written to swap together, in
+   order, when they can be, so a fault on one of them reads in
+   the rest of the batch too, in the expectation that they will
+   be used together again.  The extra pages are mapped with their
+   accessed bits clear, so if the guess was wrong they are the
+   first to be evicted again.
+
+   The stack grows the same way: a fault on an address that is
+   not in the table, but that is just below the stack pointer
+   and within STACK_MAX bytes of the top of user memory, adds a
+   zeroed page to the table there.
+
+   fork() copies a process's supplemental page table, but not its
+   pages: the child shares each page that the parent has in a
+   frame, and each swap slot, and both map the shared frames
+   read-only.  The first write to such a page by either process
+   faults, and page_handle_cow() gives the writer its own copy,
+   unless the other process no longer has the page.  So a fork
+   costs time in proportion to the number of pages, and a page
+   is copied only if both processes keep it and one writes it.
+
+   Only the process itself adds pages to its supplemental page
+   table or removes them.  Eviction, in another thread, looks up
+   pages in the table and changes the ones in frames, with the
+   frame table locked, so the process locks the frame table too
+   when it changes the table's structure. */
+
+/** Number of buckets in each histogram of fault latencies.
+   Bucket I counts the faults that took less than 2**(I + 11)
+   cycles, and more than half that, except that the first and the
+   last buckets are open-ended. */
+#define LATENCY_BUCKETS 16
+
+/** Object cache for struct page. */
+static struct kmem_cache *page_cache;
+
+/** Statistics. */
+static long long file_cnt;      /**< # of pages read from files. */
+static long long zero_cnt;      /**< # of zeroed pages. */
+static long long grow_cnt;      /**< # of pages added to stacks. */
+static long long readahead_cnt; /**< # of pages read from swap early. */
+static long long writeback_cnt; /**< # of pages written back to files. */
+
+/** Histograms of the time to load pages on faults, by type. */
+static long long latency[PAGE_ANON + 1][LATENCY_BUCKETS];
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_release;
+static hash_action_func page_destroy;
+static struct page *page_add (void *upage, enum page_type, bool writable);
+static bool add_file_page (void *upage, enum page_type, struct file *,
+                           off_t ofs, uint32_t read_bytes, bool writable);
+static bool page_load (struct page *);
+static void write_back (struct page *);
+
+/** Initializes the demand paging system. */
+void
+page_init (void) 
+{
+  page_cache = kmem_cache_create ("page", sizeof (struct page), NULL);
+}
+
+/** Creates the running thread's supplemental page table.
+   Returns true if successful, false if out of memory. */
+bool
+page_table_create (void) 
+{
+  return hash_init (&thread_current ()->pages, page_hash, page_less, NULL);
+}
+
+/** Fills the running thread's supplemental page table, which
+   must be empty, with a copy of PARENT's, for fork().  Pages
+   that PARENT has in frames are shared with it, copy-on-write,
+   and pages in swap share their swap slots.  PARENT's
+   memory-mapped files are not inherited.  PARENT must not run
+   until this returns.  Returns true if successful, false if out
+   of memory. */
+bool
+page_table_copy (struct thread *parent) 
+{
+  struct thread *cur = thread_current ();
+  struct hash_iterator i;
+
+  /* Only PARENT changes the structure of its table, so the table
+     can be walked without the frame table locked, but the pages
+     in it can be evicted meanwhile, so each one is copied with
+     it locked. */
+  hash_first (&i, &parent->pages);
+  while (hash_next (&i)) 
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, elem);
+      struct page *q;
+      bool ok = true;
+
+      if (p->type == PAGE_MMAP)
+        continue;
+      q = page_add (p->upage, p->type, p->writable);
+      if (q == NULL)
+        return false;
+
+      /* Only pages of the executable refer to a file. */
+      q->file = p->file != NULL ? cur->exec_file : NULL;
+      q->ofs = p->ofs;
+      q->read_bytes = p->read_bytes;
+
+      frame_table_lock ();
+      q->type = p->type;
+      if (p->frame != NULL)
+        ok = frame_share (p, q);
+      else if (p->swap_slot != SWAP_NONE) 
+        {
+          swap_dup (p->swap_slot);
+          q->swap_slot = p->swap_slot;
+        }
+      frame_table_unlock ();
+      if (!ok)
+        return false;
+    }
+  return true;
+}
+
+/** Destroys the running thread's supplemental page table, freeing
+   the frames and swap slots that its pages are in, and unmapping
+   them from its page directory. */
+void
+page_table_destroy (void) 
+{
+  struct hash *pages = &thread_current ()->pages;
+
+  /* Take every page out of the frame table before freeing any of
+     them, since eviction may look at any page of a process that
+     still has frames. */
+  hash_apply (pages, page_release);
+  hash_destroy (pages, page_destroy);
+}
+
+/** Adds a page at user virtual address UPAGE to the running
+   thread's supplemental page table, to be loaded from FILE on
+   first access: READ_BYTES bytes starting at offset OFS,
+   followed by PGSIZE - READ_BYTES zeros.  The process may write
+   to it if WRITABLE is true.  Returns true if successful, false
+   if out of memory or UPAGE is already in the table. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               uint32_t read_bytes, bool writable) 
+{
+  if (read_bytes == 0)
+    return page_add_zero (upage, writable);
+  return add_file_page (upage, PAGE_FILE, file, ofs, read_bytes, writable);
+}
+
+/** Adds a page at user virtual address UPAGE to the running
+   thread's supplemental page table, to be zeroed on first
+   access.  The process may write to it if WRITABLE is true.
+   Returns true if successful, false if out of memory or UPAGE is
+   already in the table. */
+bool
+page_add_zero (void *upage, bool writable) 
+{
+  return page_add (upage, PAGE_ZERO, writable) != NULL;
+}
+
+/** Adds a writable page at user virtual address UPAGE to the
+   running thread's supplemental page table, mapping READ_BYTES
+   bytes of FILE starting at offset OFS, followed by zeros.  The
+   page is loaded from FILE on first access, and written back to
+   it if it is modified.  Returns true if successful, false if
+   out of memory or UPAGE is already in the table. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               uint32_t read_bytes) 
+{
+  ASSERT (read_bytes > 0);
+  return add_file_page (upage, PAGE_MMAP, file, ofs, read_bytes, true);
+}
+
+/** Removes the page at user virtual address UPAGE from the running
+   thread's supplemental page table and frees it, writing it back
+   to its file first if it is a modified PAGE_MMAP page. */
+void
+page_remove (void *upage) 
+{
+  struct thread *cur = thread_current ();
+  struct page *p = page_lookup (cur, upage);
+
+  ASSERT (p != NULL);
+
+  /* Keep eviction away while writing back, since it could write
+     back and free the same frame. */
+  frame_table_lock ();
+  if (p->frame != NULL && p->type == PAGE_MMAP
+      && pagedir_is_dirty (cur->pagedir, p->upage)) 
+    {
+      write_back (p);
+      pagedir_set_dirty (cur->pagedir, p->upage, false);
+    }
+  frame_table_unlock ();
+
+  frame_release (p);
+  if (p->swap_slot != SWAP_NONE)
+    swap_free (p->swap_slot);
+
+  frame_table_lock ();
+  hash_delete (&cur->pages, &p->elem);
+  frame_table_unlock ();
+  kmem_cache_free (page_cache, p);
+}
+
+/** Handles a page fault at FAULT_ADDR, a user virtual address
+   that was not present in the running thread's page directory,
+   caused by a write if WRITE is true, by bringing in the page
+   that contains it.  ESP is the user stack pointer at the time
+   of the fault, or a null pointer if it is not known.  Returns
+   true if successful, false if FAULT_ADDR is not part of the
+   process's address space or the page could not be loaded. */
+bool
+page_handle_fault (void *fault_addr, bool write, void *esp) 
+{
+  struct page *p;
+
+  ASSERT (is_user_vaddr (fault_addr));
+
+  p = page_lookup (thread_current (), fault_addr);
+  if (p == NULL) 
+    {
+      /* Grow the stack if the access is at or above the stack
+         pointer, or just below it, as done by PUSH (4 bytes
+         below) or PUSHA (32 bytes below). */
+      uint8_t *addr = fault_addr;
+      if (esp == NULL || addr + 32 < (uint8_t *) esp
+          || addr < (uint8_t *) PHYS_BASE - STACK_MAX)
+        return false;
+      p = page_add (pg_round_down (fault_addr), PAGE_ZERO, true);
+      if (p == NULL)
+        return false;
+      grow_cnt++;
+    }
+
+  if (write && !p->writable)
+    return false;
+
+  /* A page is in a frame but not mapped only while it is being
+     evicted.  Once that is done, it is either gone, so we can
+     read it back, or mapped again, because it could not be
+     saved. */
+  if (p->frame != NULL) 
+    {
+      frame_wait ();
+      if (p->frame != NULL)
+        return true;
+    }
+  return page_load (p);
+}
+
+/** Handles a page fault caused by a write to FAULT_ADDR, a user
+   virtual address that was present in the running thread's page
+   directory, but read-only.  If the page is one that fork() made
+   read-only so as to share it, gives the process a copy that it
+   can write and returns true.  Otherwise, returns false. */
+bool
+page_handle_cow (void *fault_addr) 
+{
+  struct page *p;
+
+  ASSERT (is_user_vaddr (fault_addr));
+
+  p = page_lookup (thread_current (), fault_addr);
+  return p != NULL && p->writable && frame_unshare (p);
+}
+
+/** Saves the contents of the CNT pages in PAGES, at most
+   SWAP_CLUSTER of them, all in frames, so that the frames can be
+   reused.  A modified PAGE_MMAP page is written back to its
+   file.  Any other page that was modified since it was loaded,
+   or that is PAGE_ANON, is written to swap.  Any other page can
+   be loaded again from where it first came from, so nothing
+   needs to be done.  The pages that are written to swap go out
+   in one batch, in the order given, if swap has room for them
+   all in a row, or one by one otherwise.  The pages must already
+   be unmapped from their process's page directory PD.
+
+   Sets SAVED[I] to true if PAGES[I] was saved.  If swap is full,
+   maps the page again and sets SAVED[I] to false.  Called by the
+   frame table, with its lock held. */
+void
+page_out (struct page *pages[], bool saved[], size_t cnt, uint32_t *pd) 
+{
+  uintptr_t frames[SWAP_CLUSTER];
+  size_t idx[SWAP_CLUSTER];
+  size_t out_cnt = 0;
+  size_t slot, i;
+
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  for (i = 0; i < cnt; i++) 
+    {
+      struct page *p = pages[i];
+
+      ASSERT (p->frame != NULL);
+      saved[i] = true;
+      if (p->type == PAGE_MMAP) 
+        {
+          if (pagedir_is_dirty (pd, p->upage))
+            write_back (p);
+        }
+      else if (p->type == PAGE_ANON || pagedir_is_dirty (pd, p->upage)) 
+        {
+          frames[out_cnt] = p->frame->paddr;
+          idx[out_cnt++] = i;
+        }
+    }
+  if (out_cnt == 0)
+    return;
+
+  slot = swap_out (frames, out_cnt);
+  for (i = 0; i < out_cnt; i++) 
+    {
+      struct page *p = pages[idx[i]];
+
+      if (slot != SWAP_NONE)
+        p->swap_slot = slot + i;
+      else if (out_cnt > 1)
+        p->swap_slot = swap_out (&frames[i], 1);
+      else
+        p->swap_slot = SWAP_NONE;
+      if (p->swap_slot == SWAP_NONE) 
+        {
+          pagedir_set_frame (pd, p->upage, p->frame->paddr, p->writable);
+          pagedir_set_dirty (pd, p->upage, true);
+          saved[idx[i]] = false;
+        }
+      else
+        p->type = PAGE_ANON;
+    }
+}
+
+/** Prints demand paging statistics, including histograms of the
+   time it took to load each type of page on a fault. */
+void
+page_print_stats (void) 
+{
+  static const char *type_names[] = {"file", "zero", "mmap", "swap"};
+  int type, i;
+
+  printf ("Page: %lld pages read from files, %lld zeroed, "
+          "%lld stack pages added, %lld read ahead from swap, "
+          "%lld written back to files\n",
+          file_cnt, zero_cnt, grow_cnt, readahead_cnt, writeback_cnt);
+  for (type = 0; type <= PAGE_ANON; type++) 
+    {
+      long long total = 0;
+
+      for (i = 0; i < LATENCY_BUCKETS; i++)
+        total += latency[type][i];
+      if (total == 0)
+        continue;
+      printf ("Page: %lld %s faults, by cycles:", total, type_names[type]);
+      for (i = 0; i < LATENCY_BUCKETS; i++)
+        if (latency[type][i] > 0)
+          printf (" %s%"PRIu32"k %lld", i < LATENCY_BUCKETS - 1 ? "<" : ">=",
+                  (uint32_t) 1 << (i < LATENCY_BUCKETS - 1 ? i + 1 : i),
+                  latency[type][i]);
+      printf ("\n");
+    }
+}
+
+/** Returns the page in thread T's supplemental page table that
+   contains user virtual address ADDR, or a null pointer if there
+   is none.  T must be the running thread, unless the frame table
+   is locked. */
+struct page *
+page_lookup (struct thread *t, const void *addr) 
+{
+  struct page key;
+  struct hash_elem *e;
+
+  key.upage = pg_round_down (addr);
+  e = hash_find (&t->pages, &key.elem);
+  return e != NULL ? hash_entry (e, struct page, elem) : NULL;
+}
+
+/** Adds a page of the given TYPE at user virtual address UPAGE
+   to the running thread's supplemental page table and returns
+   it, or returns a null pointer if out of memory or UPAGE is
+   already in the table. */
+static struct page *
+page_add (void *upage, enum page_type type, bool writable) 
+{
+  struct hash_elem *dup;
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = kmem_cache_alloc (page_cache);
+  if (p == NULL)
+    return NULL;
+  p->owner = thread_current ();
+  p->upage = upage;
+  p->type = type;
+  p->writable = writable;
+  p->frame = NULL;
+  p->file = NULL;
+  p->ofs = 0;
+  p->read_bytes = 0;
+  p->swap_slot = SWAP_NONE;
+
+  frame_table_lock ();
+  dup = hash_insert (&thread_current ()->pages, &p->elem);
+  frame_table_unlock ();
+  if (dup != NULL) 
+    {
+      kmem_cache_free (page_cache, p);
+      return NULL;
+    }
+  return p;
+}
+
+/** Adds a page of the given TYPE, PAGE_FILE or PAGE_MMAP, at user
+   virtual address UPAGE to the running thread's supplemental
+   page table, with READ_BYTES bytes from FILE starting at offset
+   OFS, followed by zeros.  The process may write to it if
+   WRITABLE is true.  Returns true if successful, false if out of
+   memory or UPAGE is already in the table. */
+static bool
+add_file_page (void *upage, enum page_type type, struct file *file,
+               off_t ofs, uint32_t read_bytes, bool writable) 
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = page_add (upage, type, writable);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  return true;
+}
+
+/** Writes page P, a PAGE_MMAP page in a frame, back to its file.
+   Only the bytes that came from the file are written, so the
+   file does not grow. */
+static void
+write_back (struct page *p) 
+{
+  uint8_t *kpage;
+
+  ASSERT (p->type == PAGE_MMAP && p->frame != NULL);
+
+  kpage = kmap (p->frame->paddr);
+  file_write_at (p->file, kpage, p->read_bytes, p->ofs);
+  kunmap (kpage);
+  writeback_cnt++;
+}
+
+/** Records that loading a page of the given TYPE on a fault took
+   CYCLES cycles. */
+static void
+account_latency (enum page_type type, uint64_t cycles) 
+{
+  int i = 0;
+
+  while (i < LATENCY_BUCKETS - 1 && cycles >= (uint64_t) 2048 << i)
+    i++;
+  latency[type][i]++;
+}
+
+/** Collects the pages to read from swap along with P: the pages
+   in P's group of SWAP_CLUSTER virtual pages that are in swap,
+   in slots next to P's, and so were written out in the same
+   batch.  Gives each of them a pinned frame, as far as frames
+   can be had without eviction failing.  Stores them, with P, in
+   RUN, in order of virtual address and slot, and returns how
+   many there are.  P must be in swap, with a frame. */
+static size_t
+gather_run (struct page *p, struct page *run[SWAP_CLUSTER]) 
+{
+  struct thread *cur = thread_current ();
+  struct page *before[SWAP_CLUSTER];
+  uint8_t *group;
+  size_t before_cnt = 0, cnt = 0;
+  size_t slot;
+  int idx, i;
+
+  group = (uint8_t *) ((uintptr_t) p->upage
+                       & ~(uintptr_t) (SWAP_CLUSTER * PGSIZE - 1));
+  idx = ((uint8_t *) p->upage - group) / PGSIZE;
+
+  /* Pages before P, nearest first.  Pages that are not in swap
+     are skipped, since they may have been left out of P's
+     batch. */
+  slot = p->swap_slot;
+  for (i = idx - 1; i >= 0; i--) 
+    {
+      struct page *q = page_lookup (cur, group + i * PGSIZE);
+      if (q == NULL || q->type != PAGE_ANON || q->frame != NULL)
+        continue;
+      if (q->swap_slot != slot - 1 || frame_alloc (q, 0) == NULL)
+        break;
+      before[before_cnt++] = q;
+      slot--;
+    }
+  while (before_cnt > 0)
+    run[cnt++] = before[--before_cnt];
+  run[cnt++] = p;
+
+  /* Pages after P. */
+  slot = p->swap_slot;
+  for (i = idx + 1; i < SWAP_CLUSTER; i++) 
+    {
+      struct page *q = page_lookup (cur, group + i * PGSIZE);
+      if (q == NULL || q->type != PAGE_ANON || q->frame != NULL)
+        continue;
+      if (q->swap_slot != slot + 1 || frame_alloc (q, 0) == NULL)
+        break;
+      run[cnt++] = q;
+      slot++;
+    }
+  return cnt;
+}
+
+/** Reads P, which is in swap and has a frame, back into memory,
+   along with the pages next to it that gather_run() picks, and
+   maps those other pages in the running thread's page
+   directory.  P itself is left for the caller to map. */
+static void
+swap_in_run (struct page *p) 
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  struct page *run[SWAP_CLUSTER];
+  uintptr_t frames[SWAP_CLUSTER];
+  size_t cnt, i;
+
+  cnt = gather_run (p, run);
+  for (i = 0; i < cnt; i++)
+    frames[i] = run[i]->frame->paddr;
+  swap_in (run[0]->swap_slot, frames, cnt);
+
+  for (i = 0; i < cnt; i++) 
+    {
+      struct page *q = run[i];
+
+      q->swap_slot = SWAP_NONE;
+      if (q == p)
+        continue;
+
+      /* Q was mapped before it was swapped out, and page tables
+         are not freed until the page directory is, so this
+         cannot run out of memory. */
+      pagedir_set_frame (pd, q->upage, q->frame->paddr, q->writable);
+      frame_unpin (q->frame);
+      readahead_cnt++;
+    }
+}
+
+/** Gives P a frame, fills it with P's contents, and maps it into
+   the running thread's page directory.  Returns true if
+   successful, false if out of memory or the file read fails. */
+static bool
+page_load (struct page *p) 
+{
+  enum page_type type = p->type;
+  uint64_t start = rdtsc ();
+  struct frame *f;
+
+  ASSERT (p->frame == NULL);
+
+  f = frame_alloc (p, p->type == PAGE_ZERO ? PAL_ZERO : 0);
+  if (f == NULL)
+    return false;
+
+  if (p->type == PAGE_FILE || p->type == PAGE_MMAP) 
+    {
+      uint8_t *kpage = kmap (f->paddr);
+      off_t read = file_read_at (p->file, kpage, p->read_bytes, p->ofs);
+
+      if (read == (off_t) p->read_bytes)
+        memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+      kunmap (kpage);
+      if (read != (off_t) p->read_bytes) 
+        {
+          frame_release (p);
+          return false;
+        }
+      file_cnt++;
+    }
+  else if (p->type == PAGE_ANON) 
+    swap_in_run (p);
+  else
+    zero_cnt++;
+
+  if (!pagedir_set_frame (thread_current ()->pagedir, p->upage, f->paddr,
+                          p->writable)) 
+    {
+      frame_release (p);
+      return false;
+    }
+  frame_unpin (f);
+  account_latency (type, rdtsc () - start);
+  return true;
+}
+
+/** Returns a hash value for the page that E refers to. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct page *p = hash_entry (e, struct page, elem);
+  return hash_int (pg_no (p->upage));
+}
+
+/** Returns true if the page that A refers to precedes the one
+   that B refers to. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED) 
+{
+  const struct page *pa = hash_entry (a, struct page, elem);
+  const struct page *pb = hash_entry (b, struct page, elem);
+  return pa->upage < pb->upage;
+}
+
+/** Frees the frame of the page that E refers to, if it has
+   one. */
+static void
+page_release (struct hash_elem *e, void *aux UNUSED) 
+{
+  frame_release (hash_entry (e, struct page, elem));
+}
+
+/** Frees the page that E refers to, along with its swap slot. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED) 
+{
+  struct page *p = hash_entry (e, struct page, elem);
+
+  ASSERT (p->frame == NULL);
+  if (p->swap_slot != SWAP_NONE)
+    swap_free (p->swap_slot);
+  kmem_cache_free (page_cache, p);
+}
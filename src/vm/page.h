@@ -0,0 +1,62 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct thread;
+
+/** Where a user page's contents are, when it is not in memory. */
+enum page_type
+  {
+    PAGE_FILE,                  /**< In a file, followed by zeros. */
+    PAGE_ZERO,                  /**< All zeros. */
+    PAGE_MMAP,                  /**< In a file, and written back to it. */
+    PAGE_ANON                   /**< In swap, if not in memory. */
+  };
+
+/** A page in a process's supplemental page table, which records
+   every page of its address space, whether or not it is in
+   memory. */
+struct page
+  {
+    struct hash_elem elem;      /**< Element in supplemental page table. */
+    struct thread *owner;       /**< Process whose page it is. */
+    void *upage;                /**< User virtual address. */
+    enum page_type type;        /**< Where the contents come from. */
+    bool writable;              /**< May the process write it? */
+    struct frame *frame;        /**< Frame, if in memory, or null. */
+    struct list_elem share_elem; /**< In frame's `sharers', if shared. */
+
+    /* PAGE_FILE and PAGE_MMAP only. */
+    struct file *file;          /**< File to read from. */
+    off_t ofs;                  /**< Offset in file. */
+    uint32_t read_bytes;        /**< Bytes to read; the rest are zeroed. */
+
+    /* PAGE_ANON only. */
+    size_t swap_slot;           /**< Swap slot, if not in memory. */
+  };
+
+/** Maximum size of a process's stack, in bytes. */
+#define STACK_MAX (8 * 1024 * 1024)
+
+void page_init (void);
+bool page_table_create (void);
+bool page_table_copy (struct thread *parent);
+void page_table_destroy (void);
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    uint32_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t ofs,
+                    uint32_t read_bytes);
+void page_remove (void *upage);
+bool page_handle_fault (void *fault_addr, bool write, void *esp);
+bool page_handle_cow (void *fault_addr);
+struct page *page_lookup (struct thread *, const void *addr);
+void page_out (struct page *[], bool saved[], size_t cnt, uint32_t *pd);
+void page_print_stats (void);
+
+#endif /**< vm/page.h */
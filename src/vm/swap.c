@@ -0,0 +1,184 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/interrupt.h"
+#include "threads/kmap.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/** Swap space.
+
+   The swap device, the block device in the BLOCK_SWAP role, is
+   divided into page-size "slots" of SECTORS_PER_SLOT sectors
+   each, with a bitmap of the ones in use.  A page that has to be
+   evicted from memory, and that cannot be read back from a file,
+   is written to a free slot, and read back from it when it is
+   next accessed, which frees the slot.
+
+   After fork(), a page in swap belongs to both processes, so
+   each slot has a count of the pages that refer to it, and it is
+   freed only when the last of them is read back or discarded.
+
+   Pages are written and read in batches of up to SWAP_CLUSTER
+   pages, which go in consecutive slots, so that each batch is
+   one sequential run of sectors instead of scattered 8-sector
+   transfers.  The frame table batches pages of one process that
+   are close together in its address space, which is also what
+   page_load() reads back together.  See frame.c and page.c.
+
+   The bitmap and the counts are protected by turning off
+   interrupts.  The I/O itself is done with interrupts on, by the
+   owner of the slots. */
+
+/** Number of sectors in a swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/** Swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/** Slots in use. */
+static struct bitmap *used_slots;
+
+/** Number of pages that refer to each slot in use. */
+static uint16_t *slot_refs;
+
+/** Statistics. */
+static long long out_cnt;       /**< # of pages written to swap. */
+static long long out_batch_cnt; /**< # of batches of pages written. */
+static long long in_cnt;        /**< # of pages read from swap. */
+static long long in_batch_cnt;  /**< # of batches of pages read. */
+
+static void transfer (size_t slot, const uintptr_t frames[], size_t cnt,
+                      bool write);
+
+/** Initializes swap space on the swap device, if there is one.
+   Without one, swap_out() always fails. */
+void
+swap_init (void) 
+{
+  size_t slot_cnt = 0;
+
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / SECTORS_PER_SLOT;
+  used_slots = bitmap_create (slot_cnt);
+  slot_refs = calloc (slot_cnt, sizeof *slot_refs);
+  if (used_slots == NULL || (slot_cnt > 0 && slot_refs == NULL))
+    PANIC ("swap table allocation failed--swap device is too large");
+}
+
+/** Writes the CNT pages in FRAMES, at most SWAP_CLUSTER of them,
+   to CNT consecutive free swap slots.  Returns the index of the
+   first slot, or SWAP_NONE if swap has no run of CNT free
+   slots. */
+size_t
+swap_out (const uintptr_t frames[], size_t cnt) 
+{
+  enum intr_level old_level;
+  size_t slot, i;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+  old_level = intr_disable ();
+  slot = bitmap_scan_and_flip (used_slots, 0, cnt, false);
+  if (slot != BITMAP_ERROR)
+    for (i = 0; i < cnt; i++)
+      slot_refs[slot + i] = 1;
+  intr_set_level (old_level);
+  if (slot == BITMAP_ERROR)
+    return SWAP_NONE;
+
+  transfer (slot, frames, cnt, true);
+  out_cnt += cnt;
+  out_batch_cnt++;
+  return slot;
+}
+
+/** Reads the CNT pages in the consecutive swap slots starting at
+   SLOT into FRAMES, and drops a reference to each slot, freeing
+   the ones that no other page refers to. */
+void
+swap_in (size_t slot, const uintptr_t frames[], size_t cnt) 
+{
+  size_t i;
+
+  ASSERT (slot != SWAP_NONE);
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+  ASSERT (bitmap_all (used_slots, slot, cnt));
+
+  transfer (slot, frames, cnt, false);
+  in_cnt += cnt;
+  in_batch_cnt++;
+
+  for (i = 0; i < cnt; i++)
+    swap_free (slot + i);
+}
+
+/** Adds a reference to swap slot SLOT, for another page with the
+   same contents, which is then also read back from the slot or
+   freed with swap_free(). */
+void
+swap_dup (size_t slot) 
+{
+  enum intr_level old_level;
+
+  ASSERT (bitmap_test (used_slots, slot));
+  ASSERT (slot_refs[slot] < UINT16_MAX);
+
+  old_level = intr_disable ();
+  slot_refs[slot]++;
+  intr_set_level (old_level);
+}
+
+/** Drops a reference to swap slot SLOT without reading it, and
+   frees the slot if no other page refers to it. */
+void
+swap_free (size_t slot) 
+{
+  enum intr_level old_level;
+
+  ASSERT (bitmap_test (used_slots, slot));
+
+  old_level = intr_disable ();
+  if (--slot_refs[slot] == 0)
+    bitmap_reset (used_slots, slot);
+  intr_set_level (old_level);
+}
+
+/** Prints swap statistics. */
+void
+swap_print_stats (void) 
+{
+  if (used_slots == NULL)
+    return;
+  printf ("Swap: %zu of %zu slots in use, "
+          "%lld pages written in %lld batches, "
+          "%lld pages read in %lld batches\n",
+          bitmap_count (used_slots, 0, bitmap_size (used_slots), true),
+          bitmap_size (used_slots), out_cnt, out_batch_cnt,
+          in_cnt, in_batch_cnt);
+}
+
+/** Writes the CNT pages in FRAMES to the consecutive swap slots
+   starting at SLOT, if WRITE is true, or reads them from the
+   slots otherwise, in order of sector. */
+static void
+transfer (size_t slot, const uintptr_t frames[], size_t cnt, bool write) 
+{
+  block_sector_t sector = slot * SECTORS_PER_SLOT;
+  size_t i;
+  int j;
+
+  for (i = 0; i < cnt; i++) 
+    {
+      uint8_t *kpage = kmap (frames[i]);
+      for (j = 0; j < SECTORS_PER_SLOT; j++, sector++)
+        if (write)
+          block_write (swap_device, sector, kpage + j * BLOCK_SECTOR_SIZE);
+        else
+          block_read (swap_device, sector, kpage + j * BLOCK_SECTOR_SIZE);
+      kunmap (kpage);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A swap slot index that refers to no slot. */
+#define SWAP_NONE SIZE_MAX
+
+/** Maximum number of pages swapped out or in together.  Pages
+   are swapped together only if they are in the same aligned
+   group of this many virtual pages. */
+#define SWAP_CLUSTER 8
+
+void swap_init (void);
+size_t swap_out (const uintptr_t frames[], size_t cnt);
+void swap_in (size_t slot, const uintptr_t frames[], size_t cnt);
+void swap_dup (size_t slot);
+void swap_free (size_t slot);
+void swap_print_stats (void);
+
+#endif /**< vm/swap.h */